@@ -71,7 +71,145 @@ struct MkvsynthPixel {
 	};
 };
 
+/*******************************************************************************
+ * Also see getPlanes()                                                        *
+ *                                                                             *
+ * Where each plane of a frame is. An interleaved frame has 1 plane holding    *
+ * every channel, a planar frame has 1 plane per channel. Plane 'i' starts at  *
+ * data[i], and each of its rows starts linesize[i] bytes after the one above  *
+ * it. width[i] is the number of samples in a row of the plane, each of them   *
+ * sampleBytes long.                                                           *
+ ******************************************************************************/
+
+typedef struct MkvsynthPlanes MkvsynthPlanes;
+
+struct MkvsynthPlanes {
+	int count;
+	int sampleBytes;
+	uint8_t *data[3];
+	int linesize[3];
+	int width[3];
+	int height[3];
+};
+
+/*******************************************************************************
+ * Also see prepareConversion() and convertSamples()                           *
+ *                                                                             *
+ * How to convert rows of samples from one colorspace to another. fromModel    *
+ * and toModel are the 16 bit interleaved colorspaces with the same colour     *
+ * model as the two colorspaces, and fromDepth and toDepth their depths.       *
+ * toYuv and toRgb are the YCbCr matrices, with 14 fractional bits. For an 8   *
+ * bit input, lookup holds what the first matrix does to every input sample,   *
+ * see prepareConversion().                                                    *
+ ******************************************************************************/
+
+typedef struct MkvsynthConversion MkvsynthConversion;
+
+struct MkvsynthConversion {
+	c_space fromModel;
+	c_space toModel;
+	int fromDepth;
+	int toDepth;
+	int16_t toYuv[9];
+	int16_t toRgb[9];
+	int32_t lookup[3][3][256];
+};
+
+/*******************************************************************************
+ * Also see getLookupTables()                                                  *
+ *                                                                             *
+ * What the conversions work out for each value of an 8 bit sample. The first  *
+ * part follows the expressions of getRed(), getLuma() and the rest of         *
+ * pixels.c (see rowToRgb()), the last part the 8 bit samples that go into     *
+ * convertSamples(), as a fraction of 1 and, for hue, as a sector of the       *
+ * colour wheel and the fraction of the chroma that the middle channel gets.   *
+ ******************************************************************************/
+
+typedef struct MkvsynthLookupTables MkvsynthLookupTables;
+
+struct MkvsynthLookupTables {
+	double lumaRed[256];
+	double lumaGreen[256];
+	double lumaBlue[256];
+	double cbRed[256];
+	double cbGreen[256];
+	double cbBlue[256];
+	double crRed[256];
+	double crGreen[256];
+	double crBlue[256];
+
+	double redCr[256];
+	double greenCb[256];
+	double greenCr[256];
+	double blueCb[256];
+
+	float hsvHue[256];
+	float hsvSaturation[256];
+	float hsvValue[256];
+	uint8_t hsvCase[256][3];
+
+	double unitSample[256];
+	int hueSector[256];
+	double hueFactor[256];
+};
+
+/*******************************************************************************
+ * Also see setupKernels()                                                     *
+ *                                                                             *
+ * The pixel kernels that have a version for more than one instruction set.    *
+ * There is a single table (mkvsynthKernels), filled in by setupKernels()      *
+ * with the versions for the widest level the CPU has. Until then it holds the *
+ * scalar versions, which work everywhere.                                     *
+ ******************************************************************************/
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MKVSYNTH_X86
+#endif
+
+#define MKVS_CPU_SCALAR 0
+#define MKVS_CPU_SSE41  1
+#define MKVS_CPU_AVX2   2
+#define MKVS_CPU_AVX512 3
+
+typedef struct MkvsynthKernels MkvsynthKernels;
+
+struct MkvsynthKernels {
+	int level;
+	void (*multiplyMatrix)(uint16_t *samples, int count, int16_t const *matrix);
+};
+
+/*******************************************************************************
+ * Also see MKVSYNTH_SPECIALISE                                                *
+ *                                                                             *
+ * What a loop over the samples of a colorspace needs to know about it: how    *
+ * many bytes a sample takes, whether every channel has a plane of its own,    *
+ * and how far the Cb and Cr planes are subsampled. A kernel specialised for a *
+ * colorspace gets its layout as a constant, so that the compiler can take     *
+ * every branch on it out of the loop. An MkvsynthLayoutRow points at the same *
+ * row of every plane, see layoutRow().                                        *
+ ******************************************************************************/
+
+typedef struct MkvsynthLayout MkvsynthLayout;
+
+struct MkvsynthLayout {
+	int sampleBytes;
+	int planar;
+	int widthShift;
+	int heightShift;
+};
+
+typedef struct MkvsynthLayoutRow MkvsynthLayoutRow;
+
+struct MkvsynthLayoutRow {
+	uint8_t *lines[3];
+	int chromaRow;
+};
+
 #include "pixels.h"
 #include "properties.h"
+#include "conversion.h"
+#include "dispatch.h"
+#include "lookup.h"
+#include "layouts.h"
 
 #endif
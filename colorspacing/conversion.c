@@ -0,0 +1,520 @@
+#include "conversion.h"
+#include <math.h>
+#include <string.h>
+
+#ifdef MKVSYNTH_X86
+#include <immintrin.h>
+#endif
+
+/******************************************************************************
+ * Also see MkvsynthConversion and convertColorspace                          *
+ *                                                                            *
+ * Any colorspace is converted to any other by way of 16 bit samples (see     *
+ * getRow()): the samples are widened to 16 bits, turned into RGB, turned     *
+ * into the colour model of the output, and narrowed to the depth of the      *
+ * output. Going from 8 to 16 bits multiplies by 257 so that 255 becomes      *
+ * 65535, except for Cb and Cr, which are shifted up so that 128 stays in the *
+ * middle. Going from 16 to 8 bits keeps the high byte.                       *
+ *                                                                            *
+ * YCbCr is full range, like the rest of colorspacing, and uses the BT.601 or *
+ * BT.709 coefficients. The matrices are fixed point with 14 fractional bits, *
+ * and work on samples that have had 32768 taken off, so that every sample    *
+ * and every coefficient fits in an int16_t and a pair of them can be         *
+ * multiplied and added in a single instruction (pmaddwd). The scalar,        *
+ * SSE4.1, AVX2 and AVX-512 versions give exactly the same results, and       *
+ * setupKernels() picks the one to use.                                       *
+ *****************************************************************************/
+
+// Multiplies every pixel of 'samples' by the 3x3 Q14 'matrix', row by row
+void matrixScalar(uint16_t *samples, int count, int16_t const *matrix) {
+	int i, channel;
+	for(i = 0; i < count; i++) {
+		uint16_t *pixel = samples + 3 * i;
+		int a = pixel[0] - 32768;
+		int b = pixel[1] - 32768;
+		int c = pixel[2] - 32768;
+
+		int result[3];
+		for(channel = 0; channel < 3; channel++) {
+			int16_t const *row = matrix + 3 * channel;
+			int value = (row[0] * a + row[1] * b + row[2] * c + 8192) >> 14;
+			result[channel] = value < -32768 ? 0 : value > 32767 ? 65535 : value + 32768;
+		}
+
+		pixel[0] = result[0];
+		pixel[1] = result[1];
+		pixel[2] = result[2];
+	}
+}
+
+#ifdef MKVSYNTH_X86
+// Each pair of coefficients of a row goes into an int32, for pmaddwd: the
+// first two, then the third and the rounding (which gets multiplied by 1)
+static uint32_t coefficientPair(int16_t first, int16_t second) {
+	return (uint16_t)first | (uint32_t)(uint16_t)second << 16;
+}
+
+// matrixScalar for 8 pixels at a time. packus (SSE4.1) puts the 32768 back
+// and clamps to 0 - 65535 in one go
+__attribute__((target("sse4.1")))
+void matrixSSE41(uint16_t *samples, int count, int16_t const *matrix) {
+	int16_t channels[3][8] __attribute__((aligned(16)));
+	__m128i sign = _mm_set1_epi16(-32768);
+	__m128i one = _mm_set1_epi16(1);
+	__m128i middle = _mm_set1_epi32(32768);
+
+	__m128i firstPair[3], secondPair[3];
+	int channel, i, j;
+	for(channel = 0; channel < 3; channel++) {
+		int16_t const *row = matrix + 3 * channel;
+		firstPair[channel] = _mm_set1_epi32(coefficientPair(row[0], row[1]));
+		secondPair[channel] = _mm_set1_epi32(coefficientPair(row[2], 8192));
+	}
+
+	for(i = 0; i + 8 <= count; i += 8) {
+		for(j = 0; j < 8; j++) {
+			channels[0][j] = samples[3 * (i + j)];
+			channels[1][j] = samples[3 * (i + j) + 1];
+			channels[2][j] = samples[3 * (i + j) + 2];
+		}
+
+		__m128i a = _mm_xor_si128(_mm_load_si128((__m128i *)channels[0]), sign);
+		__m128i b = _mm_xor_si128(_mm_load_si128((__m128i *)channels[1]), sign);
+		__m128i c = _mm_xor_si128(_mm_load_si128((__m128i *)channels[2]), sign);
+		__m128i abLow = _mm_unpacklo_epi16(a, b);
+		__m128i abHigh = _mm_unpackhi_epi16(a, b);
+		__m128i cLow = _mm_unpacklo_epi16(c, one);
+		__m128i cHigh = _mm_unpackhi_epi16(c, one);
+
+		for(channel = 0; channel < 3; channel++) {
+			__m128i low = _mm_add_epi32(_mm_madd_epi16(abLow, firstPair[channel]), _mm_madd_epi16(cLow, secondPair[channel]));
+			__m128i high = _mm_add_epi32(_mm_madd_epi16(abHigh, firstPair[channel]), _mm_madd_epi16(cHigh, secondPair[channel]));
+			low = _mm_add_epi32(_mm_srai_epi32(low, 14), middle);
+			high = _mm_add_epi32(_mm_srai_epi32(high, 14), middle);
+			_mm_store_si128((__m128i *)channels[channel], _mm_packus_epi32(low, high));
+		}
+
+		for(j = 0; j < 8; j++) {
+			samples[3 * (i + j)] = channels[0][j];
+			samples[3 * (i + j) + 1] = channels[1][j];
+			samples[3 * (i + j) + 2] = channels[2][j];
+		}
+	}
+
+	matrixScalar(samples + 3 * i, count - i, matrix);
+}
+
+// matrixScalar for 16 pixels at a time, leaving the rest to matrixSSE41. The
+// unpacks work within each half of the registers, and so does the pack, so
+// the pixels come out in order
+__attribute__((target("avx2")))
+void matrixAVX2(uint16_t *samples, int count, int16_t const *matrix) {
+	int16_t channels[3][16] __attribute__((aligned(32)));
+	__m256i sign = _mm256_set1_epi16(-32768);
+	__m256i one = _mm256_set1_epi16(1);
+	__m256i middle = _mm256_set1_epi32(32768);
+
+	__m256i firstPair[3], secondPair[3];
+	int channel, i, j;
+	for(channel = 0; channel < 3; channel++) {
+		int16_t const *row = matrix + 3 * channel;
+		firstPair[channel] = _mm256_set1_epi32(coefficientPair(row[0], row[1]));
+		secondPair[channel] = _mm256_set1_epi32(coefficientPair(row[2], 8192));
+	}
+
+	for(i = 0; i + 16 <= count; i += 16) {
+		for(j = 0; j < 16; j++) {
+			channels[0][j] = samples[3 * (i + j)];
+			channels[1][j] = samples[3 * (i + j) + 1];
+			channels[2][j] = samples[3 * (i + j) + 2];
+		}
+
+		__m256i a = _mm256_xor_si256(_mm256_load_si256((__m256i *)channels[0]), sign);
+		__m256i b = _mm256_xor_si256(_mm256_load_si256((__m256i *)channels[1]), sign);
+		__m256i c = _mm256_xor_si256(_mm256_load_si256((__m256i *)channels[2]), sign);
+		__m256i abLow = _mm256_unpacklo_epi16(a, b);
+		__m256i abHigh = _mm256_unpackhi_epi16(a, b);
+		__m256i cLow = _mm256_unpacklo_epi16(c, one);
+		__m256i cHigh = _mm256_unpackhi_epi16(c, one);
+
+		for(channel = 0; channel < 3; channel++) {
+			__m256i low = _mm256_add_epi32(_mm256_madd_epi16(abLow, firstPair[channel]), _mm256_madd_epi16(cLow, secondPair[channel]));
+			__m256i high = _mm256_add_epi32(_mm256_madd_epi16(abHigh, firstPair[channel]), _mm256_madd_epi16(cHigh, secondPair[channel]));
+			low = _mm256_add_epi32(_mm256_srai_epi32(low, 14), middle);
+			high = _mm256_add_epi32(_mm256_srai_epi32(high, 14), middle);
+			_mm256_store_si256((__m256i *)channels[channel], _mm256_packus_epi32(low, high));
+		}
+
+		for(j = 0; j < 16; j++) {
+			samples[3 * (i + j)] = channels[0][j];
+			samples[3 * (i + j) + 1] = channels[1][j];
+			samples[3 * (i + j) + 2] = channels[2][j];
+		}
+	}
+
+	matrixSSE41(samples + 3 * i, count - i, matrix);
+}
+
+// matrixScalar for 32 pixels at a time, leaving the rest to matrixAVX2. Needs
+// AVX-512BW for the 16 bit unpacks, pmaddwd and the pack
+__attribute__((target("avx512f,avx512bw")))
+void matrixAVX512(uint16_t *samples, int count, int16_t const *matrix) {
+	int16_t channels[3][32] __attribute__((aligned(64)));
+	__m512i sign = _mm512_set1_epi16(-32768);
+	__m512i one = _mm512_set1_epi16(1);
+	__m512i middle = _mm512_set1_epi32(32768);
+
+	__m512i firstPair[3], secondPair[3];
+	int channel, i, j;
+	for(channel = 0; channel < 3; channel++) {
+		int16_t const *row = matrix + 3 * channel;
+		firstPair[channel] = _mm512_set1_epi32(coefficientPair(row[0], row[1]));
+		secondPair[channel] = _mm512_set1_epi32(coefficientPair(row[2], 8192));
+	}
+
+	for(i = 0; i + 32 <= count; i += 32) {
+		for(j = 0; j < 32; j++) {
+			channels[0][j] = samples[3 * (i + j)];
+			channels[1][j] = samples[3 * (i + j) + 1];
+			channels[2][j] = samples[3 * (i + j) + 2];
+		}
+
+		__m512i a = _mm512_xor_si512(_mm512_load_si512(channels[0]), sign);
+		__m512i b = _mm512_xor_si512(_mm512_load_si512(channels[1]), sign);
+		__m512i c = _mm512_xor_si512(_mm512_load_si512(channels[2]), sign);
+		__m512i abLow = _mm512_unpacklo_epi16(a, b);
+		__m512i abHigh = _mm512_unpackhi_epi16(a, b);
+		__m512i cLow = _mm512_unpacklo_epi16(c, one);
+		__m512i cHigh = _mm512_unpackhi_epi16(c, one);
+
+		for(channel = 0; channel < 3; channel++) {
+			__m512i low = _mm512_add_epi32(_mm512_madd_epi16(abLow, firstPair[channel]), _mm512_madd_epi16(cLow, secondPair[channel]));
+			__m512i high = _mm512_add_epi32(_mm512_madd_epi16(abHigh, firstPair[channel]), _mm512_madd_epi16(cHigh, secondPair[channel]));
+			low = _mm512_add_epi32(_mm512_srai_epi32(low, 14), middle);
+			high = _mm512_add_epi32(_mm512_srai_epi32(high, 14), middle);
+			_mm512_store_si512(channels[channel], _mm512_packus_epi32(low, high));
+		}
+
+		for(j = 0; j < 32; j++) {
+			samples[3 * (i + j)] = channels[0][j];
+			samples[3 * (i + j) + 1] = channels[1][j];
+			samples[3 * (i + j) + 2] = channels[2][j];
+		}
+	}
+
+	matrixAVX2(samples + 3 * i, count - i, matrix);
+}
+#endif
+
+// Turns a sample from 0 to 65535 into a double from 0 to 1, and back
+static double unitSample(uint16_t sample) {
+	return sample / 65535.0;
+}
+
+static uint16_t deepSample(double value) {
+	if(value <= 0)
+		return 0;
+	if(value >= 1)
+		return 65535;
+	return value * 65535 + 0.5;
+}
+
+/******************************************************************************
+ * Hue goes from 0 to 65535 for 0 to 360 degrees, and saturation, value and   *
+ * lightness from 0 to 65535 for 0 to 1, as in the HSV and HSL functions of   *
+ * pixels.c. These are done one pixel at a time in floating point, since      *
+ * every pixel takes a different path.                                        *
+ *****************************************************************************/
+static void rgbToHue(double r, double g, double b, double max, double delta, uint16_t *hue) {
+	double degrees = 0;
+	if(delta > 0) {
+		if(max == r)
+			degrees = 60 * fmod((g - b) / delta + 6, 6);
+		else if(max == g)
+			degrees = 60 * ((b - r) / delta + 2);
+		else
+			degrees = 60 * ((r - g) / delta + 4);
+	}
+
+	*hue = (int)(degrees / 360 * 65536 + 0.5) & 65535;
+}
+
+// Splits a hue into the sector of the colour wheel it is in and the fraction
+// of the chroma that the channel in between gets
+static void hueShape(uint16_t hue, int *sector, double *factor) {
+	double position = hue * 6.0 / 65536;
+	*sector = position;
+	*factor = 1 - fabs(fmod(position, 2) - 1);
+}
+
+// Sets r, g and b from the shape of a hue and the chroma and minimum of the pixel
+static void hueToRgb(int sector, double factor, double chroma, double minimum, double *rgb) {
+	double x = chroma * factor;
+	double r = 0, g = 0, b = 0;
+
+	switch(sector) {
+		case 0: r = chroma; g = x; break;
+		case 1: r = x; g = chroma; break;
+		case 2: g = chroma; b = x; break;
+		case 3: g = x; b = chroma; break;
+		case 4: r = x; b = chroma; break;
+		default: r = chroma; b = x; break;
+	}
+
+	rgb[0] = r + minimum;
+	rgb[1] = g + minimum;
+	rgb[2] = b + minimum;
+}
+
+static void rgbToHsv(uint16_t *samples, int count) {
+	int i;
+	for(i = 0; i < count; i++) {
+		uint16_t *pixel = samples + 3 * i;
+		double r = unitSample(pixel[0]), g = unitSample(pixel[1]), b = unitSample(pixel[2]);
+		double max = fmax(r, fmax(g, b));
+		double delta = max - fmin(r, fmin(g, b));
+
+		rgbToHue(r, g, b, max, delta, &pixel[0]);
+		pixel[1] = deepSample(max > 0 ? delta / max : 0);
+		pixel[2] = deepSample(max);
+	}
+}
+
+// Takes 16 bit samples, or 8 bit samples when given the lookup tables, which
+// hold exactly what the 16 bit path works out for them
+static void hsvToRgb(uint16_t *samples, int count, MkvsynthLookupTables const *lookup) {
+	int i, sector;
+	double factor, value, saturation;
+	for(i = 0; i < count; i++) {
+		uint16_t *pixel = samples + 3 * i;
+		if(lookup != NULL) {
+			sector = lookup->hueSector[pixel[0]];
+			factor = lookup->hueFactor[pixel[0]];
+			saturation = lookup->unitSample[pixel[1]];
+			value = lookup->unitSample[pixel[2]];
+		} else {
+			hueShape(pixel[0], &sector, &factor);
+			saturation = unitSample(pixel[1]);
+			value = unitSample(pixel[2]);
+		}
+
+		double chroma = value * saturation;
+		double rgb[3];
+		hueToRgb(sector, factor, chroma, value - chroma, rgb);
+		pixel[0] = deepSample(rgb[0]);
+		pixel[1] = deepSample(rgb[1]);
+		pixel[2] = deepSample(rgb[2]);
+	}
+}
+
+static void rgbToHsl(uint16_t *samples, int count) {
+	int i;
+	for(i = 0; i < count; i++) {
+		uint16_t *pixel = samples + 3 * i;
+		double r = unitSample(pixel[0]), g = unitSample(pixel[1]), b = unitSample(pixel[2]);
+		double max = fmax(r, fmax(g, b));
+		double min = fmin(r, fmin(g, b));
+		double delta = max - min;
+		double lightness = (max + min) / 2;
+
+		rgbToHue(r, g, b, max, delta, &pixel[0]);
+		pixel[1] = deepSample(delta > 0 ? delta / (1 - fabs(2 * lightness - 1)) : 0);
+		pixel[2] = deepSample(lightness);
+	}
+}
+
+// Takes 8 bit samples with the lookup tables, as hsvToRgb() does
+static void hslToRgb(uint16_t *samples, int count, MkvsynthLookupTables const *lookup) {
+	int i, sector;
+	double factor, lightness, saturation;
+	for(i = 0; i < count; i++) {
+		uint16_t *pixel = samples + 3 * i;
+		if(lookup != NULL) {
+			sector = lookup->hueSector[pixel[0]];
+			factor = lookup->hueFactor[pixel[0]];
+			saturation = lookup->unitSample[pixel[1]];
+			lightness = lookup->unitSample[pixel[2]];
+		} else {
+			hueShape(pixel[0], &sector, &factor);
+			saturation = unitSample(pixel[1]);
+			lightness = unitSample(pixel[2]);
+		}
+
+		double chroma = (1 - fabs(2 * lightness - 1)) * saturation;
+		double rgb[3];
+		hueToRgb(sector, factor, chroma, lightness - chroma / 2, rgb);
+		pixel[0] = deepSample(rgb[0]);
+		pixel[1] = deepSample(rgb[1]);
+		pixel[2] = deepSample(rgb[2]);
+	}
+}
+
+/******************************************************************************
+ * prepareConversion sets up 'conversion' to go from colorspace 'from' to     *
+ * colorspace 'to', using 'matrix' (MKVS_BT601 or MKVS_BT709) for YCbCr. It   *
+ * is called once, when the filter is created, and convertSamples() then      *
+ * does the work for every row.                                               *
+ *****************************************************************************/
+void prepareConversion(MkvsynthConversion *conversion, c_space from, c_space to, int matrix) {
+	MkvsynthMetaData fromMetaData = { .colorspace = from };
+	MkvsynthMetaData toMetaData = { .colorspace = to };
+
+	conversion->fromModel = getDeepColorspace(from);
+	conversion->toModel = getDeepColorspace(to);
+	conversion->fromDepth = getDepth(&fromMetaData);
+	conversion->toDepth = getDepth(&toMetaData);
+
+	double kr = matrix == MKVS_BT709 ? 0.2126 : 0.299;
+	double kb = matrix == MKVS_BT709 ? 0.0722 : 0.114;
+	double kg = 1 - kr - kb;
+
+	double toYuv[9] = {
+		kr,                    kg,                    kb,
+		-kr / (2 * (1 - kb)),  -kg / (2 * (1 - kb)),  0.5,
+		0.5,                   -kg / (2 * (1 - kr)),  -kb / (2 * (1 - kr)),
+	};
+
+	double toRgb[9] = {
+		1,  0,                          2 * (1 - kr),
+		1,  -2 * (1 - kb) * kb / kg,    -2 * (1 - kr) * kr / kg,
+		1,  2 * (1 - kb),               0,
+	};
+
+	int i;
+	for(i = 0; i < 9; i++) {
+		conversion->toYuv[i] = lround(toYuv[i] * 16384);
+		conversion->toRgb[i] = lround(toRgb[i] * 16384);
+	}
+
+	// An 8 bit input that starts with a matrix gets the products of every
+	// coefficient and every (widened) sample, with the rounding folded into
+	// the first channel, so matrixLookup() only has to add them up
+	int16_t const *first = conversion->fromModel == MKVS_YUV444_48 ? conversion->toRgb : conversion->toYuv;
+	int channel, input, sample;
+	for(channel = 0; channel < 3; channel++) {
+		for(input = 0; input < 3; input++) {
+			for(sample = 0; sample < 256; sample++) {
+				int wide = conversion->fromModel == MKVS_YUV444_48 && input > 0 ? sample << 8 : sample * 257;
+				conversion->lookup[channel][input][sample] = first[3 * channel + input] * (wide - 32768) + (input == 0 ? 8192 : 0);
+			}
+		}
+	}
+}
+
+// matrixScalar for 8 bit samples, using the products from prepareConversion()
+static void matrixLookup(uint16_t *samples, int count, int32_t (*lookup)[3][256]) {
+	int i, channel;
+	for(i = 0; i < count; i++) {
+		uint16_t *pixel = samples + 3 * i;
+		int a = pixel[0], b = pixel[1], c = pixel[2];
+
+		int result[3];
+		for(channel = 0; channel < 3; channel++) {
+			int value = (lookup[channel][0][a] + lookup[channel][1][b] + lookup[channel][2][c]) >> 14;
+			result[channel] = value < -32768 ? 0 : value > 32767 ? 65535 : value + 32768;
+		}
+
+		pixel[0] = result[0];
+		pixel[1] = result[1];
+		pixel[2] = result[2];
+	}
+}
+
+/******************************************************************************
+ * widenSamples takes 8 bit samples to 16 bits. Where the conversion starts   *
+ * with a step that only looks at each 8 bit sample on its own (a matrix, or  *
+ * the hue, saturation and value of HSV and HSL), the step is taken along the *
+ * way with the lookup tables, giving exactly the same result as widening     *
+ * first. Returns the colour model the samples are in afterwards.             *
+ *                                                                            *
+ * Adding up 9 products is faster than 9 multiplications, but not faster      *
+ * than the vector kernels, so the matrix is only looked up at the scalar     *
+ * level (see setupKernels()).                                                *
+ *****************************************************************************/
+static c_space widenSamples(MkvsynthConversion *conversion, uint16_t *samples, int count) {
+	c_space from = conversion->fromModel;
+	c_space to = conversion->toModel;
+	int scalar = mkvsynthKernels.level == MKVS_CPU_SCALAR;
+
+	if(scalar && from == MKVS_YUV444_48 && to != from) {
+		matrixLookup(samples, count, conversion->lookup);
+		return MKVS_RGB48;
+	}
+
+	if(scalar && from == MKVS_RGB48 && to == MKVS_YUV444_48) {
+		matrixLookup(samples, count, conversion->lookup);
+		return MKVS_YUV444_48;
+	}
+
+	if(from == MKVS_HSV48 && to != from) {
+		hsvToRgb(samples, count, getLookupTables());
+		return MKVS_RGB48;
+	}
+
+	if(from == MKVS_HSL48 && to != from) {
+		hslToRgb(samples, count, getLookupTables());
+		return MKVS_RGB48;
+	}
+
+	int i;
+	for(i = 0; i < count * 3; i++) {
+		if(from == MKVS_YUV444_48 && i % 3 != 0)
+			samples[i] <<= 8;
+		else
+			samples[i] *= 257;
+	}
+
+	return from;
+}
+
+// Narrows 16 bit samples back to 8 bits
+static void narrowSamples(uint16_t *samples, int count) {
+	int i;
+	for(i = 0; i < count * 3; i++)
+		samples[i] >>= 8;
+}
+
+/******************************************************************************
+ * convertSamples converts 'count' pixels of samples from getRow(), 3 per     *
+ * pixel, in place. The samples come in as the colorspace that 'conversion'   *
+ * converts from, and are ready for putRow() with the colorspace it converts  *
+ * to once it returns.                                                        *
+ *****************************************************************************/
+void convertSamples(MkvsynthConversion *conversion, uint16_t *samples, int count) {
+	c_space model = conversion->fromModel;
+	if(conversion->fromDepth == 8)
+		model = widenSamples(conversion, samples, count);
+
+	if(model != conversion->toModel) {
+		switch(model) {
+			case MKVS_YUV444_48:
+				mkvsynthKernels.multiplyMatrix(samples, count, conversion->toRgb);
+				break;
+			case MKVS_HSV48:
+				hsvToRgb(samples, count, NULL);
+				break;
+			case MKVS_HSL48:
+				hslToRgb(samples, count, NULL);
+				break;
+			default:
+				break;
+		}
+
+		switch(conversion->toModel) {
+			case MKVS_YUV444_48:
+				mkvsynthKernels.multiplyMatrix(samples, count, conversion->toYuv);
+				break;
+			case MKVS_HSV48:
+				rgbToHsv(samples, count);
+				break;
+			case MKVS_HSL48:
+				rgbToHsl(samples, count);
+				break;
+			default:
+				break;
+		}
+	}
+
+	if(conversion->toDepth == 8)
+		narrowSamples(samples, count);
+}
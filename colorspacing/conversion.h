@@ -0,0 +1,15 @@
+#include "colorspacing.h"
+
+#define MKVS_BT601 601
+#define MKVS_BT709 709
+
+void prepareConversion(MkvsynthConversion *conversion, c_space from, c_space to, int matrix);
+void convertSamples(MkvsynthConversion *conversion, uint16_t *samples, int count);
+
+//the matrix kernels for every level, see setupKernels()
+void matrixScalar(uint16_t *samples, int count, int16_t const *matrix);
+#ifdef MKVSYNTH_X86
+void matrixSSE41(uint16_t *samples, int count, int16_t const *matrix);
+void matrixAVX2(uint16_t *samples, int count, int16_t const *matrix);
+void matrixAVX512(uint16_t *samples, int count, int16_t const *matrix);
+#endif
@@ -0,0 +1,75 @@
+#include "dispatch.h"
+#include <stdlib.h>
+#include <string.h>
+
+/******************************************************************************
+ * Also see MkvsynthKernels                                                   *
+ *                                                                            *
+ * The same mkvsynth binary has to run on any x86 machine, so the kernels for *
+ * every instruction set are always compiled in (with target attributes       *
+ * instead of -m flags), and setupKernels asks the CPU which ones it can run. *
+ * It is called once by mkvsynthSpawn(), before any filter is running, so     *
+ * the table never changes while a kernel might be reading from it.           *
+ *                                                                            *
+ * Setting MKVSYNTH_CPU to scalar, sse4.1, avx2 or avx512 uses that level     *
+ * instead, which is handy for comparing the versions. A level that the CPU   *
+ * does not have is turned down to the widest one it does have.               *
+ *****************************************************************************/
+MkvsynthKernels mkvsynthKernels = { MKVS_CPU_SCALAR, matrixScalar };
+
+static char const *levelNames[] = { "scalar", "sse4.1", "avx2", "avx512" };
+
+char const *kernelLevelName(int level) {
+	return levelNames[level];
+}
+
+// Returns the widest level that the CPU (and the OS, for the wider registers) supports
+static int detectLevel() {
+#ifdef MKVSYNTH_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		return MKVS_CPU_AVX512;
+	if(__builtin_cpu_supports("avx2"))
+		return MKVS_CPU_AVX2;
+	if(__builtin_cpu_supports("sse4.1"))
+		return MKVS_CPU_SSE41;
+#endif
+	return MKVS_CPU_SCALAR;
+}
+
+void setupKernels() {
+	int level = detectLevel();
+
+	char const *forced = getenv("MKVSYNTH_CPU");
+	if(forced != NULL && forced[0] != '\0') {
+		int i, chosen = -1;
+		for(i = 0; i < sizeof(levelNames) / sizeof(levelNames[0]); i++) {
+			if(strcmp(forced, levelNames[i]) == 0)
+				chosen = i;
+		}
+
+		if(chosen < 0)
+			MkvsynthError("MKVSYNTH_CPU is set to %s, try scalar, sse4.1, avx2 or avx512", forced);
+		if(chosen > level)
+			MkvsynthMessage("MKVSYNTH_CPU asks for %s, but this CPU only has %s", forced, levelNames[level]);
+		else
+			level = chosen;
+	}
+
+	mkvsynthKernels.level = level;
+	mkvsynthKernels.multiplyMatrix = matrixScalar;
+
+#ifdef MKVSYNTH_X86
+	switch(level) {
+		case MKVS_CPU_AVX512:
+			mkvsynthKernels.multiplyMatrix = matrixAVX512;
+			break;
+		case MKVS_CPU_AVX2:
+			mkvsynthKernels.multiplyMatrix = matrixAVX2;
+			break;
+		case MKVS_CPU_SSE41:
+			mkvsynthKernels.multiplyMatrix = matrixSSE41;
+			break;
+	}
+#endif
+}
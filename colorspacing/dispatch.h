@@ -0,0 +1,6 @@
+#include "colorspacing.h"
+
+extern MkvsynthKernels mkvsynthKernels;
+
+void setupKernels();
+char const *kernelLevelName(int level);
@@ -0,0 +1,112 @@
+#ifndef LAYOUTS_H_
+#define LAYOUTS_H_
+
+#include "colorspacing.h"
+
+/*******************************************************************************
+ * Also see MkvsynthLayout                                                     *
+ *                                                                             *
+ * MKVSYNTH_LAYOUTS calls X(name, colorspace, sampleBytes, planar, widthShift, *
+ * heightShift) for every colorspace, with the values of its MkvsynthLayout.   *
+ *                                                                             *
+ * MKVSYNTH_SPECIALISE(name) takes a row kernel that was written once, as a    *
+ * function with the arguments of an MkvsynthRowKernel and an MkvsynthLayout   *
+ * (marked MKVSYNTH_GENERIC), and turns it into one MkvsynthRowKernel per      *
+ * colorspace, name_MKVS_RGB24 and so on, each with its layout filled in as a  *
+ * constant. nameKernel(colorspace) returns the right one, so a filter looks   *
+ * at the colorspace once per frame instead of once per sample:                *
+ *                                                                             *
+ *     MKVSYNTH_GENERIC void cropRows(..., MkvsynthLayout layout) { ... }      *
+ *     MKVSYNTH_SPECIALISE(cropRows)                                           *
+ *                                                                             *
+ *     processRows(cropRowsKernel(colorspace), params, input, output, ...);    *
+ *                                                                             *
+ * Inside the kernel, layoutRow(), layoutGet() and layoutPut() read and write  *
+ * samples the way getRow() and putRow() do, for a constant layout.            *
+ ******************************************************************************/
+
+#define MKVSYNTH_LAYOUTS(X, name)                                              \
+	X(name, MKVS_RGB48,            2, 0, 0, 0)                                 \
+	X(name, MKVS_RGB24,            1, 0, 0, 0)                                 \
+	X(name, MKVS_YUV444_48,        2, 0, 0, 0)                                 \
+	X(name, MKVS_YUV444_24,        1, 0, 0, 0)                                 \
+	X(name, MKVS_HSV48,            2, 0, 0, 0)                                 \
+	X(name, MKVS_HSV24,            1, 0, 0, 0)                                 \
+	X(name, MKVS_HSL48,            2, 0, 0, 0)                                 \
+	X(name, MKVS_HSL24,            1, 0, 0, 0)                                 \
+	X(name, MKVS_RGB48_PLANAR,     2, 1, 0, 0)                                 \
+	X(name, MKVS_RGB24_PLANAR,     1, 1, 0, 0)                                 \
+	X(name, MKVS_YUV444_48_PLANAR, 2, 1, 0, 0)                                 \
+	X(name, MKVS_YUV444_24_PLANAR, 1, 1, 0, 0)                                 \
+	X(name, MKVS_HSV48_PLANAR,     2, 1, 0, 0)                                 \
+	X(name, MKVS_HSV24_PLANAR,     1, 1, 0, 0)                                 \
+	X(name, MKVS_HSL48_PLANAR,     2, 1, 0, 0)                                 \
+	X(name, MKVS_HSL24_PLANAR,     1, 1, 0, 0)                                 \
+	X(name, MKVS_YUV420_12,        1, 1, 1, 1)                                 \
+	X(name, MKVS_YUV420_24,        2, 1, 1, 1)                                 \
+	X(name, MKVS_YUV422_16,        1, 1, 1, 0)                                 \
+	X(name, MKVS_YUV422_32,        2, 1, 1, 0)
+
+// The generic body has to be inlined into every specialised kernel
+#define MKVSYNTH_GENERIC static inline __attribute__((always_inline))
+
+#define MKVSYNTH_LAYOUT_KERNEL(name, colorspace, sampleBytes, planar, widthShift, heightShift) \
+	static void name##_##colorspace(void *filterParams, uint8_t *input, uint8_t *output, int firstRow, int lastRow) { \
+		MkvsynthLayout layout = { sampleBytes, planar, widthShift, heightShift };                 \
+		name(filterParams, input, output, firstRow, lastRow, layout);                             \
+	}
+
+#define MKVSYNTH_LAYOUT_CASE(name, colorspace, sampleBytes, planar, widthShift, heightShift) \
+		case colorspace:                                                       \
+			return name##_##colorspace;
+
+#define MKVSYNTH_SPECIALISE(name)                                              \
+	MKVSYNTH_LAYOUTS(MKVSYNTH_LAYOUT_KERNEL, name)                             \
+	static MkvsynthRowKernel name##Kernel(c_space colorspace) {                \
+		switch(colorspace) {                                                   \
+			MKVSYNTH_LAYOUTS(MKVSYNTH_LAYOUT_CASE, name)                       \
+			default:                                                           \
+				MkvsynthError("This colorspace is unrecognized");              \
+				return NULL;                                                   \
+		}                                                                      \
+	}
+
+// Points 'row' at row 'y' of every plane in 'planes' (see getPlanes())
+MKVSYNTH_GENERIC void layoutRow(MkvsynthPlanes const *planes, MkvsynthLayout layout, int y, MkvsynthLayoutRow *row) {
+	row->lines[0] = planes->data[0] + y * planes->linesize[0];
+	if(layout.planar) {
+		int chromaY = y >> layout.heightShift;
+		row->lines[1] = planes->data[1] + chromaY * planes->linesize[1];
+		row->lines[2] = planes->data[2] + chromaY * planes->linesize[2];
+	}
+
+	row->chromaRow = (y & ((1 << layout.heightShift) - 1)) == 0;
+}
+
+// Returns sample 'channel' of pixel 'x', subsampled Cb and Cr samples are
+// shared by every pixel of their block
+MKVSYNTH_GENERIC uint16_t layoutGet(MkvsynthLayoutRow const *row, MkvsynthLayout layout, int x, int channel) {
+	uint8_t *line = layout.planar ? row->lines[channel] : row->lines[0];
+	int index = !layout.planar ? 3 * x + channel : channel > 0 ? x >> layout.widthShift : x;
+
+	if(layout.sampleBytes == 2)
+		return ((uint16_t *)line)[index];
+	return line[index];
+}
+
+// Sets sample 'channel' of pixel 'x'. As in putRow(), only the top left
+// pixel of a block writes its Cb and Cr samples
+MKVSYNTH_GENERIC void layoutPut(MkvsynthLayoutRow const *row, MkvsynthLayout layout, int x, int channel, uint16_t value) {
+	if(channel > 0 && (!row->chromaRow || (x & ((1 << layout.widthShift) - 1)) != 0))
+		return;
+
+	uint8_t *line = layout.planar ? row->lines[channel] : row->lines[0];
+	int index = !layout.planar ? 3 * x + channel : channel > 0 ? x >> layout.widthShift : x;
+
+	if(layout.sampleBytes == 2)
+		((uint16_t *)line)[index] = value;
+	else
+		line[index] = value;
+}
+
+#endif
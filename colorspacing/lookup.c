@@ -0,0 +1,198 @@
+#include "lookup.h"
+#include <math.h>
+
+/******************************************************************************
+ * Also see MkvsynthLookupTables                                              *
+ *                                                                            *
+ * An 8 bit sample only has 256 values, so whatever a conversion does to one  *
+ * channel on its own can be worked out once for each of them and looked up   *
+ * afterwards. The tables are filled in the first time they are asked for,    *
+ * and shared by every filter from then on.                                   *
+ *                                                                            *
+ * The tables hold exactly the values that the expressions in getRed() and    *
+ * the rest work out along the way, in the same type (float or double), and   *
+ * the lookups are put back together in the same order. rowToRgb() and        *
+ * rowToYCbCr() therefore give the same results as calling the functions of   *
+ * pixels.c for every pixel, down to the last bit, only without doing the     *
+ * multiplications (and for HSV, the divisions and the loop) every time.      *
+ *****************************************************************************/
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+static MkvsynthLookupTables tables;
+
+static void fillTables() {
+	int i;
+	for(i = 0; i < 256; i++) {
+		float sample = i;
+
+		// RGB24 to YCbCr, as in getLuma(), getCb() and getCr()
+		tables.lumaRed[i] = sample * .299;
+		tables.lumaGreen[i] = sample * .587;
+		tables.lumaBlue[i] = sample * .114;
+		tables.cbRed[i] = .169 * sample;
+		tables.cbGreen[i] = .331 * sample;
+		tables.cbBlue[i] = 128 + .5 * sample;
+		tables.crRed[i] = 128 + .5 * sample;
+		tables.crGreen[i] = .419 * sample;
+		tables.crBlue[i] = .081 * sample;
+
+		// YUV444_24 to RGB, as in getRed(), getGreen() and getBlue()
+		tables.redCr[i] = 1.4 * (sample - 128);
+		tables.greenCb[i] = .343 * (sample - 128);
+		tables.greenCr[i] = .711 * (sample - 128);
+		tables.blueCb[i] = 1.765 * (sample - 128);
+
+		// HSV24 to RGB, the hue part goes exactly as in getRed()
+		float hdeg = sample * 360.0 / 256.0;
+		float tempx = hdeg / 60.0;
+		while(tempx > 2.0)
+			tempx -= 2.0;
+		tempx -= 1;
+		if(tempx < 0)
+			tempx *= -1.0;
+
+		tables.hsvHue[i] = tempx;
+		tables.hsvSaturation[i] = sample / 256.0;
+		tables.hsvValue[i] = sample / 256.0;
+
+		// Which of hc + hm (0), hm (1) and hx + hm (2) each of red, green
+		// and blue comes out as
+		tables.hsvCase[i][0] = hdeg < 60 || hdeg >= 300 ? 0 : hdeg >= 120 && hdeg < 240 ? 1 : 2;
+		tables.hsvCase[i][1] = hdeg >= 60 && hdeg < 180 ? 0 : hdeg >= 240 ? 1 : 2;
+		tables.hsvCase[i][2] = hdeg >= 180 && hdeg < 300 ? 0 : hdeg < 120 ? 1 : 2;
+
+		// 8 bit samples widened to 16 bits as a fraction of 1, and the
+		// hue turned into a sector of the colour wheel and a fraction of
+		// the chroma, see convertSamples()
+		double hueSector = i * 257 * 6.0 / 65536;
+		tables.unitSample[i] = i * 257 / 65535.0;
+		tables.hueSector[i] = hueSector;
+		tables.hueFactor[i] = 1 - fabs(fmod(hueSector, 2) - 1);
+	}
+}
+
+// Returns the tables, filling them in the first time
+MkvsynthLookupTables const *getLookupTables() {
+	pthread_once(&tablesOnce, fillTables);
+	return &tables;
+}
+
+// Does what getRed(), getGreen() and getBlue() do, for every pixel
+static void rowToRgbPixels(uint16_t *samples, MkvsynthMetaData *metaData, int count) {
+	int i;
+	for(i = 0; i < count; i++) {
+		MkvsynthPixel pixel = getRowPixel(samples, metaData, i);
+		samples[3*i]     = getRed(&pixel, metaData);
+		samples[3*i + 1] = getGreen(&pixel, metaData);
+		samples[3*i + 2] = getBlue(&pixel, metaData);
+	}
+}
+
+static void rowToYCbCrPixels(uint16_t *samples, MkvsynthMetaData *metaData, int count) {
+	int i;
+	for(i = 0; i < count; i++) {
+		MkvsynthPixel pixel = getRowPixel(samples, metaData, i);
+		samples[3*i]     = getLuma(&pixel, metaData);
+		samples[3*i + 1] = getCb(&pixel, metaData);
+		samples[3*i + 2] = getCr(&pixel, metaData);
+	}
+}
+
+/******************************************************************************
+ * rowToRgb replaces 'count' pixels of samples from getRow() with the values  *
+ * that getRed(), getGreen() and getBlue() would give for them, 16 bits each. *
+ * 8 bit colorspaces use the lookup tables, anything else is done one pixel   *
+ * at a time with the functions themselves.                                   *
+ *****************************************************************************/
+void rowToRgb(uint16_t *samples, MkvsynthMetaData *metaData, int count) {
+	MkvsynthLookupTables const *lookup = getLookupTables();
+
+	int i, channel;
+	switch(getInterleavedColorspace(metaData->colorspace)) {
+		case MKVS_RGB24:
+			for(i = 0; i < count * 3; i++)
+				samples[i] *= 256;
+			break;
+
+		case MKVS_YUV444_24:
+			for(i = 0; i < count; i++) {
+				uint16_t *pixel = samples + 3 * i;
+				int y = pixel[0], u = pixel[1], v = pixel[2];
+
+				float red = y + lookup->redCr[v];
+				float green = y - lookup->greenCb[u] - lookup->greenCr[v];
+				float blue = y + lookup->blueCb[u];
+				red *= 256;
+				red += .5;
+				green *= 256;
+				green += .5;
+				blue *= 256;
+				blue += .5;
+
+				pixel[0] = red >= 65535 ? 65535 : (int)red;
+				pixel[1] = green <= 0 ? 0 : (int)green;
+				pixel[2] = blue >= 65535 ? 65535 : (int)blue;
+			}
+			break;
+
+		case MKVS_HSV24:
+			for(i = 0; i < count; i++) {
+				uint16_t *pixel = samples + 3 * i;
+				float fsat = lookup->hsvSaturation[pixel[1]];
+				float fval = lookup->hsvValue[pixel[2]];
+				float hc = fsat * fval;
+				float hm = fval - hc;
+				float hx = hc * lookup->hsvHue[pixel[0]];
+
+				float result[3] = { hc + hm, hm, hx + hm };
+				uint8_t const *cases = lookup->hsvCase[pixel[0]];
+				for(channel = 0; channel < 3; channel++) {
+					float value = result[cases[channel]];
+					value *= 65535;
+					pixel[channel] = (int)value;
+				}
+			}
+			break;
+
+		default:
+			rowToRgbPixels(samples, metaData, count);
+			break;
+	}
+}
+
+// rowToRgb for getLuma(), getCb() and getCr()
+void rowToYCbCr(uint16_t *samples, MkvsynthMetaData *metaData, int count) {
+	MkvsynthLookupTables const *lookup = getLookupTables();
+
+	int i;
+	switch(getInterleavedColorspace(metaData->colorspace)) {
+		case MKVS_RGB24:
+			for(i = 0; i < count; i++) {
+				uint16_t *pixel = samples + 3 * i;
+				int r = pixel[0], g = pixel[1], b = pixel[2];
+
+				float luma = lookup->lumaRed[r] + lookup->lumaGreen[g] + lookup->lumaBlue[b];
+				float cb = lookup->cbBlue[b] - lookup->cbRed[r] - lookup->cbGreen[g];
+				float cr = lookup->crRed[r] - lookup->crGreen[g] - lookup->crBlue[b];
+				luma *= 256;
+				luma += .5;
+				cb *= 256;
+				cb += .5;
+				cr *= 256;
+				cr += .5;
+
+				pixel[0] = (int)luma;
+				pixel[1] = (int)cb;
+				pixel[2] = (int)cr;
+			}
+			break;
+
+		case MKVS_YUV444_24:
+			for(i = 0; i < count * 3; i++)
+				samples[i] *= 256;
+			break;
+
+		default:
+			rowToYCbCrPixels(samples, metaData, count);
+			break;
+	}
+}
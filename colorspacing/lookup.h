@@ -0,0 +1,7 @@
+#include "colorspacing.h"
+
+MkvsynthLookupTables const *getLookupTables();
+
+//the values of getRed() and the rest for a whole row of samples from getRow()
+void rowToRgb(uint16_t *samples, MkvsynthMetaData *metaData, int count);
+void rowToYCbCr(uint16_t *samples, MkvsynthMetaData *metaData, int count);
@@ -1,17 +1,49 @@
 #include "pixels.h"
+#include <string.h>
 
 #ifdef DEBUG
 void checkColorspace (int colorspace, char *functionName) {
-	if(colorspace < 1 || colorspace > 8) {
+	if(colorspace < 1 || colorspace > 20) {
 		printf("%s() debug error: colorspace is not valid.\n", functionName);
 		exit(0);
 	}
 }
 #endif
 
+/******************************************************************************
+ * Finds where the 3 channels of a pixel are, counted in samples (bytes, or   *
+ * uint16_t for 16 bit colorspaces) from the start of the payload. In a       *
+ * planar frame each channel is in a plane of its own, and in a subsampled    *
+ * frame neighbouring pixels share the same Cb and Cr samples.                *
+ *****************************************************************************/
+static void findSamples(MkvsynthMetaData *metaData, int widthOffset, int heightOffset, int *offsets) {
+	int sampleBytes = getDepth(metaData) / 8;
+	int linesize = getLinesize(metaData);
+
+	if(!isPlanar(metaData)) {
+		offsets[0] = heightOffset * linesize / sampleBytes + 3 * widthOffset;
+		offsets[1] = offsets[0] + 1;
+		offsets[2] = offsets[0] + 2;
+		return;
+	}
+
+	int widthShift, heightShift;
+	getChromaShift(metaData, &widthShift, &heightShift);
+	int chromaLinesize = getPlaneLinesize(metaData, 1);
+	int chromaStart = linesize * metaData->height;
+	int chromaBytes = chromaLinesize * (metaData->height >> heightShift);
+	int chromaOffset = (heightOffset >> heightShift) * chromaLinesize / sampleBytes + (widthOffset >> widthShift);
+
+	offsets[0] = heightOffset * linesize / sampleBytes + widthOffset;
+	offsets[1] = chromaStart / sampleBytes + chromaOffset;
+	offsets[2] = (chromaStart + chromaBytes) / sampleBytes + chromaOffset;
+}
+
 /******************************************************************************
  * Pulls a pixel out of payload given the widthOffset and heightOffset.       *
- * Payload starts at (0, 0) in the top left corner of the image.              *
+ * Payload starts at (0, 0) in the top left corner of the image, and each     *
+ * line starts getLinesize() bytes after the one above it. For planar frames  *
+ * each channel comes from its own plane, see findSamples().                  *
  *****************************************************************************/
 
 MkvsynthPixel getPixel (uint8_t *payload, MkvsynthMetaData *metaData, int widthOffset, int heightOffset) {
@@ -22,48 +54,49 @@ MkvsynthPixel getPixel (uint8_t *payload, MkvsynthMetaData *metaData, int widthO
 
 	MkvsynthPixel pixel = {{{0}}};
 	uint16_t *deepPayload = (uint16_t *)payload;
-	int offset = 3 * (heightOffset * metaData->width + widthOffset);
+	int offsets[3];
+	findSamples(metaData, widthOffset, heightOffset, offsets);
 
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
-			pixel.rgb48.r                 = deepPayload[offset];
-			pixel.rgb48.g                 = deepPayload[offset+1];
-			pixel.rgb48.b                 = deepPayload[offset+2];
+			pixel.rgb48.r                 = deepPayload[offsets[0]];
+			pixel.rgb48.g                 = deepPayload[offsets[1]];
+			pixel.rgb48.b                 = deepPayload[offsets[2]];
 			break;
 		case MKVS_RGB24:
-			pixel.rgb24.r                 = payload[offset];
-			pixel.rgb24.g                 = payload[offset+1];
-			pixel.rgb24.b                 = payload[offset+2];
+			pixel.rgb24.r                 = payload[offsets[0]];
+			pixel.rgb24.g                 = payload[offsets[1]];
+			pixel.rgb24.b                 = payload[offsets[2]];
 			break;
 		case MKVS_YUV444_48:
-			pixel.yuv444_48.y             = deepPayload[offset];
-			pixel.yuv444_48.u             = deepPayload[offset+1];
-			pixel.yuv444_48.v             = deepPayload[offset+2];
+			pixel.yuv444_48.y             = deepPayload[offsets[0]];
+			pixel.yuv444_48.u             = deepPayload[offsets[1]];
+			pixel.yuv444_48.v             = deepPayload[offsets[2]];
 			break;
 		case MKVS_YUV444_24:
-			pixel.yuv444_24.y             = payload[offset];
-			pixel.yuv444_24.u             = payload[offset+1];
-			pixel.yuv444_24.v             = payload[offset+2];
+			pixel.yuv444_24.y             = payload[offsets[0]];
+			pixel.yuv444_24.u             = payload[offsets[1]];
+			pixel.yuv444_24.v             = payload[offsets[2]];
 			break;
 		case MKVS_HSV48:
-			pixel.hsv48.h                 = deepPayload[offset];
-			pixel.hsv48.s                 = deepPayload[offset+1];
-			pixel.hsv48.v                 = deepPayload[offset+2];
+			pixel.hsv48.h                 = deepPayload[offsets[0]];
+			pixel.hsv48.s                 = deepPayload[offsets[1]];
+			pixel.hsv48.v                 = deepPayload[offsets[2]];
 			break;
 		case MKVS_HSV24:
-			pixel.hsv24.h                 = payload[offset];
-			pixel.hsv24.s                 = payload[offset+1];
-			pixel.hsv24.v                 = payload[offset+2];
+			pixel.hsv24.h                 = payload[offsets[0]];
+			pixel.hsv24.s                 = payload[offsets[1]];
+			pixel.hsv24.v                 = payload[offsets[2]];
 			break;
 		case MKVS_HSL48:
-			pixel.hsl48.h                 = deepPayload[offset];
-			pixel.hsl48.s                 = deepPayload[offset+1];
-			pixel.hsl48.l                 = deepPayload[offset+2];
+			pixel.hsl48.h                 = deepPayload[offsets[0]];
+			pixel.hsl48.s                 = deepPayload[offsets[1]];
+			pixel.hsl48.l                 = deepPayload[offsets[2]];
 			break;
 		case MKVS_HSL24:
-			pixel.hsl24.h                 = payload[offset];
-			pixel.hsl24.s                 = payload[offset+1];
-			pixel.hsl24.l                 = payload[offset+2];
+			pixel.hsl24.h                 = payload[offsets[0]];
+			pixel.hsl24.s                 = payload[offsets[1]];
+			pixel.hsl24.l                 = payload[offsets[2]];
 			break;
 		case NULL_COLOR:
 			MkvsynthError("The colorspace has not been initialized");
@@ -88,48 +121,49 @@ void putPixel (MkvsynthPixel *pixel, uint8_t *payload, MkvsynthMetaData *metaDat
 #endif
 
 	uint16_t *deepPayload = (uint16_t *)payload;
-	int offset = 3 * (heightOffset * metaData->width + widthOffset);
+	int offsets[3];
+	findSamples(metaData, widthOffset, heightOffset, offsets);
 
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
-			deepPayload[offset]           = pixel->rgb48.r;
-			deepPayload[offset+1]         = pixel->rgb48.g;
-			deepPayload[offset+2]         = pixel->rgb48.b;
+			deepPayload[offsets[0]]       = pixel->rgb48.r;
+			deepPayload[offsets[1]]       = pixel->rgb48.g;
+			deepPayload[offsets[2]]       = pixel->rgb48.b;
 			break;
 		case MKVS_RGB24:
-			payload[offset]               = pixel->rgb24.r;
-			payload[offset+1]             = pixel->rgb24.g;
-			payload[offset+2]             = pixel->rgb24.b;
+			payload[offsets[0]]           = pixel->rgb24.r;
+			payload[offsets[1]]           = pixel->rgb24.g;
+			payload[offsets[2]]           = pixel->rgb24.b;
 			break;
 		case MKVS_YUV444_48:
-			deepPayload[offset]           = pixel->yuv444_48.y;
-			deepPayload[offset+1]         = pixel->yuv444_48.u;
-			deepPayload[offset+2]         = pixel->yuv444_48.v;
+			deepPayload[offsets[0]]       = pixel->yuv444_48.y;
+			deepPayload[offsets[1]]       = pixel->yuv444_48.u;
+			deepPayload[offsets[2]]       = pixel->yuv444_48.v;
 			break;
 		case MKVS_YUV444_24:
-			payload[offset]               = pixel->yuv444_24.y;
-			payload[offset+1]             = pixel->yuv444_24.u;
-			payload[offset+2]             = pixel->yuv444_24.v;
+			payload[offsets[0]]           = pixel->yuv444_24.y;
+			payload[offsets[1]]           = pixel->yuv444_24.u;
+			payload[offsets[2]]           = pixel->yuv444_24.v;
 			break;
 		case MKVS_HSV48:
-			deepPayload[offset]           = pixel->hsv48.h;
-			deepPayload[offset+1]         = pixel->hsv48.s;
-			deepPayload[offset+2]         = pixel->hsv48.v;
+			deepPayload[offsets[0]]       = pixel->hsv48.h;
+			deepPayload[offsets[1]]       = pixel->hsv48.s;
+			deepPayload[offsets[2]]       = pixel->hsv48.v;
 			break;
 		case MKVS_HSV24:
-			payload[offset]               = pixel->hsv24.h;
-			payload[offset+1]             = pixel->hsv24.s;
-			payload[offset+2]             = pixel->hsv24.v;
+			payload[offsets[0]]           = pixel->hsv24.h;
+			payload[offsets[1]]           = pixel->hsv24.s;
+			payload[offsets[2]]           = pixel->hsv24.v;
 			break;
 		case MKVS_HSL48:
-			deepPayload[offset]           = pixel->hsl48.h;
-			deepPayload[offset+1]         = pixel->hsl48.s;
-			deepPayload[offset+2]         = pixel->hsl48.l;
+			deepPayload[offsets[0]]       = pixel->hsl48.h;
+			deepPayload[offsets[1]]       = pixel->hsl48.s;
+			deepPayload[offsets[2]]       = pixel->hsl48.l;
 			break;
 		case MKVS_HSL24:
-			payload[offset]               = pixel->hsl24.h;
-			payload[offset+1]             = pixel->hsl24.s;
-			payload[offset+2]             = pixel->hsl24.l;
+			payload[offsets[0]]           = pixel->hsl24.h;
+			payload[offsets[1]]           = pixel->hsl24.s;
+			payload[offsets[2]]           = pixel->hsl24.l;
 			break;
 		case NULL_COLOR:
 			MkvsynthError("The colorspace has not been initialized");
@@ -141,13 +175,128 @@ void putPixel (MkvsynthPixel *pixel, uint8_t *payload, MkvsynthMetaData *metaDat
 	}
 }
 
+/******************************************************************************
+ * Also see putRow()                                                          *
+ *                                                                            *
+ * getRow unpacks line 'row' of payload into 'samples', which holds 3 samples *
+ * per pixel (metaData->width * 3 in total), in the order of the channels of  *
+ * the colorspace. The samples keep the values of the colorspace as they are, *
+ * so an 8 bit colorspace gives values from 0 to 255. Interleaved, planar and *
+ * subsampled frames all come out the same way, subsampled Cb and Cr samples  *
+ * are repeated for every pixel that shares them. The colorspace is only      *
+ * looked at once per row, so filters that visit every pixel should use this  *
+ * instead of getPixel().                                                     *
+ *****************************************************************************/
+void getRow (uint8_t *payload, MkvsynthMetaData *metaData, int row, uint16_t *samples) {
+	int depth = getDepth(metaData);
+	if(depth < 0)
+		MkvsynthError("This colorspace is unrecognized");
+
+	int width = metaData->width;
+	int offsets[3];
+	findSamples(metaData, 0, row, offsets);
+
+	int i, channel;
+	if(!isPlanar(metaData)) {
+		if(depth == 16) {
+			memcpy(samples, (uint16_t *)payload + offsets[0], width * 3 * sizeof(uint16_t));
+		} else {
+			uint8_t *line = payload + offsets[0];
+			for(i = 0; i < width * 3; i++)
+				samples[i] = line[i];
+		}
+		return;
+	}
+
+	int widthShift, heightShift;
+	getChromaShift(metaData, &widthShift, &heightShift);
+
+	for(channel = 0; channel < 3; channel++) {
+		int shift = channel > 0 ? widthShift : 0;
+		if(depth == 16) {
+			uint16_t *line = (uint16_t *)payload + offsets[channel];
+			for(i = 0; i < width; i++)
+				samples[3*i + channel] = line[i >> shift];
+		} else {
+			uint8_t *line = payload + offsets[channel];
+			for(i = 0; i < width; i++)
+				samples[3*i + channel] = line[i >> shift];
+		}
+	}
+}
+
+/******************************************************************************
+ * putRow packs 'samples' (laid out as for getRow()) into line 'row' of       *
+ * payload. Samples going into an 8 bit colorspace have to be below 256. In a *
+ * subsampled frame, the top left pixel of every block of pixels that share a *
+ * Cb and Cr sample gives the sample, so rows that are not the top row of a   *
+ * block only write luma.                                                     *
+ *****************************************************************************/
+void putRow (uint16_t *samples, uint8_t *payload, MkvsynthMetaData *metaData, int row) {
+	int depth = getDepth(metaData);
+	if(depth < 0)
+		MkvsynthError("This colorspace is unrecognized");
+
+	int width = metaData->width;
+	int offsets[3];
+	findSamples(metaData, 0, row, offsets);
+
+	int i, channel;
+	if(!isPlanar(metaData)) {
+		if(depth == 16) {
+			memcpy((uint16_t *)payload + offsets[0], samples, width * 3 * sizeof(uint16_t));
+		} else {
+			uint8_t *line = payload + offsets[0];
+			for(i = 0; i < width * 3; i++)
+				line[i] = samples[i];
+		}
+		return;
+	}
+
+	int widthShift, heightShift;
+	getChromaShift(metaData, &widthShift, &heightShift);
+	int channels = row % (1 << heightShift) == 0 ? 3 : 1;
+
+	for(channel = 0; channel < channels; channel++) {
+		int shift = channel > 0 ? widthShift : 0;
+		if(depth == 16) {
+			uint16_t *line = (uint16_t *)payload + offsets[channel];
+			for(i = 0; i < width >> shift; i++)
+				line[i] = samples[3*(i << shift) + channel];
+		} else {
+			uint8_t *line = payload + offsets[channel];
+			for(i = 0; i < width >> shift; i++)
+				line[i] = samples[3*(i << shift) + channel];
+		}
+	}
+}
+
+// Returns pixel 'widthOffset' of a row from getRow(), for the functions that
+// work on a single MkvsynthPixel (getRed() and the rest)
+MkvsynthPixel getRowPixel (uint16_t *samples, MkvsynthMetaData *metaData, int widthOffset) {
+	MkvsynthPixel pixel = {{{0}}};
+	uint16_t *sample = samples + 3 * widthOffset;
+
+	if(getDepth(metaData) == 16) {
+		pixel.rgb48.r = sample[0];
+		pixel.rgb48.g = sample[1];
+		pixel.rgb48.b = sample[2];
+	} else {
+		pixel.rgb24.r = sample[0];
+		pixel.rgb24.g = sample[1];
+		pixel.rgb24.b = sample[2];
+	}
+
+	return pixel;
+}
+
 void addPixel (MkvsynthPixel *destination, MkvsynthPixel *source, uint16_t colorspace, double strength) {
 
 #ifdef DEBUG
 	checkColorspace(metaData->colorspace, "addPixel");
 #endif
 
-	switch(colorspace) {
+	switch(getInterleavedColorspace(colorspace)) {
 		case MKVS_RGB48:
 			destination->rgb48.r         += source->rgb48.r * strength;
 			destination->rgb48.g         += source->rgb48.g * strength;
@@ -211,7 +360,7 @@ uint16_t getRed (MkvsynthPixel *pixel, MkvsynthMetaData *metaData) {
 	float tempx = 0; //placeholder for calculating hx
 	int y = 0;
 	
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			rgbRed = pixel->rgb48.r;
 			break;
@@ -333,7 +482,7 @@ uint16_t getGreen (MkvsynthPixel *pixel, MkvsynthMetaData *metaData) {
 	float tempx = 0; //placeholder for calculating hx
 	int y = 0;
 	
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			rgbGreen = pixel->rgb48.g;
 			break;
@@ -454,7 +603,7 @@ uint16_t getBlue (MkvsynthPixel *pixel, MkvsynthMetaData *metaData){
 	float tempx = 0; //placeholder for calculating hx
 	int y = 0;
 	
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			rgbBlue = pixel->rgb48.b;
 			break;
@@ -571,7 +720,7 @@ void setRed(MkvsynthPixel *pixel, double value, MkvsynthMetaData *metaData) {
 	float yval = 0;
 	float uval = 0;
 	float vval = 0;
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			if(value <= 0) {
 				value = 0;
@@ -663,7 +812,7 @@ void setGreen(MkvsynthPixel *pixel, double value, MkvsynthMetaData *metaData) {
 	float yval = 0;
 	float uval = 0;
 	float vval = 0;
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			if(value <= 0) {
 				value = 0;
@@ -755,7 +904,7 @@ void setBlue(MkvsynthPixel *pixel, double value, MkvsynthMetaData *metaData) {
 	float yval = 0;
 	float uval = 0;
 	float vval = 0;
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			if(value <= 0) {
 				value = 0;
@@ -846,7 +995,7 @@ void adjustRed(MkvsynthPixel *pixel, double intensity, MkvsynthMetaData *metaDat
 	float yval = 0;
 	float uval = 0;
 	float vval = 0;
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			if(pixel->rgb48.r + intensity <= 0) {
 				pixel->rgb48.r = 0;
@@ -941,7 +1090,7 @@ void adjustGreen(MkvsynthPixel *pixel, double intensity, MkvsynthMetaData *metaD
 	float yval = 0;
 	float uval = 0;
 	float vval = 0;
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			if(pixel->rgb48.g + intensity <= 0) {
 				pixel->rgb48.g = 0;
@@ -1036,7 +1185,7 @@ void adjustBlue(MkvsynthPixel *pixel, double intensity, MkvsynthMetaData *metaDa
 	float yval = 0;
 	float uval = 0;
 	float vval = 0;
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			if(pixel->rgb48.b + intensity <= 0) {
 				pixel->rgb48.b = 0;
@@ -1128,7 +1277,7 @@ uint16_t getLuma(MkvsynthPixel *pixel, MkvsynthMetaData *metaData){
 	uint16_t yuvLuma = 0;
 	float result = 0;
 	
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			result = (float)pixel->rgb48.r * .299 + (float)pixel->rgb48.g * .587 + (float)pixel->rgb48.b * .114;
 			result += .5;
@@ -1184,7 +1333,7 @@ uint16_t getCb(MkvsynthPixel *pixel, MkvsynthMetaData *metaData){
 	uint16_t yuvCb = 0;
 	float result = 0;
 	
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			result = 32768 + .5 * (float)pixel->rgb48.b - .169 * (float)pixel->rgb48.r - .331 * (float)pixel->rgb48.g;
 			result += .5;
@@ -1240,7 +1389,7 @@ uint16_t getCr(MkvsynthPixel *pixel, MkvsynthMetaData *metaData){
 	uint16_t yuvCr = 0;
 	float result = 0;
 	
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			result = 32768 + .5 * (float)pixel->rgb48.r - .419 * (float)pixel->rgb48.g - .081 * (float)pixel->rgb48.b;
 			result += .5;
@@ -1299,7 +1448,7 @@ void setLuma(MkvsynthPixel *pixel, double value, MkvsynthMetaData *metaData){
 	float yval = 0;
 	float uval = 0;
 	float vval = 0;
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			yval = (float)pixel->rgb48.r * .299 + (float)pixel->rgb48.g * .587 + (float)pixel->rgb48.b * .114;
 			uval = 32768 + .5 * (float)pixel->rgb48.b - .169 * (float)pixel->rgb48.r - .331 * (float)pixel->rgb48.g;
@@ -1390,7 +1539,7 @@ void setCb(MkvsynthPixel *pixel, double value, MkvsynthMetaData *metaData){
 	float yval = 0;
 	float uval = 0;
 	float vval = 0;
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			yval = (float)pixel->rgb48.r * .299 + (float)pixel->rgb48.g * .587 + (float)pixel->rgb48.b * .114;
 			uval = 32768 + .5 * (float)pixel->rgb48.b - .169 * (float)pixel->rgb48.r - .331 * (float)pixel->rgb48.g;
@@ -1482,7 +1631,7 @@ void setCr(MkvsynthPixel *pixel, double value, MkvsynthMetaData *metaData){
 	float yval = 0;
 	float uval = 0;
 	float vval = 0;
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			yval = (float)pixel->rgb48.r * .299 + (float)pixel->rgb48.g * .587 + (float)pixel->rgb48.b * .114;
 			uval = 32768 + .5 * (float)pixel->rgb48.b - .169 * (float)pixel->rgb48.r - .331 * (float)pixel->rgb48.g;
@@ -1573,7 +1722,7 @@ void adjustLuma(MkvsynthPixel *pixel, double intensity, MkvsynthMetaData *metaDa
 	float yval = 0;
 	float uval = 0;
 	float vval = 0;
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			yval = (float)pixel->rgb48.r * .299 + (float)pixel->rgb48.g * .587 + (float)pixel->rgb48.b * .114;
 			uval = 32768 + .5 * (float)pixel->rgb48.b - .169 * (float)pixel->rgb48.r - .331 * (float)pixel->rgb48.g;
@@ -1669,7 +1818,7 @@ void adjustCb(MkvsynthPixel *pixel, double intensity, MkvsynthMetaData *metaData
 	float yval = 0;
 	float uval = 0;
 	float vval = 0;
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			yval = (float)pixel->rgb48.r * .299 + (float)pixel->rgb48.g * .587 + (float)pixel->rgb48.b * .114;
 			uval = 32768 + .5 * (float)pixel->rgb48.b - .169 * (float)pixel->rgb48.r - .331 * (float)pixel->rgb48.g;
@@ -1764,7 +1913,7 @@ void adjustCr(MkvsynthPixel *pixel, double intensity, MkvsynthMetaData *metaData
 	float yval = 0;
 	float uval = 0;
 	float vval = 0;
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			yval = (float)pixel->rgb48.r * .299 + (float)pixel->rgb48.g * .587 + (float)pixel->rgb48.b * .114;
 			uval = 32768 + .5 * (float)pixel->rgb48.b - .169 * (float)pixel->rgb48.r - .331 * (float)pixel->rgb48.g;
@@ -1857,7 +2006,7 @@ uint16_t getHue(MkvsynthPixel *pixel, MkvsynthMetaData *metaData){
 	double gp = 0; //these variable represent the portion of the red, green, or blue value that is present in the color
 	double cmin, cmax, delta, dhue, fhue; //dhue represents the hue out of one, fhue is the float form of hue
 	int x,y;
-	switch(metaData->colorspace){
+	switch(getInterleavedColorspace(metaData->colorspace)){
 		case MKVS_RGB24:
 		rp = (double)pixel->rgb24.r / 256.0;
 		gp = (double)pixel->rgb24.g / 256.0;
@@ -1953,7 +2102,7 @@ uint16_t getHSVSaturation(MkvsynthPixel *pixel, MkvsynthMetaData *metaData){
 	double gp = 0; //these variable represent the portion of the red, green, or blue value that is present in the color
 	double cmin, cmax, delta, ds, fs; //ds represents the saturation out of one, fs is the float form of saturation
 	int x, y;
-	switch(metaData->colorspace){
+	switch(getInterleavedColorspace(metaData->colorspace)){
 		case MKVS_RGB24:
 			rp = (double)pixel->rgb24.r / 256.0;
 			gp = (double)pixel->rgb24.g / 256.0;
@@ -2034,7 +2183,7 @@ uint16_t getValue(MkvsynthPixel *pixel, MkvsynthMetaData *metaData){
 	double gp = 0; //these variable represent the portion of the red, green, or blue value that is present in the color
 	double cmin, cmax;
 	int x, y;
-	switch(metaData->colorspace){
+	switch(getInterleavedColorspace(metaData->colorspace)){
 		case MKVS_RGB24:
 		rp = (double)pixel->rgb24.r / 256.0;
 		gp = (double)pixel->rgb24.g / 256.0;
@@ -2096,7 +2245,7 @@ uint16_t getValue(MkvsynthPixel *pixel, MkvsynthMetaData *metaData){
 
 uint16_t getHSLSaturation(MkvsynthPixel *pixel, MkvsynthMetaData *metaData){
 	uint16_t hsls = 0;
-	switch(metaData->colorspace){
+	switch(getInterleavedColorspace(metaData->colorspace)){
 		case MKVS_RGB48:
 			MkvsynthError("This colorspace interaction is not yet supported");
 			break;
@@ -2145,7 +2294,7 @@ uint16_t getHSLSaturation(MkvsynthPixel *pixel, MkvsynthMetaData *metaData){
 
 uint16_t getLightness(MkvsynthPixel *pixel, MkvsynthMetaData *metaData){
 	uint16_t hsll = 0;
-	switch(metaData->colorspace){
+	switch(getInterleavedColorspace(metaData->colorspace)){
 		case MKVS_RGB48:
 			MkvsynthError("This colorspace interaction is not yet supported");
 			break;
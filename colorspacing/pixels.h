@@ -3,6 +3,11 @@
 MkvsynthPixel getPixel                    (uint8_t *payload, MkvsynthMetaData *metaData, int widthOffset, int heightOffset);
 void putPixel                             (MkvsynthPixel *pixel, uint8_t *payload, MkvsynthMetaData *metaData, int widthOffset, int heightOffset);
 
+//whole rows at a time, as 3 samples per pixel, see getRow()
+void getRow                               (uint8_t *payload, MkvsynthMetaData *metaData, int row, uint16_t *samples);
+void putRow                               (uint16_t *samples, uint8_t *payload, MkvsynthMetaData *metaData, int row);
+MkvsynthPixel getRowPixel                 (uint16_t *samples, MkvsynthMetaData *metaData, int widthOffset);
+
 uint16_t getRed                           (MkvsynthPixel *pixel, MkvsynthMetaData *metaData);
 uint16_t getGreen                         (MkvsynthPixel *pixel, MkvsynthMetaData *metaData);
 uint16_t getBlue                          (MkvsynthPixel *pixel, MkvsynthMetaData *metaData);
@@ -1,8 +1,87 @@
 #include "properties.h"
 
+// Returns the interleaved colorspace that holds the same values for each pixel
+// as 'colorspace', which is 'colorspace' itself if it is not planar
+c_space getInterleavedColorspace(c_space colorspace) {
+	switch(colorspace) {
+		case MKVS_YUV420_12:
+		case MKVS_YUV422_16:
+			return MKVS_YUV444_24;
+		case MKVS_YUV420_24:
+		case MKVS_YUV422_32:
+			return MKVS_YUV444_48;
+		case MKVS_RGB48_PLANAR:
+			return MKVS_RGB48;
+		case MKVS_RGB24_PLANAR:
+			return MKVS_RGB24;
+		case MKVS_YUV444_48_PLANAR:
+			return MKVS_YUV444_48;
+		case MKVS_YUV444_24_PLANAR:
+			return MKVS_YUV444_24;
+		case MKVS_HSV48_PLANAR:
+			return MKVS_HSV48;
+		case MKVS_HSV24_PLANAR:
+			return MKVS_HSV24;
+		case MKVS_HSL48_PLANAR:
+			return MKVS_HSL48;
+		case MKVS_HSL24_PLANAR:
+			return MKVS_HSL24;
+		default:
+			return colorspace;
+	}
+}
+
+// Returns the 16 bit interleaved colorspace that holds the same kind of values
+// as 'colorspace' (RGB48, YUV444_48, HSV48 or HSL48)
+c_space getDeepColorspace(c_space colorspace) {
+	switch(getInterleavedColorspace(colorspace)) {
+		case MKVS_RGB24:
+			return MKVS_RGB48;
+		case MKVS_YUV444_24:
+			return MKVS_YUV444_48;
+		case MKVS_HSV24:
+			return MKVS_HSV48;
+		case MKVS_HSL24:
+			return MKVS_HSL48;
+		default:
+			return getInterleavedColorspace(colorspace);
+	}
+}
+
+// Returns 1 if every channel of the frame is stored in a plane of its own
+int isPlanar(MkvsynthMetaData *metaData) {
+	return getInterleavedColorspace(metaData->colorspace) != metaData->colorspace;
+}
+
+// Returns the number of planes in the frame
+int getPlaneCount(MkvsynthMetaData *metaData) {
+	return isPlanar(metaData) ? 3 : 1;
+}
+
+// Sets how many times fewer Cb and Cr samples than pixels there are across
+// and down the frame, as a shift: 1 for half as many, 0 for as many
+void getChromaShift(MkvsynthMetaData *metaData, int *widthShift, int *heightShift) {
+	switch(metaData->colorspace) {
+		case MKVS_YUV420_12:
+		case MKVS_YUV420_24:
+			*widthShift = 1;
+			*heightShift = 1;
+			break;
+		case MKVS_YUV422_16:
+		case MKVS_YUV422_32:
+			*widthShift = 1;
+			*heightShift = 0;
+			break;
+		default:
+			*widthShift = 0;
+			*heightShift = 0;
+			break;
+	}
+}
+
 // Returns the bit depth
 int getDepth(MkvsynthMetaData *metaData) {
-	switch(metaData->colorspace) {
+	switch(getInterleavedColorspace(metaData->colorspace)) {
 		case MKVS_RGB48:
 			return 16;
 		case MKVS_RGB24:
@@ -27,25 +106,43 @@ int getDepth(MkvsynthMetaData *metaData) {
 	return -1;
 }
 
-// Returns the number of bytes in the frame
+// Returns the number of bytes in the frame, including the padding at the end
+// of every line of every plane
 int getBytes(MkvsynthMetaData *metaData) {
+	int linesize = getLinesize(metaData);
+	if(linesize < 0)
+		return -1;
+
+	int widthShift, heightShift;
+	getChromaShift(metaData, &widthShift, &heightShift);
+
+	int chromaBytes = getPlaneLinesize(metaData, 1) * (metaData->height >> heightShift);
+	return linesize * metaData->height + (getPlaneCount(metaData) - 1) * chromaBytes;
+}
+
+// Returns the number of bytes that 1 pixel takes up in a plane, which for a
+// planar frame is a single channel
+int getPixelBytes(MkvsynthMetaData *metaData) {
+	if(isPlanar(metaData))
+		return getDepth(metaData) / 8;
+
 	switch(metaData->colorspace) {
 		case MKVS_RGB48:
-			return metaData->width * metaData->height * 6;
+			return 6;
 		case MKVS_RGB24:
-			return metaData->width * metaData->height * 3;
+			return 3;
 		case MKVS_YUV444_48:
-			return metaData->width * metaData->height * 6;
+			return 6;
 		case MKVS_YUV444_24:
-			return metaData->width * metaData->height * 3;
+			return 3;
 		case MKVS_HSV48:
-			return metaData->width * metaData->height * 6;
+			return 6;
 		case MKVS_HSV24:
-			return metaData->width * metaData->height * 3;
+			return 3;
 		case MKVS_HSL48:
-			return metaData->width * metaData->height * 6;
+			return 6;
 		case MKVS_HSL24:
-			return metaData->width * metaData->height * 3;
+			return 3;
 		case NULL_COLOR:
 			return -1;
 		default:
@@ -54,38 +151,96 @@ int getBytes(MkvsynthMetaData *metaData) {
 	return -1;
 }
 
-// Returns the number of bytes in 1 line of a frame
+// Returns the number of bytes from the start of 1 line of a plane to the start
+// of the next one: the stride if it has been set, otherwise the bytes in the
+// pixels of a line rounded up to MKVSYNTH_ALIGNMENT
 int getLinesize(MkvsynthMetaData *metaData) {
-	switch(metaData->colorspace) {
-		case MKVS_RGB48:
-			return metaData->width * 6;
-		case MKVS_RGB24:
-			return metaData->width * 3;
-		case MKVS_YUV444_48:
-			return metaData->width * 6;
-		case MKVS_YUV444_24:
-			return metaData->width * 3;
-		case MKVS_HSV48:
-			return metaData->width * 6;
-		case MKVS_HSV24:
-			return metaData->width * 3;
-		case MKVS_HSL48:
-			return metaData->width * 6;
-		case MKVS_HSL24:
-			return metaData->width * 3;
-		case NULL_COLOR:
-			return -1;
-		default:
-			return -1;
+	if(metaData->stride > 0)
+		return metaData->stride;
+
+	int pixelBytes = getPixelBytes(metaData);
+	if(pixelBytes < 0)
+		return -1;
+
+	int lineBytes = metaData->width * pixelBytes;
+	return (lineBytes + MKVSYNTH_ALIGNMENT - 1) / MKVSYNTH_ALIGNMENT * MKVSYNTH_ALIGNMENT;
+}
+
+// Returns the linesize of plane 'plane'. A subsampled chroma plane gets the
+// linesize of the first plane divided by the subsampling, rounded up to
+// MKVSYNTH_ALIGNMENT, which is always enough for its narrower rows
+int getPlaneLinesize(MkvsynthMetaData *metaData, int plane) {
+	int widthShift, heightShift;
+	getChromaShift(metaData, &widthShift, &heightShift);
+
+	int linesize = getLinesize(metaData);
+	if(plane == 0 || widthShift == 0)
+		return linesize;
+
+	linesize >>= widthShift;
+	return (linesize + MKVSYNTH_ALIGNMENT - 1) / MKVSYNTH_ALIGNMENT * MKVSYNTH_ALIGNMENT;
+}
+
+/******************************************************************************
+ * getPlanes fills out where each plane of 'payload' is, see MkvsynthPlanes.  *
+ * The planes follow each other in the payload, so that every plane starts on *
+ * a multiple of MKVSYNTH_ALIGNMENT bytes just like every row does. A filter  *
+ * that only moves channels around can work through the planes the same way   *
+ * for interleaved, planar and subsampled frames.                             *
+ *****************************************************************************/
+void getPlanes(uint8_t *payload, MkvsynthMetaData *metaData, MkvsynthPlanes *planes) {
+	int pixelBytes = getPixelBytes(metaData);
+	int widthShift, heightShift;
+	getChromaShift(metaData, &widthShift, &heightShift);
+
+	planes->count = getPlaneCount(metaData);
+	planes->sampleBytes = getDepth(metaData) / 8;
+
+	int i;
+	uint8_t *data = payload;
+	for(i = 0; i < planes->count; i++) {
+		planes->data[i] = data;
+		planes->linesize[i] = getPlaneLinesize(metaData, i);
+		planes->width[i] = metaData->width * pixelBytes / planes->sampleBytes;
+		planes->height[i] = metaData->height;
+		if(i > 0) {
+			planes->width[i] >>= widthShift;
+			planes->height[i] >>= heightShift;
+		}
+		data += planes->linesize[i] * planes->height[i];
+	}
+
+	for(; i < 3; i++) {
+		planes->data[i] = NULL;
+		planes->linesize[i] = 0;
+		planes->width[i] = 0;
+		planes->height[i] = 0;
 	}
-	return -1;
 }
 
-// Some colorspaces have limitations like resolution that is divisible by 2
-// At the moment, mkvsynth does not support any colorspaces with limitations
+// Some colorspaces have limitations like resolution that is divisible by 2,
+// which is the case for the subsampled (YUV420 and YUV422) colorspaces
 int isMetaDataValid(MkvsynthMetaData *metaData) {
-	if(metaData->colorspace >= 0 && metaData->colorspace <= 8) {
-		switch(metaData->colorspace) {
+	if(metaData->colorspace > 0 && metaData->colorspace <= 20) {
+		int widthShift, heightShift;
+		getChromaShift(metaData, &widthShift, &heightShift);
+		if(metaData->width % (1 << widthShift) != 0 || metaData->height % (1 << heightShift) != 0) {
+			printf("Meta data checker: the colorspace needs an even width (and for YUV420 an even height)\n");
+			printf("Resolution: %ix%i\n", metaData->width, metaData->height);
+			return -1;
+		}
+	}
+
+	if(metaData->stride != 0 && metaData->colorspace > 0 && metaData->colorspace <= 20) {
+		if(metaData->stride < metaData->width * getPixelBytes(metaData) || metaData->stride % MKVSYNTH_ALIGNMENT != 0) {
+			printf("Meta data checker: stride is too small or not aligned\n");
+			printf("Stride value: %i\n", metaData->stride);
+			return -1;
+		}
+	}
+
+	if(metaData->colorspace >= 0 && metaData->colorspace <= 20) {
+		switch(getInterleavedColorspace(metaData->colorspace)) {
 			case MKVS_RGB48:
 				return 1;
 			case MKVS_RGB24:
@@ -106,6 +261,8 @@ int isMetaDataValid(MkvsynthMetaData *metaData) {
 				printf("Meta data checker: colorspace is not initialized\n");
 				printf("Color space value: %i\n", metaData->colorspace);
 				return -1;	
+			default:
+				break;
 		}
 	} else {
 		printf("Meta data checker: colorspace is not recognized\n");
@@ -1,7 +1,15 @@
 #include "colorspacing.h"
 #include <stdio.h>
 
+c_space getInterleavedColorspace(c_space colorspace);
+c_space getDeepColorspace(c_space colorspace);
+int isPlanar(MkvsynthMetaData *metaData);
+int getPlaneCount(MkvsynthMetaData *metaData);
+void getChromaShift(MkvsynthMetaData *metaData, int *widthShift, int *heightShift);
 int getDepth(MkvsynthMetaData *metaData);
 int getBytes(MkvsynthMetaData *metaData);
+int getPixelBytes(MkvsynthMetaData *metaData);
 int isMetaDataValid(MkvsynthMetaData *metaData);
 int getLinesize(MkvsynthMetaData *metaData);
+int getPlaneLinesize(MkvsynthMetaData *metaData, int plane);
+void getPlanes(uint8_t *payload, MkvsynthMetaData *metaData, MkvsynthPlanes *planes);
@@ -33,6 +33,7 @@ void switchToBuffer(char *, FILE *);
 /* global variables */
 char *typeNames[] = {"void", "number", "boolean", "string", "clip", "identifier"};
 char *currentFunction = "";
+argList *currentArgs = NULL;
 extern int linenumber;
 
 /* function definitions */
@@ -297,8 +298,10 @@ Value fnctCall(Env const *e, Value const *name, argList *a) {
 	if (f == NULL)
 		MkvsynthError("reference to undefined function \"%s\"", name->id);
 
-	/* set global variable */
+	/* set global variables */
 	currentFunction = f->name;
+	argList *parentArgs = currentArgs;
+	currentArgs = a;
 
 	/* check argument order */
 	int i;
@@ -323,8 +326,9 @@ Value fnctCall(Env const *e, Value const *name, argList *a) {
 	free(a->args);
 	free(a);
 
-	/* unset global variable */
+	/* unset global variables */
 	currentFunction = "";
+	currentArgs = parentArgs;
 
 	return res;
 }
@@ -3,6 +3,7 @@
 
 /* includes */
 #include <setjmp.h>
+#include <stdio.h>
 #include "../jarvis/jarvis.h"
 
 /* macros */
@@ -130,10 +131,16 @@ Value setVar(Env const *, char const *, Value const *);
 Value ex(Env *, ASTnode *);
 void checkArgs(argList const *, int, ...);
 void* getOptArg(argList const *, char const *, valueType);
+void setThreadOption(int);
+void setSegmentOption(int, char const *, char const *);
+FILE *setWorkerOption(char const *);
 
 /* global variables */
 Env global; /* the global execution environment */
 Plugin *pluginList; /* loaded plugins */
+extern argList *currentArgs; /* arguments of the function being called */
+extern char *currentFunction; /* name of the function being called */
+extern int linenumber; /* line of the script being run */
 extern Fn coreFunctions[];
 extern Fn internalFilters[];
 extern char *typeNames[];
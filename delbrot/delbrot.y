@@ -454,13 +454,62 @@ void yyerror(char *error, ...) {
 }
 
 int main(int argc, char **argv) {
+	/* options, which come before the script */
+	int threads = 0;
+	int segments = 1;
+	char *address = NULL;
+	char *coordinator = NULL;
+	while (argc > 2 && (!strcmp(argv[1], "--threads") || !strcmp(argv[1], "--segments")
+	|| !strcmp(argv[1], "--listen") || !strcmp(argv[1], "--connect"))) {
+		if (!strcmp(argv[1], "--threads")) {
+			threads = atoi(argv[2]);
+			if (threads < 1) {
+				MkvsynthError("--threads must be at least 1");
+				exit(1);
+			}
+		} else if (!strcmp(argv[1], "--segments")) {
+			segments = atoi(argv[2]);
+			if (segments < 1) {
+				MkvsynthError("--segments must be at least 1");
+				exit(1);
+			}
+		} else if (!strcmp(argv[1], "--listen")) {
+			address = argv[2];
+		} else {
+			coordinator = argv[2];
+		}
+		argc -= 2;
+		argv += 2;
+	}
+
 	/* help message */
 	if ((argc != 1 && argc != 2)
 	|| (argc > 1 && (!strcmp(argv[1],"-h") || !strcmp(argv[1],"--help")))) {
-		printf("Usage: mkvsynth [FILE]\nInterprets an mkvsynth script.\n\nIf FILE is omitted, STDIN will be used instead.\n\nReport bugs on github.com/mkvsynth/mkvsynth.\n");
+		printf("Usage: mkvsynth [--threads N] [--segments N [--listen ADDRESS]] [FILE]\n  or:  mkvsynth [--threads N] --connect HOST:PORT\nInterprets an mkvsynth script.\n\nIf FILE is omitted, STDIN will be used instead.\n\n  --threads N       keep at most N threads busy, see setThreads\n  --segments N      render the script in N processes, each doing an Nth of the clip\n  --listen ADDRESS  let N-1 workers render the other segments, instead of forking,\n                    ADDRESS is HOST:PORT, or PORT for 127.0.0.1\n  --connect ADDRESS render a segment for the mkvsynth listening at ADDRESS\n\nReport bugs on github.com/mkvsynth/mkvsynth.\n");
 		exit(0);
 	}
 
+	/* the segments are started before the script is opened, and split up the
+	 * thread budget between them */
+	if (threads > 0)
+		setThreadOption(threads);
+	if (coordinator != NULL) {
+		if (argc != 1 || segments > 1 || address != NULL) {
+			MkvsynthError("--connect gets the script and its segment from the coordinator");
+			exit(1);
+		}
+		yyin = setWorkerOption(coordinator);
+	} else if (segments > 1) {
+		if (argc != 2) {
+			MkvsynthError("--segments needs a script file, not STDIN");
+			exit(1);
+		}
+		setSegmentOption(segments, address, argv[1]);
+	} else if (address != NULL) {
+		MkvsynthError("--listen needs --segments");
+		exit(1);
+	}
+
 	/* read script file, if provided */
 	if (argc == 2) {
 		yyin = fopen(argv[1], "r");
@@ -8,9 +8,18 @@ Value ffmpegDecode_AST(argList *);
 Value go_AST(argList *);
 Value gradientVideoGenerate_AST(argList *);
 Value removeRange_AST(argList *);
+Value setAdvisorInterval_AST(argList *);
+Value setAffinity_AST(argList *);
+Value setBufferMemory_AST(argList *);
+Value setStatsFile_AST(argList *);
+Value setThreads_AST(argList *);
 Value testingGradient_AST(argList *);
 Value writeRawFile_AST(argList *);
 Value x264Encode_AST(argList *);
+void setThreadBudget(int);
+void startSegments(int);
+void listenSegments(int, char const *, char const *);
+FILE *joinSegments(char const *);
 
 Fn internalFilters[] = {
 #ifndef DELBROT
@@ -22,9 +31,41 @@ Fn internalFilters[] = {
 	{ fnCore, "go",                    go_AST,                    NULL, NULL, NULL },
 	{ fnCore, "gradientVideoGenerate", gradientVideoGenerate_AST, NULL, NULL, NULL },
 	{ fnCore, "removeRange",           removeRange_AST,           NULL, NULL, NULL },
+	{ fnCore, "setAdvisorInterval",    setAdvisorInterval_AST,    NULL, NULL, NULL },
+	{ fnCore, "setAffinity",           setAffinity_AST,           NULL, NULL, NULL },
+	{ fnCore, "setBufferMemory",       setBufferMemory_AST,       NULL, NULL, NULL },
+	{ fnCore, "setStatsFile",          setStatsFile_AST,          NULL, NULL, NULL },
+	{ fnCore, "setThreads",            setThreads_AST,            NULL, NULL, NULL },
 	{ fnCore, "testingGradient",       testingGradient_AST,       NULL, NULL, NULL },
 	{ fnCore, "writeRawFile",          writeRawFile_AST,          NULL, NULL, NULL },
 	{ fnCore, "x264Encode",            x264Encode_AST,            NULL, NULL, NULL },
 	{ 0,      0,                       0,                         0,    0,    0    },
 #endif
 };
+
+/* --threads, which is the same as calling setThreads before anything else */
+void setThreadOption(int threads) {
+#ifndef DELBROT
+	setThreadBudget(threads);
+#endif
+}
+
+/* --segments, which runs the script in several processes, see startSegments.
+ * With --listen, the other processes are workers that connect to 'address' */
+void setSegmentOption(int segments, char const *address, char const *script) {
+#ifndef DELBROT
+	if (address != NULL)
+		listenSegments(segments, address, script);
+	else
+		startSegments(segments);
+#endif
+}
+
+/* --connect, which runs a segment of the coordinator's script, see joinSegments */
+FILE *setWorkerOption(char const *address) {
+#ifndef DELBROT
+	return joinSegments(address);
+#else
+	return NULL;
+#endif
+}
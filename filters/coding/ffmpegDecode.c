@@ -20,53 +20,175 @@ struct ffmpegDecode {
 	AVCodecContext *codecContext;
 	AVCodec *codec;
 	AVFrame *frame;
-	AVFrame *rgbFrame;
 	AVDictionary *dictionary;
 	struct SwsContext *resizeContext;
 	int videoStream;
 	int frameFinished;
-	uint8_t *rgbFramePayload;
 	uint8_t *outputPayload;
 
+	// The number of the frame that the decoder hands out next, which is not
+	// known right after a seek. Once the file has been read, the decoder is
+	// flushed for the frames it still holds on to
+	unsigned long long nextFrame;
+	int seeking;
+	int flushing;
+
 	MkvsynthOutput *output;
 };
 
-void *ffmpegDecode(void *filterParams) {
-	struct ffmpegDecode *params = (struct ffmpegDecode *)filterParams;
-
-	/////////////////
-	// Decode Loop //
-	/////////////////
+// Decodes the next frame into params->frame, returns 0 at the end of the file
+static int decodeFrame(struct ffmpegDecode *params) {
 	AVPacket packet;
-	int currentFrame = 1;
-	while(av_read_frame(params->formatContext, &packet) >= 0) {
+	while(!params->flushing) {
+		if(av_read_frame(params->formatContext, &packet) < 0) {
+			params->flushing = 1;
+			break;
+		}
+
+		params->frameFinished = 0;
 		if(packet.stream_index == params->videoStream) {
 			avcodec_decode_video2(
 				params->codecContext,
 				params->frame,
 				&params->frameFinished,
 				&packet);
-
-			if(params->frameFinished) {
-				currentFrame++;
-				if(currentFrame % 500 == 0)
-					MkvsynthMessage("Finished Frame %i", currentFrame);
-				sws_scale (
-					params->resizeContext,
-					(uint8_t const * const *)params->frame->data,
-					params->frame->linesize,
-					0,
-					params->codecContext->height,
-					params->rgbFrame->data,
-					params->rgbFrame->linesize);
-			
-				params->outputPayload = malloc(getBytes(params->output->metaData));
-  			memcpy(params->outputPayload, params->rgbFrame->data[0], getBytes(params->output->metaData));
-				putFrame(params->output, params->outputPayload);
-			}
 		}
-		
+
 		av_free_packet(&packet);
+		if(params->frameFinished)
+			return 1;
+	}
+
+	av_init_packet(&packet);
+	packet.data = NULL;
+	packet.size = 0;
+	avcodec_decode_video2(
+		params->codecContext,
+		params->frame,
+		&params->frameFinished,
+		&packet);
+
+	return params->frameFinished;
+}
+
+// sws_scale writes straight into the planes of the payload, padding and all
+static uint8_t *convertFrame(struct ffmpegDecode *params) {
+	params->outputPayload = getPayload(params->output);
+	MkvsynthPlanes planes;
+	getPlanes(params->outputPayload, params->output->metaData, &planes);
+	uint8_t *outputPlanes[4] = { planes.data[0], planes.data[1], planes.data[2], NULL };
+	int outputLinesizes[4] = { planes.linesize[0], planes.linesize[1], planes.linesize[2], 0 };
+
+	sws_scale (
+		params->resizeContext,
+		(uint8_t const * const *)params->frame->data,
+		params->frame->linesize,
+		0,
+		params->codecContext->height,
+		outputPlanes,
+		outputLinesizes);
+
+	return params->outputPayload;
+}
+
+// Works out the number of the frame in params->frame from its timestamp
+static unsigned long long frameNumber(struct ffmpegDecode *params) {
+	AVStream *stream = params->formatContext->streams[params->videoStream];
+	int64_t timestamp = av_frame_get_best_effort_timestamp(params->frame);
+	if(timestamp == AV_NOPTS_VALUE)
+		return params->nextFrame;
+
+	if(stream->start_time != AV_NOPTS_VALUE)
+		timestamp -= stream->start_time;
+
+	if(timestamp < 0)
+		return 0;
+
+	return av_rescale_q(timestamp, stream->time_base, av_inv_q(stream->avg_frame_rate));
+}
+
+// Seeks to the keyframe in front of frame 'frame'
+static void seekFrame(struct ffmpegDecode *params, unsigned long long frame) {
+	AVStream *stream = params->formatContext->streams[params->videoStream];
+	int64_t timestamp = av_rescale_q(frame, av_inv_q(stream->avg_frame_rate), stream->time_base);
+	if(stream->start_time != AV_NOPTS_VALUE)
+		timestamp += stream->start_time;
+
+	if(av_seek_frame(params->formatContext, params->videoStream, timestamp, AVSEEK_FLAG_BACKWARD) < 0)
+		MkvsynthError("could not seek to frame %llu", frame);
+
+	avcodec_flush_buffers(params->codecContext);
+	params->seeking = 1;
+	params->flushing = 0;
+}
+
+/******************************************************************************
+ * Segments (see segmentFrames()) ask for the frames of their own part of the *
+ * clip, so instead of decoding everything in front of it, the decoder seeks  *
+ * to the keyframe before the first frame that is asked for, then decodes up  *
+ * to that frame. Frames asked for in order are simply decoded one after the  *
+ * other. The step and the render share the decoder, which is fine because    *
+ * only one of them ever runs.                                                *
+ *                                                                            *
+ * Seeking is not exact: with a wrong frame rate in the header, or timestamps *
+ * that B-frames have moved around, the first frame after a seek can already  *
+ * be past the one that was asked for. The decoder then seeks further back,   *
+ * twice as far every time, until it lands in front of the frame. A frame     *
+ * that is skipped over on the way, or that is still behind the first frame   *
+ * of the file, ends the script instead of being swapped for another one.     *
+ *****************************************************************************/
+static uint8_t *ffmpegDecodeRender(void *filterParams, unsigned long long frame) {
+	struct ffmpegDecode *params = (struct ffmpegDecode *)filterParams;
+
+	unsigned long long seekTo = frame, distance = 16;
+	if(frame != params->nextFrame)
+		seekFrame(params, seekTo);
+
+	// The number of frames decoded since the last seek
+	int decoded = 0;
+
+	unsigned long long current;
+	for(;;) {
+		if(!decodeFrame(params))
+			return NULL;
+
+		current = params->seeking ? frameNumber(params) : params->nextFrame;
+		params->nextFrame = current + 1;
+		decoded++;
+
+		if(current == frame)
+			break;
+		if(current < frame)
+			continue;
+
+		if(!params->seeking || decoded > 1)
+			MkvsynthError("frame %llu is missing, the decoder went from before it to frame %llu", frame, current);
+		if(seekTo == 0)
+			MkvsynthError("could not seek to frame %llu, the first frame of the file is frame %llu", frame, current);
+
+		seekTo = seekTo > distance ? seekTo - distance : 0;
+		distance *= 2;
+		seekFrame(params, seekTo);
+		decoded = 0;
+	}
+
+	params->seeking = 0;
+	return convertFrame(params);
+}
+
+int ffmpegDecode(void *filterParams) {
+	struct ffmpegDecode *params = (struct ffmpegDecode *)filterParams;
+
+	/////////////////
+	// Decode Step //
+	/////////////////
+	if(decodeFrame(params)) {
+		params->nextFrame++;
+		if(params->nextFrame % 500 == 0)
+			MkvsynthMessage("Finished Frame %llu", params->nextFrame);
+
+		putFrame(params->output, convertFrame(params));
+		return 1;
 	}
 
 	////////////////////////
@@ -78,12 +200,10 @@ void *ffmpegDecode(void *filterParams) {
 	// Memory Deallocation //
 	/////////////////////////
 	av_free(params->frame);
-	av_free(params->rgbFrame);
-	av_free(params->rgbFramePayload);
 	avcodec_close(params->codecContext);
 	avformat_close_input(&params->formatContext);
 	free(params);
-	return NULL;
+	return 0;
 }
 
 Value ffmpegDecode_AST(argList *a) {
@@ -94,6 +214,7 @@ Value ffmpegDecode_AST(argList *a) {
 	struct ffmpegDecode *params = malloc(sizeof(struct ffmpegDecode));
 	checkArgs(a, 1, typeStr);
 	char *filename = MANDSTR(0);
+	int native = OPTBOOL("native", 0);
 	params->output = createOutputBuffer();
 
 	//////////////////////////////
@@ -103,8 +224,10 @@ Value ffmpegDecode_AST(argList *a) {
 	params->codecContext = NULL;
 	params->codec = NULL;
 	params->frame = NULL;
-	params->rgbFrame = NULL;
-	params->rgbFramePayload = NULL;
+	params->videoStream = -1;
+	params->nextFrame = 0;
+	params->seeking = 0;
+	params->flushing = 0;
 	
 	//////////////////////////////////////
 	// Error Checking And Initializtion //
@@ -138,44 +261,90 @@ Value ffmpegDecode_AST(argList *a) {
 	if(params->codec == NULL)
 		MkvsynthError("Unrecognized video codec.");
 
+	// Stay within the thread budget, libavcodec starts its threads on open
+	int threads = filterThreads();
+	if(threads > 0)
+		params->codecContext->thread_count = threads;
+
 	int openCodec = avcodec_open2(params->codecContext, params->codec, &params->dictionary);
 
 	if(openCodec < 0)
 		MkvsynthError("Failed to open codec.");
 
 	params->frame = avcodec_alloc_frame();
-	params->rgbFrame = avcodec_alloc_frame();
 
-	int bytes = avpicture_get_size(PIX_FMT_RGB48, params->codecContext->width, params->codecContext->height);
-	params->rgbFramePayload = (uint8_t *)av_malloc(bytes);
-	
+	///////////////
+	// Meta Data //
+	///////////////
+	params->output->metaData->width = params->codecContext->width;
+	params->output->metaData->height = params->codecContext->height;
+	params->output->metaData->colorspace = MKVS_RGB48;
+	params->output->metaData->fpsNumerator = params->formatContext->streams[params->videoStream]->avg_frame_rate.num;
+	params->output->metaData->fpsDenominator = params->formatContext->streams[params->videoStream]->avg_frame_rate.den;
+
+	// Containers that do not count their frames only give an estimate
+	AVStream *stream = params->formatContext->streams[params->videoStream];
+	if(stream->nb_frames > 0)
+		params->output->metaData->frames = stream->nb_frames;
+	else if(params->formatContext->duration != AV_NOPTS_VALUE)
+		params->output->metaData->frames = av_rescale_q(params->formatContext->duration, AV_TIME_BASE_Q, av_inv_q(stream->avg_frame_rate));
+
+	// native:true keeps YUV sources in their own subsampling, which takes a
+	// quarter of the memory of rgb48 for 4:2:0, deeper sources go to 16 bits
+	enum PixelFormat outputFormat = PIX_FMT_RGB48;
+	if(native) {
+		switch(params->codecContext->pix_fmt) {
+			case PIX_FMT_YUV420P:
+				outputFormat = PIX_FMT_YUV420P;
+				params->output->metaData->colorspace = MKVS_YUV420_12;
+				break;
+			case PIX_FMT_YUV422P:
+				outputFormat = PIX_FMT_YUV422P;
+				params->output->metaData->colorspace = MKVS_YUV422_16;
+				break;
+			case PIX_FMT_YUV444P:
+				outputFormat = PIX_FMT_YUV444P;
+				params->output->metaData->colorspace = MKVS_YUV444_24_PLANAR;
+				break;
+			case PIX_FMT_YUV420P10LE:
+			case PIX_FMT_YUV420P16LE:
+				outputFormat = PIX_FMT_YUV420P16LE;
+				params->output->metaData->colorspace = MKVS_YUV420_24;
+				break;
+			case PIX_FMT_YUV422P10LE:
+			case PIX_FMT_YUV422P16LE:
+				outputFormat = PIX_FMT_YUV422P16LE;
+				params->output->metaData->colorspace = MKVS_YUV422_32;
+				break;
+			default:
+				break;
+		}
+
+		if(outputFormat == PIX_FMT_RGB48 || isMetaDataValid(params->output->metaData) != 1) {
+			MkvsynthWarning("the source can not be kept in its own format, it is converted to rgb48");
+			outputFormat = PIX_FMT_RGB48;
+			params->output->metaData->colorspace = MKVS_RGB48;
+		}
+	}
+
 	params->resizeContext = sws_getContext (
 		params->codecContext->width,
 		params->codecContext->height,
 		params->codecContext->pix_fmt,
 		params->codecContext->width,
 		params->codecContext->height,
-		PIX_FMT_RGB48,
+		outputFormat,
 		SWS_SPLINE,
 		NULL,
 		NULL,
 		NULL);
 
-	avpicture_fill((AVPicture *)params->rgbFrame, params->rgbFramePayload, PIX_FMT_RGB48, params->codecContext->width, params->codecContext->height);
-
-	///////////////
-	// Meta Data //
-	///////////////
-	params->output->metaData->width = params->codecContext->width;
-	params->output->metaData->height = params->codecContext->height;
-	params->output->metaData->colorspace = MKVS_RGB48;
-	params->output->metaData->fpsNumerator = params->formatContext->streams[params->videoStream]->avg_frame_rate.num;
-	params->output->metaData->fpsDenominator = params->formatContext->streams[params->videoStream]->avg_frame_rate.den;
-
 	//////////////////////
 	// Queue and Return //
 	//////////////////////
-	mkvsynthQueue((void *)params, ffmpegDecode);
+	mkvsynthQueueTask((void *)params, ffmpegDecode, NULL, params->output);
+	mkvsynthQueueRender(params->output, ffmpegDecodeRender);
+	mkvsynthQueueThread(params->output);
 	RETURNCLIP(params->output);
 }
 
@@ -4,35 +4,75 @@
 #include "../../jarvis/jarvis.h"
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 struct x264EncodeParams {
 	char *filename;
 	char *x264params;
+	char const *inputCsp;
+	int threads;
 	MkvsynthInput *input;
+
+	// Only set with --segments, see segmentFrames(), last is 0 for the end
+	int segmented;
+	unsigned long long first;
+	unsigned long long last;
 };
 
+// Writes every line of every plane of 'payload' to x264
+static void writeLines(MkvsynthMetaData *metaData, uint8_t *payload, FILE *x264Proc) {
+	MkvsynthPlanes planes;
+	getPlanes(payload, metaData, &planes);
+
+	int i, plane;
+	for(plane = 0; plane < planes.count; plane++) {
+		for(i = 0; i < planes.height[plane]; i++)
+			fwrite(planes.data[plane] + i * planes.linesize[plane], planes.sampleBytes, planes.width[plane], x264Proc);
+	}
+}
+
 void *x264Encode(void *filterParams) {
 	struct x264EncodeParams *params = (struct x264EncodeParams*)filterParams;
 
 	char fullCommand[1024];
+	char threads[32] = "";
+	if(params->threads > 0)
+		snprintf(threads, sizeof(threads), "--threads %i ", params->threads);
 	
-	snprintf(fullCommand, sizeof(fullCommand), "x264 - --input-csp rgb --input-depth %i --fps %i/%i --input-res %ix%i %s -o %s",
+	snprintf(fullCommand, sizeof(fullCommand), "x264 - --input-csp %s --input-depth %i --fps %i/%i --input-res %ix%i %s%s -o %s",
+		params->inputCsp,
 		getDepth(params->input->metaData),
 		params->input->metaData->fpsNumerator,
 		params->input->metaData->fpsDenominator,
 		params->input->metaData->width,
 		params->input->metaData->height,
+		threads,
 		params->x264params,
 		params->filename);
 
 	FILE *x264Proc = popen(fullCommand, "w");
 
-	MkvsynthFrame *workingFrame = getReadOnlyFrame(params->input);
+	MkvsynthMetaData *metaData = params->input->metaData;
 
-	while(workingFrame->payload != NULL) {
-		fwrite(workingFrame->payload, 1, getBytes(params->input->metaData), x264Proc);
-		clearReadOnlyFrame(workingFrame);
-		workingFrame = getReadOnlyFrame(params->input);
+	// x264 wants the lines without the padding at the end of each of them,
+	// and planar frames one plane after the other
+	if(params->segmented) {
+		unsigned long long frame;
+		for(frame = params->first; params->last == 0 || frame < params->last; frame++) {
+			uint8_t *payload = requestFrame(params->input, frame);
+			if(payload == NULL)
+				break;
+
+			writeLines(metaData, payload, x264Proc);
+			clearPayload(payload);
+		}
+	} else {
+		MkvsynthFrame *workingFrame = getReadOnlyFrame(params->input);
+		while(workingFrame->payload != NULL) {
+			writeLines(metaData, workingFrame->payload, x264Proc);
+			clearReadOnlyFrame(workingFrame);
+			workingFrame = getReadOnlyFrame(params->input);
+		}
 	}
 
 	pclose(x264Proc);
@@ -40,6 +80,36 @@ void *x264Encode(void *filterParams) {
 	return NULL;
 }
 
+/******************************************************************************
+ * Every segment is encoded on its own, so each of them starts with a         *
+ * keyframe and the headers x264 needs, and raw h264 segments can simply be   *
+ * written one after another. Anything else is written as raw h264 first and  *
+ * then put into its container by ffmpeg, 'stitchParams' is the frame rate.   *
+ *****************************************************************************/
+static void x264Stitch(char const *filename, char **parts, int count, void *stitchParams) {
+	char const *extension = strrchr(filename, '.');
+	if(extension != NULL && (strcmp(extension, ".264") == 0 || strcmp(extension, ".h264") == 0)) {
+		concatenateFiles(filename, parts, count, NULL);
+		return;
+	}
+
+	char *stream = malloc(strlen(filename) + 8);
+	sprintf(stream, "%s.264", filename);
+	concatenateFiles(stream, parts, count, NULL);
+
+	char fullCommand[1024];
+	snprintf(fullCommand, sizeof(fullCommand), "ffmpeg -loglevel error -y -r %s -i '%s' -c copy '%s'",
+		(char *)stitchParams,
+		stream,
+		filename);
+
+	int result = system(fullCommand);
+	unlink(stream);
+	free(stream);
+	if(result != 0)
+		MkvsynthError("ffmpeg could not put the segments into %s", filename);
+}
+
 Value x264Encode_AST(argList *a) {
 	struct x264EncodeParams *params = malloc(sizeof(struct x264EncodeParams));
 
@@ -47,11 +117,48 @@ Value x264Encode_AST(argList *a) {
 	MkvsynthOutput *output = MANDCLIP(0);
 	params->filename = strdup(MANDSTR(1));
 	params->x264params = strdup(OPTSTR("params", ""));
+	params->threads = filterThreads();
 	params->input = createInputBuffer(output);
 
 	if(isMetaDataValid(params->input->metaData) != 1)
 		MkvsynthError("invalid colorspace!");
 
+	// Planar and subsampled YUV go to x264 as is, without shuffling the
+	// channels around
+	switch(params->input->metaData->colorspace) {
+		case MKVS_RGB48:
+		case MKVS_RGB24:
+			params->inputCsp = "rgb";
+			break;
+		case MKVS_YUV444_48_PLANAR:
+		case MKVS_YUV444_24_PLANAR:
+			params->inputCsp = "i444";
+			break;
+		case MKVS_YUV422_16:
+		case MKVS_YUV422_32:
+			params->inputCsp = "i422";
+			break;
+		case MKVS_YUV420_12:
+		case MKVS_YUV420_24:
+			params->inputCsp = "i420";
+			break;
+		default:
+			MkvsynthError("x264 only takes interleaved rgb or planar yuv, see convertColorspace");
+	}
+
+	// With --segments, this process encodes only its own share of the clip
+	params->first = 0;
+	params->last = 0;
+	params->segmented = segmentFrames(params->input->metaData, &params->first, &params->last);
+	if(params->segmented) {
+		char *fps = malloc(64);
+		sprintf(fps, "%i/%i", params->input->metaData->fpsNumerator, params->input->metaData->fpsDenominator);
+		char *part = segmentFile(params->filename, ".264", x264Stitch, fps);
+		free(params->filename);
+		params->filename = part;
+		pullFrames(params->input, 1);
+	}
+
 	mkvsynthQueue((void *)params, x264Encode);
     RETURNNULL();
 }
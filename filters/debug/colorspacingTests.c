@@ -7,33 +7,76 @@ struct ColorspacingTestsParams {
 	MkvsynthOutput *output;
 };
 
-void *colorspacingTests(void *filterParams) {
+// Converts rows firstRow through lastRow - 1 of 'input' into 'output'. The
+// two are always different frames: the even row of a 4:2:0 pair writes the
+// chroma that the odd row still has to read
+MKVSYNTH_GENERIC void colorspacingTestsRows(void *filterParams, uint8_t *input, uint8_t *output, int firstRow, int lastRow, MkvsynthLayout layout) {
 	struct ColorspacingTestsParams *params = (struct ColorspacingTestsParams *)filterParams;
+	MkvsynthMetaData *metaData = params->input->metaData;
+	uint16_t *samples = rowScratch(metaData->width * 3 * sizeof(uint16_t));
 
-	MkvsynthFrame *workingFrame = getFrame(params->input);
-
-	while(workingFrame->payload != NULL) {
-		int i, j;
-		for(i = 0; i < params->input->metaData->width; i++) {
-			for(j = 0; j < params->input->metaData->height; j++) {
-				MkvsynthPixel oldPixel = getPixel(workingFrame->payload, params->input->metaData, i, j);
-				MkvsynthPixel newPixel = {{{0}}};
-				newPixel.rgb48.r = getRed(&oldPixel, params->input->metaData);
-				newPixel.rgb48.g = getGreen(&oldPixel, params->input->metaData);
-				newPixel.rgb48.b = getBlue(&oldPixel, params->input->metaData);
-				putPixel(&newPixel, workingFrame->payload, params->output->metaData, i, j);
-			}
-		}
-		
-		putFrame(params->output, workingFrame->payload);
-		clearFrame(workingFrame); //Memeory Management
-		workingFrame = getFrame(params->input);
+	MkvsynthPlanes source, dest;
+	getPlanes(input, metaData, &source);
+	getPlanes(output, params->output->metaData, &dest);
+
+	// rowToRgb() gives 16 bit values, like getRed() and the rest
+	int shift = 16 - 8 * layout.sampleBytes;
+
+	int i, j, channel;
+	for(j = firstRow; j < lastRow; j++) {
+		MkvsynthLayoutRow sourceRow, destRow;
+		layoutRow(&source, layout, j, &sourceRow);
+		layoutRow(&dest, layout, j, &destRow);
+
+		for(i = 0; i < metaData->width; i++)
+			for(channel = 0; channel < 3; channel++)
+				samples[3*i + channel] = layoutGet(&sourceRow, layout, i, channel);
+
+		rowToRgb(samples, metaData, metaData->width);
+
+		for(i = 0; i < metaData->width; i++)
+			for(channel = 0; channel < 3; channel++)
+				layoutPut(&destRow, layout, i, channel, samples[3*i + channel] >> shift);
 	}
+}
+
+MKVSYNTH_SPECIALISE(colorspacingTestsRows)
+
+int colorspacingTests(void *filterParams) {
+	struct ColorspacingTestsParams *params = (struct ColorspacingTestsParams *)filterParams;
+
+	MkvsynthFrame *workingFrame = getReadOnlyFrame(params->input);
+
+	if(workingFrame->payload == NULL) {
+		putFrame(params->output, NULL);
+		clearReadOnlyFrame(workingFrame);
+		free(params);
+		return 0;
+	}
+
+	uint8_t *payload = getPayload(params->output);
+	MkvsynthRowKernel kernel = colorspacingTestsRowsKernel(params->output->metaData->colorspace);
+	processRows(kernel, params, workingFrame->payload, payload, params->output->metaData);
+
+	putFrame(params->output, payload);
+	clearReadOnlyFrame(workingFrame);
+	return 1;
+}
+
+// Converts output frame 'frame' on its own, see mkvsynthQueueRender()
+static uint8_t *colorspacingTestsRender(void *filterParams, unsigned long long frame) {
+	struct ColorspacingTestsParams *params = (struct ColorspacingTestsParams *)filterParams;
+
+	uint8_t *input = requestFrame(params->input, frame);
+	if(input == NULL)
+		return NULL;
+
+	uint8_t *payload = getPayload(params->output);
+	MkvsynthRowKernel kernel = colorspacingTestsRowsKernel(params->output->metaData->colorspace);
+	processRows(kernel, params, input, payload, params->output->metaData);
 
-	putFrame(params->output, NULL);
-	clearFrame(workingFrame);
-	free(params);
-	return NULL;
+	clearPayload(input);
+	return payload;
 }
 
 Value colorspacingTests_AST(argList *a) {
@@ -58,7 +101,10 @@ Value colorspacingTests_AST(argList *a) {
 	params->output->metaData->height = input->metaData->height;
 	params->output->metaData->fpsNumerator = input->metaData->fpsNumerator;
 	params->output->metaData->fpsDenominator = input->metaData->fpsDenominator;
+	params->output->metaData->frames = input->metaData->frames;
 
-	mkvsynthQueue((void *)params, colorspacingTests);
+	mkvsynthQueueTask((void *)params, colorspacingTests, params->input, params->output);
+	mkvsynthQueueRender(params->output, colorspacingTestsRender);
+	mkvsynthQueueRows(params->output, colorspacingTestsRowsKernel(input->metaData->colorspace));
 	RETURNCLIP(params->output);
 }
@@ -3,27 +3,41 @@
 
 struct gradientVideoGenerateParams {
 	int frames;
+	int frame;
 	MkvsynthOutput *output;
 };
 
-void *gradientVideoGenerate(void *filterParams) {
+// Every frame is a single shade, which depends only on the frame number
+static uint8_t *gradientVideoGenerateRender(void *filterParams, unsigned long long frame) {
 	struct gradientVideoGenerateParams *params = (struct gradientVideoGenerateParams*)filterParams;
 
-	int i, j;
-	for(i = 0; i < params->frames; i++) {
-		uint8_t *payload = malloc(getBytes(params->output->metaData));
-		uint16_t *shortPayload = (uint16_t *)payload;
+	if(frame >= params->frames)
+		return NULL;
 
-		int bytes = getBytes(params->output->metaData);
-		for(j = 0; j < bytes / 2; j++)
-			shortPayload[j] = (i % 256) << 8;
+	uint8_t *payload = getPayload(params->output);
+	uint16_t *shortPayload = (uint16_t *)payload;
 
-		putFrame(params->output, payload);
+	// The padding at the end of each line gets the same shade, it is never seen
+	int j;
+	int bytes = getBytes(params->output->metaData);
+	for(j = 0; j < bytes / 2; j++)
+		shortPayload[j] = (frame % 256) << 8;
+
+	return payload;
+}
+
+int gradientVideoGenerate(void *filterParams) {
+	struct gradientVideoGenerateParams *params = (struct gradientVideoGenerateParams*)filterParams;
+
+	if(params->frame == params->frames) {
+		putFrame(params->output, NULL);
+		free(params);
+		return 0;
 	}
 
-	putFrame(params->output, NULL);
-	free(params);
-	return NULL;
+	putFrame(params->output, gradientVideoGenerateRender(params, params->frame));
+	params->frame++;
+	return 1;
 }
 
 Value gradientVideoGenerate_AST(argList *a) {
@@ -48,15 +62,18 @@ Value gradientVideoGenerate_AST(argList *a) {
 	output->metaData->height = (int)height;
 	output->metaData->fpsNumerator = 60;
 	output->metaData->fpsDenominator = 1;
+	output->metaData->frames = numFrames;
 
 	////////////////////////
 	// Pthread Parameters //
 	////////////////////////
 	struct gradientVideoGenerateParams *params = malloc(sizeof(struct gradientVideoGenerateParams));
 	params->frames = numFrames;
+	params->frame = 0;
 	params->output = output;
 
-	mkvsynthQueue((void *)params, gradientVideoGenerate);
+	mkvsynthQueueTask((void *)params, gradientVideoGenerate, NULL, params->output);
+	mkvsynthQueueRender(params->output, gradientVideoGenerateRender);
 
 	RETURNCLIP(output);
 }
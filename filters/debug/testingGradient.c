@@ -3,27 +3,43 @@
 
 struct TestingGradientParams {
 	int frames;
+	int frame;
 	MkvsynthOutput *output;
 };
 
-void *testingGradient(void *filterParams) {
+// Every frame depends only on the frame number
+static uint8_t *testingGradientRender(void *filterParams, unsigned long long frame) {
 	struct TestingGradientParams *params = (struct TestingGradientParams*)filterParams;
 
+	if(frame >= params->frames)
+		return NULL;
+
+	uint8_t *payload = getPayload(params->output);
+	int linesize = getLinesize(params->output->metaData);
+	int channels = params->output->metaData->width * 3;
+
 	int i, j;
-	for(i = 0; i < params->frames; i++) {
-		uint8_t *payload = malloc(getBytes(params->output->metaData));
-		uint16_t *shortPayload = (uint16_t *)payload;
+	for(i = 0; i < params->output->metaData->height; i++) {
+		uint16_t *shortLine = (uint16_t *)(payload + i * linesize);
+		for(j = 0; j < channels; j++)
+			shortLine[j] = (i * channels + j + frame) % 65536;
+	}
 
-		int bytes = getBytes(params->output->metaData);
-		for(j = 0; j < bytes / 2; j++)
-			shortPayload[j] = (j + i) % 65536;
+	return payload;
+}
+
+int testingGradient(void *filterParams) {
+	struct TestingGradientParams *params = (struct TestingGradientParams*)filterParams;
 
-		putFrame(params->output, payload);
+	if(params->frame == params->frames) {
+		putFrame(params->output, NULL);
+		free(params);
+		return 0;
 	}
 
-	putFrame(params->output, NULL);
-	free(params);
-	return NULL;
+	putFrame(params->output, testingGradientRender(params, params->frame));
+	params->frame++;
+	return 1;
 }
 
 Value testingGradient_AST(argList *a) {
@@ -48,15 +64,18 @@ Value testingGradient_AST(argList *a) {
 	output->metaData->height = height;
 	output->metaData->fpsNumerator = 60;
 	output->metaData->fpsDenominator = 1;
+	output->metaData->frames = numFrames;
 
 	////////////////////////
 	// Pthread Parameters //
 	////////////////////////
 	struct TestingGradientParams *params = malloc(sizeof(struct TestingGradientParams));
 	params->frames = numFrames;
+	params->frame = 0;
 	params->output = output;
 
-	mkvsynthQueue((void *)params, testingGradient);
+	mkvsynthQueueTask((void *)params, testingGradient, NULL, params->output);
+	mkvsynthQueueRender(params->output, testingGradientRender);
 
 	RETURNCLIP(output);
 }
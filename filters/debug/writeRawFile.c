@@ -4,30 +4,73 @@
 #include "../../jarvis/jarvis.h"
 #include <stdio.h>
 
+// With first: or last:, frame is the next frame to write and last is the
+// final one (0 for the end of the clip), both counting from 1
 struct writeRawFileParams {
 	FILE *file;
+	int frame;
+	int last;
 	MkvsynthInput *input;
 };
 
-void *writeRawFile(void *filterParams) {
+// Writes every line of every plane of the frame, leaving out the padding at
+// the end of the lines
+static void writeLines(struct writeRawFileParams *params, uint8_t *payload) {
+	MkvsynthMetaData *metaData = params->input->metaData;
+
+	MkvsynthPlanes planes;
+	getPlanes(payload, metaData, &planes);
+
+	int i, plane;
+	for(plane = 0; plane < planes.count; plane++) {
+		for(i = 0; i < planes.height[plane]; i++)
+			fwrite(planes.data[plane] + i * planes.linesize[plane], planes.sampleBytes, planes.width[plane], params->file);
+	}
+}
+
+int writeRawFile(void *filterParams) {
 	struct writeRawFileParams *params = (struct writeRawFileParams *)filterParams;
 
 	/////////////////
-	// Filter Loop //
+	// Filter Step //
 	/////////////////
 	MkvsynthFrame *workingFrame = getReadOnlyFrame(params->input);
 
-	int frame = 1;
-	while(workingFrame->payload != NULL) {
-		fwrite(workingFrame->payload, 1, getBytes(params->input->metaData), params->file);
-		MkvsynthMessage("output frame %i", frame);
-		frame++;
-		clearReadOnlyFrame(workingFrame);
-		workingFrame = getReadOnlyFrame(params->input);
+	if(workingFrame->payload == NULL) {
+		fclose(params->file);
+		free(params);
+		return 0;
+	}
+
+	writeLines(params, workingFrame->payload);
+	MkvsynthMessage("output frame %i", params->frame);
+	params->frame++;
+	clearReadOnlyFrame(workingFrame);
+	return 1;
+}
+
+// Pulls only the frames between first and last, see requestFrame()
+int writeRawFileRange(void *filterParams) {
+	struct writeRawFileParams *params = (struct writeRawFileParams *)filterParams;
+
+	/////////////////
+	// Filter Step //
+	/////////////////
+	uint8_t *payload = NULL;
+	if(params->last == 0 || params->frame <= params->last)
+		payload = requestFrame(params->input, params->frame - 1);
+
+	if(payload == NULL) {
+		fclose(params->file);
+		free(params);
+		return 0;
 	}
 
-	free(params);
-	return NULL;
+	writeLines(params, payload);
+	MkvsynthMessage("output frame %i", params->frame);
+	params->frame++;
+	clearPayload(payload);
+	return 1;
 }
 
 Value writeRawFile_AST(argList *a) {
@@ -37,16 +80,37 @@ Value writeRawFile_AST(argList *a) {
 	MkvsynthOutput *output = MANDCLIP(0);
 	char *filename = MANDSTR(1);
 
+	params->frame = OPTNUM("first", 1);
+	params->last = OPTNUM("last", 0);
+	params->input = createInputBuffer(output);
+
 	////////////////////
 	// Error Checking //
 	////////////////////
+	if(params->frame < 1 || params->last < 0)
+		MkvsynthError("first and last must be frame numbers, starting from 1");
+
+	// With --segments, only this process's share of the frames gets written,
+	// to a file of its own that is stitched onto the others afterwards
+	unsigned long long first = params->frame - 1;
+	unsigned long long last = params->last;
+	int segmented = segmentFrames(params->input->metaData, &first, &last);
+	if(segmented) {
+		params->frame = first + 1;
+		params->last = last;
+		filename = segmentFile(filename, NULL, concatenateFiles, NULL);
+	}
+
 	params->file = fopen(filename, "w");
 	if(params->file == NULL)
 		MkvsynthError("Could not open the output file!");
 
-	params->input = createInputBuffer(output);
-
-	mkvsynthQueue((void *)params, writeRawFile);
+	if(!segmented && getOptArg(a, "first", typeNum) == NULL && getOptArg(a, "last", typeNum) == NULL) {
+		mkvsynthQueueTask((void *)params, writeRawFile, params->input, NULL);
+	} else {
+		pullFrames(params->input, 1);
+		mkvsynthQueueTask((void *)params, writeRawFileRange, params->input, NULL);
+	}
     RETURNNULL();
 }
 
@@ -10,68 +10,103 @@ struct BilinearResizeParams {
 	MkvsynthOutput *output;
 };
 
-void *bilinearResize(void *filterParams) {
+// Resizes rows firstRow through lastRow - 1 of the output, reading the
+// samples straight out of the planes (see MKVSYNTH_SPECIALISE()). Each
+// weighted sample is added on its own and cut off to a whole number, exactly
+// as addPixel() would
+MKVSYNTH_GENERIC void bilinearResizeRows(void *filterParams, uint8_t *input, uint8_t *output, int firstRow, int lastRow, MkvsynthLayout layout) {
 	struct BilinearResizeParams *params = (struct BilinearResizeParams *)filterParams;
-
-	MkvsynthFrame *workingFrame = getReadOnlyFrame(params->input);
-
-	while(workingFrame->payload != NULL) {
-		uint8_t *payload = malloc(getBytes(params->output->metaData));
-
-		double xRatio = ((double)params->input->metaData->width - 1) / ((double)params->output->metaData->width - 1);
-		double yRatio = ((double)params->input->metaData->height - 1) / ((double)params->output->metaData->height - 1);
-		
-		int i, j;
-		for(i = 0; i < params->output->metaData->height; i++) {
-			for(j = 0; j < params->output->metaData->width; j++) {
-				double x = (double)j * xRatio;
-				double y = (double)i * yRatio;
-
-				int xLeft   = floor(x);
-				int xRight  = ceil((float)x);
-				int yTop    = floor(y);
-				int yBottom = ceil((float)y);
-
-				double rightDiff = xRight - x;
-				double leftDiff = x - xLeft;
-				double bottomDiff = yBottom - y;
-				double topDiff = y - yTop;
-
-				if(leftDiff == 0)
-					leftDiff = 1;
-
-				if(topDiff == 0)
-					topDiff = 1;
-
-				double topLeftWeight     = rightDiff * bottomDiff;
-				double topRightWeight    = leftDiff  * bottomDiff;
-				double bottomLeftWeight  = rightDiff * topDiff;
-				double bottomRightWeight = leftDiff  * topDiff;
-
-				MkvsynthPixel topLeft     = getPixel(workingFrame->payload, params->input->metaData, xLeft,  yTop);
-				MkvsynthPixel topRight    = getPixel(workingFrame->payload, params->input->metaData, xRight, yTop);
-				MkvsynthPixel bottomLeft  = getPixel(workingFrame->payload, params->input->metaData, xLeft,  yBottom);
-				MkvsynthPixel bottomRight = getPixel(workingFrame->payload, params->input->metaData, xRight, yBottom);
-
-				MkvsynthPixel newPixel = {{{0}}};
-				addPixel(&newPixel, &topLeft,     params->output->metaData->colorspace, topLeftWeight);
-				addPixel(&newPixel, &topRight,    params->output->metaData->colorspace, topRightWeight);
-				addPixel(&newPixel, &bottomLeft,  params->output->metaData->colorspace, bottomLeftWeight);
-				addPixel(&newPixel, &bottomRight, params->output->metaData->colorspace, bottomRightWeight);
-
-				putPixel(&newPixel, payload, params->output->metaData, j, i);
+	MkvsynthMetaData *inputMetaData = params->input->metaData;
+	MkvsynthMetaData *outputMetaData = params->output->metaData;
+
+	double xRatio = ((double)inputMetaData->width - 1) / ((double)outputMetaData->width - 1);
+	double yRatio = ((double)inputMetaData->height - 1) / ((double)outputMetaData->height - 1);
+
+	MkvsynthPlanes source, dest;
+	getPlanes(input, inputMetaData, &source);
+	getPlanes(output, outputMetaData, &dest);
+
+	int i, j, channel;
+	for(i = firstRow; i < lastRow; i++) {
+		double y = (double)i * yRatio;
+		int yTop    = floor(y);
+		int yBottom = ceil((float)y);
+
+		double bottomDiff = yBottom - y;
+		double topDiff = y - yTop;
+		if(topDiff == 0)
+			topDiff = 1;
+
+		MkvsynthLayoutRow top, bottom, result;
+		layoutRow(&source, layout, yTop, &top);
+		layoutRow(&source, layout, yBottom, &bottom);
+		layoutRow(&dest, layout, i, &result);
+
+		for(j = 0; j < outputMetaData->width; j++) {
+			double x = (double)j * xRatio;
+			int xLeft   = floor(x);
+			int xRight  = ceil((float)x);
+
+			double rightDiff = xRight - x;
+			double leftDiff = x - xLeft;
+			if(leftDiff == 0)
+				leftDiff = 1;
+
+			double topLeftWeight     = rightDiff * bottomDiff;
+			double topRightWeight    = leftDiff  * bottomDiff;
+			double bottomLeftWeight  = rightDiff * topDiff;
+			double bottomRightWeight = leftDiff  * topDiff;
+
+			for(channel = 0; channel < 3; channel++) {
+				uint16_t sample = 0;
+				sample += layoutGet(&top, layout, xLeft, channel)     * topLeftWeight;
+				sample += layoutGet(&top, layout, xRight, channel)    * topRightWeight;
+				sample += layoutGet(&bottom, layout, xLeft, channel)  * bottomLeftWeight;
+				sample += layoutGet(&bottom, layout, xRight, channel) * bottomRightWeight;
+				layoutPut(&result, layout, j, channel, sample);
 			}
 		}
+	}
+}
 
-		putFrame(params->output, payload);
+MKVSYNTH_SPECIALISE(bilinearResizeRows)
+
+int bilinearResize(void *filterParams) {
+	struct BilinearResizeParams *params = (struct BilinearResizeParams *)filterParams;
+
+	MkvsynthFrame *workingFrame = getReadOnlyFrame(params->input);
+
+	if(workingFrame->payload == NULL) {
+		putFrame(params->output, NULL);
 		clearReadOnlyFrame(workingFrame);
-		workingFrame = getReadOnlyFrame(params->input);
+		free(params);
+		return 0;
 	}
 
-	putFrame(params->output, NULL);
+	// The colorspace is looked at once per frame, not once per sample
+	MkvsynthRowKernel kernel = bilinearResizeRowsKernel(params->output->metaData->colorspace);
+	uint8_t *payload = getPayload(params->output);
+	processRows(kernel, params, workingFrame->payload, payload, params->output->metaData);
+
+	putFrame(params->output, payload);
 	clearReadOnlyFrame(workingFrame);
-	free(params);
-	return NULL;
+	return 1;
+}
+
+// Resizes output frame 'frame' on its own, see mkvsynthQueueRender()
+static uint8_t *bilinearResizeRender(void *filterParams, unsigned long long frame) {
+	struct BilinearResizeParams *params = (struct BilinearResizeParams *)filterParams;
+
+	uint8_t *input = requestFrame(params->input, frame);
+	if(input == NULL)
+		return NULL;
+
+	MkvsynthRowKernel kernel = bilinearResizeRowsKernel(params->output->metaData->colorspace);
+	uint8_t *payload = getPayload(params->output);
+	processRows(kernel, params, input, payload, params->output->metaData);
+
+	clearPayload(input);
+	return payload;
 }
 
 Value bilinearResize_AST(argList *a) {
@@ -94,6 +129,7 @@ Value bilinearResize_AST(argList *a) {
 	params->output->metaData->height = (unsigned long long)MANDNUM(2);
 	params->output->metaData->fpsNumerator = input->metaData->fpsNumerator;
 	params->output->metaData->fpsDenominator = input->metaData->fpsDenominator;
+	params->output->metaData->frames = input->metaData->frames;
 
 	////////////////////
 	// Error Checking //
@@ -104,7 +140,8 @@ Value bilinearResize_AST(argList *a) {
 	if(isMetaDataValid(params->output->metaData) != 1)
 		MkvsynthError("invalid ouput!");
 
-	mkvsynthQueue((void *)params, bilinearResize);
+	mkvsynthQueueTask((void *)params, bilinearResize, params->input, params->output);
+	mkvsynthQueueRender(params->output, bilinearResizeRender);
 	RETURNCLIP(params->output);
 }
 
@@ -1,35 +1,161 @@
 #include "../../jarvis/jarvis.h"
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 
 struct ConvertColorspaceParams {
 	short colorspace;
+	MkvsynthConversion conversion;
 	MkvsynthInput *input;
 	MkvsynthOutput *output;
 };
 
-void *convertColorspace(void *filterParams) {
+// The names that the script can use for each colorspace
+static struct {
+	char const *name;
+	c_space colorspace;
+} colorspaceNames[] = {
+	{ "rgb48",            MKVS_RGB48 },
+	{ "rgb24",            MKVS_RGB24 },
+	{ "yuv444_48",        MKVS_YUV444_48 },
+	{ "yuv444_24",        MKVS_YUV444_24 },
+	{ "hsv48",            MKVS_HSV48 },
+	{ "hsv24",            MKVS_HSV24 },
+	{ "hsl48",            MKVS_HSL48 },
+	{ "hsl24",            MKVS_HSL24 },
+	{ "rgb48_planar",     MKVS_RGB48_PLANAR },
+	{ "rgb24_planar",     MKVS_RGB24_PLANAR },
+	{ "yuv444_48_planar", MKVS_YUV444_48_PLANAR },
+	{ "yuv444_24_planar", MKVS_YUV444_24_PLANAR },
+	{ "hsv48_planar",     MKVS_HSV48_PLANAR },
+	{ "hsv24_planar",     MKVS_HSV24_PLANAR },
+	{ "hsl48_planar",     MKVS_HSL48_PLANAR },
+	{ "hsl24_planar",     MKVS_HSL24_PLANAR },
+	{ "yuv420_12",        MKVS_YUV420_12 },
+	{ "yuv420_24",        MKVS_YUV420_24 },
+	{ "yuv422_16",        MKVS_YUV422_16 },
+	{ "yuv422_32",        MKVS_YUV422_32 },
+};
+
+/******************************************************************************
+ * Converts rows firstRow through lastRow - 1 of the output. Each channel is  *
+ * copied on its own, from wherever it is in the input (interleaved or a      *
+ * plane of its own) to wherever it goes in the output. Going from 16 to 8    *
+ * bits keeps the high byte, and going from 8 to 16 bits multiplies by 257 so *
+ * that 255 becomes 65535. Going to a subsampled colorspace keeps the top     *
+ * left Cb and Cr sample of every block, and coming from one repeats them.    *
+ *                                                                            *
+ * Going to another colour model takes whole rows instead, see                *
+ * convertModelRows().                                                        *
+ *****************************************************************************/
+static void convertChannelRows(void *filterParams, uint8_t *input, uint8_t *output, int firstRow, int lastRow) {
 	struct ConvertColorspaceParams *params = (struct ConvertColorspaceParams *)filterParams;
 
-	MkvsynthFrame *workingFrame = getReadOnlyFrame(params->input);
+	MkvsynthPlanes source, dest;
+	getPlanes(input, params->input->metaData, &source);
+	getPlanes(output, params->output->metaData, &dest);
+	int width = params->output->metaData->width;
+
+	int sourceWidthShift, sourceHeightShift, destWidthShift, destHeightShift;
+	getChromaShift(params->input->metaData, &sourceWidthShift, &sourceHeightShift);
+	getChromaShift(params->output->metaData, &destWidthShift, &destHeightShift);
+
+	int sourceStep = source.count == 1 ? 3 : 1;
+	int destStep = dest.count == 1 ? 3 : 1;
 
-	while(workingFrame->payload != NULL) {
-		uint8_t *payload = malloc(getBytes(params->output->metaData));
+	int i, j, channel;
+	for(channel = 0; channel < 3; channel++) {
+		int sourcePlane = source.count == 1 ? 0 : channel;
+		int destPlane = dest.count == 1 ? 0 : channel;
+		int sourceOffset = source.count == 1 ? channel : 0;
+		int destOffset = dest.count == 1 ? channel : 0;
 
-		int i;
-		for(i = 0; i < getBytes(params->output->metaData); i++) {
-			payload[i] = workingFrame->payload[i*2 + 1];
+		// Luma (and every channel of a colorspace that is not subsampled)
+		// has a sample for every pixel
+		int sx = channel > 0 ? sourceWidthShift : 0;
+		int sy = channel > 0 ? sourceHeightShift : 0;
+		int dx = channel > 0 ? destWidthShift : 0;
+		int dy = channel > 0 ? destHeightShift : 0;
+
+		for(i = firstRow >> dy; i < lastRow >> dy; i++) {
+			uint8_t *inputLine = source.data[sourcePlane] + ((i << dy) >> sy) * source.linesize[sourcePlane];
+			uint8_t *outputLine = dest.data[destPlane] + i * dest.linesize[destPlane];
+			uint16_t *deepInputLine = (uint16_t *)inputLine;
+			uint16_t *deepOutputLine = (uint16_t *)outputLine;
+
+			if(source.sampleBytes == 2 && dest.sampleBytes == 2) {
+				for(j = 0; j < width >> dx; j++)
+					deepOutputLine[j*destStep + destOffset] = deepInputLine[((j << dx) >> sx)*sourceStep + sourceOffset];
+			} else if(source.sampleBytes == 2) {
+				for(j = 0; j < width >> dx; j++)
+					outputLine[j*destStep + destOffset] = deepInputLine[((j << dx) >> sx)*sourceStep + sourceOffset] >> 8;
+			} else if(dest.sampleBytes == 2) {
+				for(j = 0; j < width >> dx; j++)
+					deepOutputLine[j*destStep + destOffset] = inputLine[((j << dx) >> sx)*sourceStep + sourceOffset] * 257;
+			} else {
+				for(j = 0; j < width >> dx; j++)
+					outputLine[j*destStep + destOffset] = inputLine[((j << dx) >> sx)*sourceStep + sourceOffset];
+			}
 		}
-		
-		putFrame(params->output, payload);
+	}
+}
+
+// Converts rows firstRow through lastRow - 1 of the output to another colour
+// model, see convertSamples()
+static void convertModelRows(void *filterParams, uint8_t *input, uint8_t *output, int firstRow, int lastRow) {
+	struct ConvertColorspaceParams *params = (struct ConvertColorspaceParams *)filterParams;
+	uint16_t *samples = rowScratch(params->output->metaData->width * 3 * sizeof(uint16_t));
+
+	int i;
+	for(i = firstRow; i < lastRow; i++) {
+		getRow(input, params->input->metaData, i, samples);
+		convertSamples(&params->conversion, samples, params->output->metaData->width);
+		putRow(samples, output, params->output->metaData, i);
+	}
+}
+
+static void convertColorspaceRows(void *filterParams, uint8_t *input, uint8_t *output, int firstRow, int lastRow) {
+	struct ConvertColorspaceParams *params = (struct ConvertColorspaceParams *)filterParams;
+
+	if(params->conversion.fromModel == params->conversion.toModel)
+		convertChannelRows(filterParams, input, output, firstRow, lastRow);
+	else
+		convertModelRows(filterParams, input, output, firstRow, lastRow);
+}
+
+int convertColorspace(void *filterParams) {
+	struct ConvertColorspaceParams *params = (struct ConvertColorspaceParams *)filterParams;
+
+	MkvsynthFrame *workingFrame = getReadOnlyFrame(params->input);
+
+	if(workingFrame->payload == NULL) {
+		putFrame(params->output, NULL);
 		clearReadOnlyFrame(workingFrame);
-		workingFrame = getReadOnlyFrame(params->input);
+		free(params);
+		return 0;
 	}
 
-	putFrame(params->output, NULL);
+	uint8_t *payload = getPayload(params->output);
+	processRows(convertColorspaceRows, params, workingFrame->payload, payload, params->output->metaData);
+
+	putFrame(params->output, payload);
 	clearReadOnlyFrame(workingFrame);
-	free(params);
-	return NULL;
+	return 1;
+}
+
+// Converts output frame 'frame' on its own, see mkvsynthQueueRender()
+static uint8_t *convertColorspaceRender(void *filterParams, unsigned long long frame) {
+	struct ConvertColorspaceParams *params = (struct ConvertColorspaceParams *)filterParams;
+
+	uint8_t *input = requestFrame(params->input, frame);
+	if(input == NULL)
+		return NULL;
+
+	uint8_t *payload = getPayload(params->output);
+	processRows(convertColorspaceRows, params, input, payload, params->output->metaData);
+
+	clearPayload(input);
+	return payload;
 }
 
 Value convertColorspace_AST(argList *a) {
@@ -41,17 +167,34 @@ Value convertColorspace_AST(argList *a) {
 	checkArgs(a, 2, typeClip, typeStr);
 	MkvsynthOutput *input = MANDCLIP(0);
 	char *colorspaceStr = MANDSTR(1);
+	char *matrixStr = OPTSTR("matrix", "601");
 
-	if(strcmp(colorspaceStr, "rgb24") || strcmp(colorspaceStr, "MKVS_RGB24"))
-		params->colorspace = MKVS_RGB24;
-	else
-		MkvsynthError("Currently the only valid output colorspace is rgb24!");
+	// MKVS_RGB24 works as well as rgb24
+	char *name = colorspaceStr;
+	if(strncasecmp(name, "MKVS_", 5) == 0)
+		name += 5;
+
+	params->colorspace = NULL_COLOR;
+	int i;
+	for(i = 0; i < sizeof(colorspaceNames) / sizeof(colorspaceNames[0]); i++) {
+		if(strcasecmp(name, colorspaceNames[i].name) == 0)
+			params->colorspace = colorspaceNames[i].colorspace;
+	}
+
+	if(params->colorspace == NULL_COLOR)
+		MkvsynthError("%s is not a colorspace, try rgb24 or yuv444_24_planar", colorspaceStr);
 
 	params->input = createInputBuffer(input);
 	params->output = createOutputBuffer();
 
-	if(params->input->metaData->colorspace != MKVS_RGB48)
-		MkvsynthError("Currently the only valid input colorspace is rgb48!");
+	// YCbCr uses the BT.601 coefficients unless told otherwise
+	int matrix = MKVS_BT601;
+	if(strcmp(matrixStr, "709") == 0)
+		matrix = MKVS_BT709;
+	else if(strcmp(matrixStr, "601") != 0)
+		MkvsynthError("%s is not a matrix, try 601 or 709", matrixStr);
+
+	prepareConversion(&params->conversion, params->input->metaData->colorspace, params->colorspace, matrix);
 
 	///////////////
 	// Meta Data //
@@ -61,7 +204,13 @@ Value convertColorspace_AST(argList *a) {
 	params->output->metaData->height = input->metaData->height;
 	params->output->metaData->fpsNumerator = input->metaData->fpsNumerator;
 	params->output->metaData->fpsDenominator = input->metaData->fpsDenominator;
+	params->output->metaData->frames = input->metaData->frames;
+
+	if(isMetaDataValid(params->output->metaData) != 1)
+		MkvsynthError("the resolution of the input does not work in %s", colorspaceStr);
 
-	mkvsynthQueue((void *)params, convertColorspace);
+	mkvsynthQueueTask((void *)params, convertColorspace, params->input, params->output);
+	mkvsynthQueueRender(params->output, convertColorspaceRender);
+	mkvsynthQueueRows(params->output, convertColorspaceRows);
 	RETURNCLIP(params->output);
 }
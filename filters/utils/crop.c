@@ -11,32 +11,70 @@ struct CropParams {
 	MkvsynthOutput *output;
 };
 
-void *crop(void *filterParams) {
+// Copies rows firstRow through lastRow - 1 of every plane of the output, and
+// the matching rows of subsampled planes
+MKVSYNTH_GENERIC void cropRows(void *filterParams, uint8_t *input, uint8_t *output, int firstRow, int lastRow, MkvsynthLayout layout) {
 	struct CropParams *params = (struct CropParams *)filterParams;
 
-	MkvsynthFrame *workingFrame = getReadOnlyFrame(params->input);
+	MkvsynthPlanes source, dest;
+	getPlanes(input, params->input->metaData, &source);
+	getPlanes(output, params->output->metaData, &dest);
+
+	int pixelBytes = layout.planar ? layout.sampleBytes : 3 * layout.sampleBytes;
+	int planes = layout.planar ? 3 : 1;
 
-	while(workingFrame->payload != NULL) {
-		uint8_t *payload = malloc(getBytes(params->output->metaData));
+	int i, plane;
+	for(plane = 0; plane < planes; plane++) {
+		int xShift = plane > 0 ? layout.widthShift : 0;
+		int yShift = plane > 0 ? layout.heightShift : 0;
+		int lineBytes = dest.width[plane] * layout.sampleBytes;
 
-		int i;
-		for(i = 0; i < params->output->metaData->height; i++) {
-			int sourceOffset = (double)((double)params->left / (double)params->input->metaData->width) * (double)getLinesize(params->input->metaData);
-			sourceOffset += (i + params->top) * getLinesize(params->input->metaData);
-			int offsetSize = getLinesize(params->output->metaData);
-			int destOffset = i * offsetSize;
-			memcpy(payload+destOffset, workingFrame->payload+sourceOffset, offsetSize);
+		for(i = firstRow >> yShift; i < lastRow >> yShift; i++) {
+			int sourceOffset = (params->left >> xShift) * pixelBytes;
+			sourceOffset += (i + (params->top >> yShift)) * source.linesize[plane];
+			int destOffset = i * dest.linesize[plane];
+			memcpy(dest.data[plane]+destOffset, source.data[plane]+sourceOffset, lineBytes);
 		}
-		
-		putFrame(params->output, payload);
+	}
+}
+
+MKVSYNTH_SPECIALISE(cropRows)
+
+int crop(void *filterParams) {
+	struct CropParams *params = (struct CropParams *)filterParams;
+
+	MkvsynthFrame *workingFrame = getReadOnlyFrame(params->input);
+
+	if(workingFrame->payload == NULL) {
+		putFrame(params->output, NULL);
 		clearReadOnlyFrame(workingFrame);
-		workingFrame = getReadOnlyFrame(params->input);
+		free(params);
+		return 0;
 	}
 
-	putFrame(params->output, NULL);
+	MkvsynthRowKernel kernel = cropRowsKernel(params->output->metaData->colorspace);
+	uint8_t *payload = getPayload(params->output);
+	processRows(kernel, params, workingFrame->payload, payload, params->output->metaData);
+
+	putFrame(params->output, payload);
 	clearReadOnlyFrame(workingFrame);
-	free(params);
-	return NULL;
+	return 1;
+}
+
+// Crops output frame 'frame' on its own, see mkvsynthQueueRender()
+static uint8_t *cropRender(void *filterParams, unsigned long long frame) {
+	struct CropParams *params = (struct CropParams *)filterParams;
+
+	uint8_t *input = requestFrame(params->input, frame);
+	if(input == NULL)
+		return NULL;
+
+	MkvsynthRowKernel kernel = cropRowsKernel(params->output->metaData->colorspace);
+	uint8_t *payload = getPayload(params->output);
+	processRows(kernel, params, input, payload, params->output->metaData);
+
+	clearPayload(input);
+	return payload;
 }
 
 Value crop_AST(argList *a) {
@@ -63,6 +101,7 @@ Value crop_AST(argList *a) {
 	params->output->metaData->height = input->metaData->height - params->top - params->bottom;
 	params->output->metaData->fpsNumerator = input->metaData->fpsNumerator;
 	params->output->metaData->fpsDenominator = input->metaData->fpsDenominator;
+	params->output->metaData->frames = input->metaData->frames;
 
 	////////////////////
 	// Error Checking //
@@ -88,6 +127,7 @@ Value crop_AST(argList *a) {
 	if((params->top + params->bottom) > input->metaData->height)
 		MkvsynthError("cannot crop that many rows! Insufficient video height!");
 
-	mkvsynthQueue((void *)params, crop);
+	mkvsynthQueueTask((void *)params, crop, params->input, params->output);
+	mkvsynthQueueRender(params->output, cropRender);
 	RETURNCLIP(params->output);
 }
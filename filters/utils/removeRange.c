@@ -1,36 +1,45 @@
 #include "../../jarvis/jarvis.h"
 #include <stdio.h>
 
-// first and last are inclusive
+// first and last are inclusive, frame is the number of the next frame
 struct RemoveRangeParams {
 	unsigned long long first;
 	unsigned long long last;
+	unsigned long long frame;
 	MkvsynthInput *input;
 	MkvsynthOutput *output;
 };
 
-void *removeRange(void *filterParams) {
+int removeRange(void *filterParams) {
 	struct RemoveRangeParams *params = (struct RemoveRangeParams *)filterParams;
 
-	MkvsynthFrame *workingFrame = getFrame(params->input);
+	MkvsynthFrame *workingFrame = getReadOnlyFrame(params->input);
 
-	int frame = 1;
-	while(workingFrame->payload != NULL) {
-		if(frame < params->first || frame > params->last) {
-			putFrame(params->output, workingFrame->payload);
-			clearFrame(workingFrame);
-		} else {
-			clearReadOnlyFrame(workingFrame); // This will destroy all parts of the frame
-		}
-
-		workingFrame = getFrame(params->input);
-		frame++;
+	if(workingFrame->payload == NULL) {
+		putFrame(params->output, NULL);
+		clearReadOnlyFrame(workingFrame);
+		free(params);
+		return 0;
 	}
 
-	putFrame(params->output, NULL);
-	clearFrame(workingFrame);
-	free(params);
-	return NULL;
+	// The payloads are passed along untouched, so they never need to be copied
+	if(params->frame < params->first || params->frame > params->last)
+		putFrame(params->output, sharePayload(workingFrame->payload, 1));
+	clearReadOnlyFrame(workingFrame);
+
+	params->frame++;
+	return 1;
+}
+
+// Output frame 'frame' is the input frame with the same number, or the one
+// 'last - first + 1' frames later once the removed range has been skipped
+static uint8_t *removeRangeRender(void *filterParams, unsigned long long frame) {
+	struct RemoveRangeParams *params = (struct RemoveRangeParams *)filterParams;
+
+	if(params->first <= params->last && frame + 1 >= params->first)
+		frame += params->last - params->first + 1;
+
+	return requestFrame(params->input, frame);
 }
 
 Value removeRange_AST(argList *a) {
@@ -41,8 +50,16 @@ Value removeRange_AST(argList *a) {
 	///////////////////////
 	checkArgs(a, 3, typeClip, typeNum, typeNum);
 	MkvsynthOutput *input = MANDCLIP(0);
-	params->first = (unsigned long long)MANDNUM(1);
-	params->last = (unsigned long long)MANDNUM(2);
+	double first = MANDNUM(1);
+	double last = MANDNUM(2);
+	params->frame = 1;
+
+	// Frames count from 1, so the step, the render and the frame count all
+	// start the range at frame 1 at the earliest. The range may also run past
+	// the end of the clip, but 'frames' can be an estimate, so only the frame
+	// count stops it there
+	params->first = first > 1 ? (unsigned long long)first : 1;
+	params->last = last > 0 ? (unsigned long long)last : 0;
 
 	params->input = createInputBuffer(input);
 	params->output = createOutputBuffer();
@@ -56,6 +73,13 @@ Value removeRange_AST(argList *a) {
 	params->output->metaData->fpsNumerator = input->metaData->fpsNumerator;
 	params->output->metaData->fpsDenominator = input->metaData->fpsDenominator;
 
-	mkvsynthQueue((void *)params, removeRange);
+	unsigned long long frames = input->metaData->frames;
+	unsigned long long end = params->last < frames ? params->last : frames;
+	if(params->first <= end)
+		frames -= end - params->first + 1;
+	params->output->metaData->frames = frames;
+
+	mkvsynthQueueTask((void *)params, removeRange, params->input, params->output);
+	mkvsynthQueueRender(params->output, removeRangeRender);
 	RETURNCLIP(params->output);
 }
@@ -0,0 +1,336 @@
+#include "advisor.h"
+#include <time.h>
+#include <unistd.h>
+
+/******************************************************************************
+ * Also see MkvsynthBufferWatch                                               *
+ *                                                                            *
+ * The advisor is a thread that runs next to the filters while go() is        *
+ * running and keeps an eye on how full the rings between them are. The       *
+ * filter that holds the script back is the one whose input is full most of   *
+ * the time (the filters before it are waiting for it to take their frames)   *
+ * while its output is empty most of the time (the filters after it are       *
+ * waiting for it to produce frames). Every report interval the advisor       *
+ * prints that filter, together with what would help, so a long encode shows  *
+ * which filter is limiting its speed while it is still running.              *
+ *****************************************************************************/
+static MkvsynthBufferWatch *watchList = NULL;
+static double advisorInterval = 0;
+static int advisorRunning = 0;
+static pthread_t advisorThread;
+static pthread_mutex_t advisorLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t advisorWake;
+
+/******************************************************************************
+ * Also see allocateBuffers()                                                 *
+ *                                                                            *
+ * watchBuffers adds every input reading from one of 'outputs' to the rings   *
+ * that the advisor looks at. Outputs without a ring (rendered on demand) are *
+ * skipped, since nothing ever waits in them.                                 *
+ *****************************************************************************/
+void watchBuffers(MkvsynthOutput *outputs) {
+	MkvsynthOutput *output;
+	MkvsynthInput *input;
+
+	for(output = outputs; output != NULL; output = output->nextOutput) {
+		if(output->frames == NULL || output->writer == NULL)
+			continue;
+
+		for(input = output->inputs; input != NULL; input = input->nextInput) {
+			if(input->reader == NULL)
+				continue;
+
+			MkvsynthBufferWatch *watch = malloc(sizeof(MkvsynthBufferWatch));
+			watch->input = input;
+			watch->samples = 0;
+			watch->fullSamples = 0;
+			watch->emptySamples = 0;
+			watch->framesWaiting = 0;
+
+			watch->next = watchList;
+			watchList = watch;
+		}
+	}
+}
+
+/******************************************************************************
+ * A ring is only looked at while the filters on both sides of it are still   *
+ * running. Once the filter writing to it has finished the ring empties out,  *
+ * which says nothing about how fast that filter was.                         *
+ *****************************************************************************/
+static void sampleBuffers() {
+	MkvsynthBufferWatch *watch;
+	for(watch = watchList; watch != NULL; watch = watch->next) {
+		MkvsynthInput *input = watch->input;
+		MkvsynthOutput *output = input->output;
+
+		// framesRead is loaded first, so framesWritten can not be older
+		unsigned int framesRead = atomic_load_explicit(&input->framesRead, memory_order_relaxed);
+		unsigned int framesWritten = atomic_load_explicit(&output->framesWritten, memory_order_relaxed);
+		int waiting = framesWritten - framesRead;
+		if(waiting > output->bufferDepth)
+			waiting = output->bufferDepth;
+
+		if(atomic_load(&input->reader->running) == 0)
+			continue;
+		if(waiting == 0 && atomic_load(&output->writer->running) == 0)
+			continue;
+
+		watch->samples++;
+		watch->framesWaiting += waiting;
+		if(waiting == output->bufferDepth)
+			watch->fullSamples++;
+		else if(waiting == 0)
+			watch->emptySamples++;
+	}
+}
+
+static double share(int part, int whole) {
+	return whole > 0 ? (double)part / whole : 0;
+}
+
+// How full the ring was on average, between 0 and 1
+static double bufferFill(MkvsynthBufferWatch *watch) {
+	return (double)watch->framesWaiting / watch->samples / watch->input->output->bufferDepth;
+}
+
+/******************************************************************************
+ * filterPressure is how full the inputs of a filter were times how empty its *
+ * outputs were, between 0 and 1. A filter without inputs (a decoder) is      *
+ * judged on its outputs alone, and one without outputs (an encoder) on its   *
+ * inputs alone.                                                              *
+ *****************************************************************************/
+static double filterPressure(MkvsynthFilterStats *stats) {
+	double full = 0, empty = 0;
+	int inputs = 0, outputs = 0;
+
+	MkvsynthBufferWatch *watch;
+	for(watch = watchList; watch != NULL; watch = watch->next) {
+		if(watch->samples == 0)
+			continue;
+
+		if(watch->input->reader == stats) {
+			full += bufferFill(watch);
+			inputs++;
+		}
+		if(watch->input->output->writer == stats) {
+			empty += 1 - bufferFill(watch);
+			outputs++;
+		}
+	}
+
+	if(inputs == 0 && outputs == 0)
+		return 0;
+
+	return (inputs > 0 ? full / inputs : 1) * (outputs > 0 ? empty / outputs : 1);
+}
+
+// Frames written by the filter, or read for filters that do not write any
+static unsigned long long filterFrames(MkvsynthFilterStats *stats) {
+	unsigned long long frames = atomic_load(&stats->framesOut);
+	return frames > 0 ? frames : atomic_load(&stats->framesIn);
+}
+
+static unsigned long long filterWait(MkvsynthFilterStats *stats) {
+	return atomic_load(&stats->inputWait) + atomic_load(&stats->outputWait);
+}
+
+// The share of the last 'window' nanoseconds that the filter spent waiting
+static double waitShare(MkvsynthFilterStats *stats, unsigned long long window) {
+	double waited = (double)(filterWait(stats) - stats->advisedWait) / window;
+	return waited < 1 ? waited : 1;
+}
+
+/******************************************************************************
+ * A filter next to the critical one is busy for part of the time and waits   *
+ * for the rest. If it were never made to wait it could go about              *
+ * fps / busy, which is as far as speeding up the critical filter can get     *
+ * the script before the neighbour becomes the limit. Returns 0 for a filter  *
+ * without neighbours.                                                        *
+ *****************************************************************************/
+static double neighbourLimit(MkvsynthFilterStats *stats, unsigned long long window) {
+	double limit = 0;
+
+	MkvsynthBufferWatch *watch;
+	for(watch = watchList; watch != NULL; watch = watch->next) {
+		MkvsynthFilterStats *neighbour = NULL;
+		if(watch->input->reader == stats)
+			neighbour = watch->input->output->writer;
+		else if(watch->input->output->writer == stats)
+			neighbour = watch->input->reader;
+
+		if(neighbour == NULL || neighbour == stats)
+			continue;
+
+		double fps = (filterFrames(neighbour) - neighbour->advisedFrames) * 1e9 / window;
+		double busy = 1 - waitShare(neighbour, window);
+		if(busy < 0.05)
+			busy = 0.05;
+
+		if(limit == 0 || fps / busy < limit)
+			limit = fps / busy;
+	}
+
+	return limit;
+}
+
+/******************************************************************************
+ * adviseBuffers reports on the samples taken over the last 'window'          *
+ * nanoseconds and starts over. The critical filter needs a pressure of at    *
+ * least one half (see filterPressure()). When no filter has that, the ring   *
+ * that keeps swinging between full and empty the most is reported instead,   *
+ * since a deeper ring there lets both of its filters work through bursts.    *
+ *****************************************************************************/
+static void adviseBuffers(unsigned long long window) {
+	MkvsynthFilterStats *critical = NULL;
+	double pressure = 0.5;
+
+	MkvsynthBufferWatch *watch;
+	for(watch = watchList; watch != NULL; watch = watch->next) {
+		MkvsynthFilterStats *sides[2] = { watch->input->output->writer, watch->input->reader };
+		int i;
+		for(i = 0; i < 2; i++) {
+			if(atomic_load(&sides[i]->running) == 0)
+				continue;
+
+			double candidate = filterPressure(sides[i]);
+			if(candidate >= pressure) {
+				critical = sides[i];
+				pressure = candidate;
+			}
+		}
+	}
+
+	if(critical != NULL) {
+		double fps = (filterFrames(critical) - critical->advisedFrames) * 1e9 / window;
+		double waiting = waitShare(critical, window);
+		MkvsynthMessage("advisor: %s (line %i) is limiting the script to %.1f fps, the filters around it are waiting on it %.0f%% of the time",
+		                critical->name, critical->line, fps, pressure * 100);
+
+		if(waiting < 0.2) {
+			long cores = threadBudget();
+			double limit = neighbourLimit(critical, window);
+			int threads = cores;
+			if(limit > 0 && fps > 0 && limit / fps < cores) {
+				threads = limit / fps;
+				if(threads < limit / fps)
+					threads++;
+			}
+
+			if(threads <= 1 && cores > 1)
+				MkvsynthMessage("advisor: %s is busy all of the time, but so are the filters around it, more threads for it alone would not help", critical->name);
+			else if(threads <= 1)
+				MkvsynthMessage("advisor: %s is busy all of the time, and there is only one core, so a faster setting for it is the only way to speed the script up", critical->name);
+			else
+				MkvsynthMessage("advisor: %s is busy all of the time, running its rows on %i threads with processRows() would let the script go about %ix as fast",
+				                critical->name, threads, threads);
+		} else {
+			MkvsynthMessage("advisor: %s spends %.0f%% of its time waiting on something other than its buffers (disk, an encoder, or a busy CPU)",
+			                critical->name, waiting * 100);
+		}
+	} else {
+		MkvsynthBufferWatch *swinging = NULL;
+		double swing = 0.25;
+
+		for(watch = watchList; watch != NULL; watch = watch->next) {
+			double full = share(watch->fullSamples, watch->samples);
+			double empty = share(watch->emptySamples, watch->samples);
+			double candidate = full < empty ? full : empty;
+			if(candidate >= swing) {
+				swinging = watch;
+				swing = candidate;
+			}
+		}
+
+		if(swinging != NULL) {
+			MkvsynthOutput *output = swinging->input->output;
+			MkvsynthMessage("advisor: the buffer between %s (line %i) and %s (line %i) keeps swinging between full and empty (%.1f of %i frames on average), buffer:%i on %s would smooth that out",
+			                output->writer->name, output->writer->line, swinging->input->reader->name, swinging->input->reader->line,
+			                (double)swinging->framesWaiting / swinging->samples, output->bufferDepth, output->bufferDepth * 2, output->writer->name);
+		}
+	}
+
+	for(watch = watchList; watch != NULL; watch = watch->next) {
+		MkvsynthFilterStats *sides[2] = { watch->input->output->writer, watch->input->reader };
+		int i;
+		for(i = 0; i < 2; i++) {
+			sides[i]->advisedFrames = filterFrames(sides[i]);
+			sides[i]->advisedWait = filterWait(sides[i]);
+		}
+
+		watch->samples = 0;
+		watch->fullSamples = 0;
+		watch->emptySamples = 0;
+		watch->framesWaiting = 0;
+	}
+}
+
+static void *advisorLoop(void *unused) {
+	unsigned long long interval = advisorInterval * 1e9;
+	unsigned long long lastReport = statsClock();
+
+	pthread_mutex_lock(&advisorLock);
+	while(advisorRunning) {
+		struct timespec until;
+		clock_gettime(CLOCK_MONOTONIC, &until);
+		until.tv_nsec += MKVSYNTH_ADVISOR_SAMPLE * 1000000;
+		if(until.tv_nsec >= 1000000000) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000;
+		}
+
+		pthread_cond_timedwait(&advisorWake, &advisorLock, &until);
+		if(!advisorRunning)
+			break;
+
+		sampleBuffers();
+
+		unsigned long long now = statsClock();
+		if(now - lastReport >= interval) {
+			adviseBuffers(now - lastReport);
+			lastReport = now;
+		}
+	}
+	pthread_mutex_unlock(&advisorLock);
+
+	return NULL;
+}
+
+/******************************************************************************
+ * startAdvisor starts the advisor thread once the filters are running, with  *
+ * a report every 'interval' seconds. An interval of 0 switches it off.       *
+ * stopAdvisor stops it again once every filter has finished, and forgets     *
+ * about the rings.                                                           *
+ *****************************************************************************/
+void startAdvisor(double interval) {
+	if(interval <= 0 || watchList == NULL)
+		return;
+
+	pthread_condattr_t attributes;
+	pthread_condattr_init(&attributes);
+	pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&advisorWake, &attributes);
+	pthread_condattr_destroy(&attributes);
+
+	advisorInterval = interval;
+	advisorRunning = 1;
+	pthread_create(&advisorThread, NULL, advisorLoop, NULL);
+}
+
+void stopAdvisor() {
+	if(advisorRunning) {
+		pthread_mutex_lock(&advisorLock);
+		advisorRunning = 0;
+		pthread_cond_signal(&advisorWake);
+		pthread_mutex_unlock(&advisorLock);
+
+		pthread_join(advisorThread, NULL);
+		pthread_cond_destroy(&advisorWake);
+	}
+
+	while(watchList != NULL) {
+		MkvsynthBufferWatch *watch = watchList;
+		watchList = watch->next;
+		free(watch);
+	}
+}
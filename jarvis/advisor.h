@@ -0,0 +1,5 @@
+#include "jarvis.h"
+
+void watchBuffers(MkvsynthOutput *outputs);
+void startAdvisor(double interval);
+void stopAdvisor();
@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+#include <sched.h>
+#include <stdio.h>
+
+/******************************************************************************
+ * On a machine with several sockets, every socket (NUMA node) has memory of  *
+ * its own, and reading memory that belongs to another node is a lot slower   *
+ * than reading local memory. Left alone, the kernel moves threads between    *
+ * the sockets as it pleases, so a frame gets written on one node and read on *
+ * the other.                                                                 *
+ *                                                                            *
+ * With pinning switched on (setAffinity), every worker is pinned to a core   *
+ * of its own, and every filter is given a node: the node of the filter it    *
+ * reads from, or the next node in turn for a filter that reads from nothing. *
+ * A chain of filters therefore runs on a single node. Tasks are queued on    *
+ * workers of their node, and pthread filters are pinned to the cores of      *
+ * their node. A payload is first written by the filter producing it, so the  *
+ * kernel puts its pages on that filter's node, and since a payload only ever  *
+ * goes back to the pool of its own output it stays on that node for good.    *
+ *****************************************************************************/
+static pthread_once_t topologyOnce = PTHREAD_ONCE_INIT;
+static int pinned = 0;
+
+// The cores the process may run on, sorted by node, and the node of each one
+static int *cpus = NULL;
+static int *cpuNodes = NULL;
+static int cpuCount = 0;
+static int nodeCount = 1;
+
+static _Thread_local int currentNode = -1;
+
+static void addCpu(int cpu, int node) {
+	cpus = realloc(cpus, (cpuCount + 1) * sizeof(int));
+	cpuNodes = realloc(cpuNodes, (cpuCount + 1) * sizeof(int));
+	cpus[cpuCount] = cpu;
+	cpuNodes[cpuCount] = node;
+	cpuCount++;
+}
+
+/******************************************************************************
+ * The cores of each node are listed in /sys/devices/system/node/nodeN/cpulist *
+ * as ranges ("0-7,16-23"). Cores that the process is not allowed to run on   *
+ * (taskset, cgroups) are left out, and so are nodes with no cores left. A    *
+ * machine without the node directory is treated as a single node.            *
+ *****************************************************************************/
+static void readTopology() {
+	cpu_set_t allowed;
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		CPU_ZERO(&allowed);
+		CPU_SET(0, &allowed);
+	}
+
+	int node, nodes = 0;
+	for(node = 0; ; node++) {
+		char path[64];
+		sprintf(path, "/sys/devices/system/node/node%i/cpulist", node);
+		FILE *cpulist = fopen(path, "r");
+		if(cpulist == NULL)
+			break;
+
+		int found = 0, first, last;
+		while(fscanf(cpulist, "%i", &first) == 1) {
+			last = first;
+			if(fscanf(cpulist, "-%i", &last) != 1)
+				last = first;
+
+			int cpu;
+			for(cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+				if(CPU_ISSET(cpu, &allowed)) {
+					addCpu(cpu, nodes);
+					found = 1;
+				}
+			}
+
+			if(fgetc(cpulist) != ',')
+				break;
+		}
+
+		fclose(cpulist);
+		nodes += found;
+	}
+
+	if(cpuCount == 0) {
+		int cpu;
+		for(cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if(CPU_ISSET(cpu, &allowed))
+				addCpu(cpu, 0);
+		}
+		nodes = 1;
+	}
+
+	nodeCount = nodes;
+}
+
+/******************************************************************************
+ * Also see mkvsynthSpawn() and setAffinity_AST                               *
+ *                                                                            *
+ * placeFilters gives every filter in 'queue' a node, or -1 for every filter  *
+ * if 'pinning' is off. It has to be called before the buffers are allocated, *
+ * because that is when the filters forget which buffers they read from, and  *
+ * before the tasks are started. Filters are queued after the filters they    *
+ * read from, so by the time a filter is placed, its input already has a      *
+ * node. A filter that reads from several filters follows the first of them.  *
+ *****************************************************************************/
+void placeFilters(MkvsynthFilterQueue *queue, int pinning) {
+	pinned = pinning;
+	if(pinned)
+		pthread_once(&topologyOnce, readTopology);
+
+	int nextNode = 0;
+	MkvsynthFilterQueue *current;
+	for(current = queue; current != NULL; current = current->next) {
+		current->node = -1;
+		if(!pinned || (current->task == NULL && current->filter == NULL))
+			continue;
+
+		MkvsynthFilterStats *upstream = upstreamFilter(current->stats);
+		MkvsynthFilterQueue *source;
+		for(source = queue; source != current && upstream != NULL; source = source->next) {
+			if(source->stats == upstream && source->node >= 0) {
+				current->node = source->node;
+				break;
+			}
+		}
+
+		if(current->node < 0)
+			current->node = nextNode++ % nodeCount;
+
+		if(current->task != NULL)
+			current->task->node = current->node;
+	}
+
+	if(pinned && nodeCount > 1)
+		MkvsynthMessage("Placing filters on %i NUMA nodes", nodeCount);
+}
+
+// Returns the node of the core that worker number 'worker' gets, -1 if workers are not pinned
+int workerNode(int worker) {
+	if(!pinned)
+		return -1;
+
+	return cpuNodes[worker % cpuCount];
+}
+
+// Pins the calling thread to the core of worker number 'worker'
+void pinWorker(int worker) {
+	if(!pinned)
+		return;
+
+	cpu_set_t cores;
+	CPU_ZERO(&cores);
+	CPU_SET(cpus[worker % cpuCount], &cores);
+	if(pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores) == 0)
+		currentNode = cpuNodes[worker % cpuCount];
+}
+
+// Pins the calling thread to every core of 'node', which is -1 for anywhere
+void pinToNode(int node) {
+	if(!pinned || node < 0)
+		return;
+
+	cpu_set_t cores;
+	CPU_ZERO(&cores);
+
+	int i;
+	for(i = 0; i < cpuCount; i++) {
+		if(cpuNodes[i] == node)
+			CPU_SET(cpus[i], &cores);
+	}
+
+	if(pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores) == 0)
+		currentNode = node;
+}
+
+// Returns the node the calling thread is pinned to, -1 if it is not pinned
+int threadNode() {
+	return currentNode;
+}
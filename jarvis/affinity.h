@@ -0,0 +1,7 @@
+#include "jarvis.h"
+
+void placeFilters(MkvsynthFilterQueue *queue, int pinning);
+int workerNode(int worker);
+void pinWorker(int worker);
+void pinToNode(int node);
+int threadNode();
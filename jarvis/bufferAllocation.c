@@ -1,23 +1,32 @@
 #include "bufferAllocation.h"
+#include <string.h>
+
+// Every output that does not have a ring yet, see allocateBuffers()
+static MkvsynthOutput *outputList = NULL;
 
 /******************************************************************************
- * Also see MkvsynthOutput and MkvsynthSemaphoreList and createInputBuffer    *
- * and MkvsynthMetaData                                                       *
+ * Also see MkvsynthOutput and createInputBuffer and MkvsynthMetaData         *
+ *                                                                            *
+ * createOutputBuffer allocates an MkvsynthOutput. The ring of frames that    *
+ * the output uses to pass frames to its inputs is allocated later by         *
+ * allocateBuffers(), because the size of the ring depends on every other     *
+ * buffer in the script. Every output is added to a list so that              *
+ * allocateBuffers() can find it.                                             *
  *                                                                            *
- * createOutputBuffer allocates an MkvsynthOutput and creates the first node  *
- * in the list of semphores that help the outputs coordinate with the inputs. *
+ * If the filter was called with a 'buffer' argument, that is the number of   *
+ * frames the ring will hold. Otherwise bufferDepth is left at 0 and          *
+ * allocateBuffers() picks the depth.                                         *
  *                                                                            *
  * createInputBuffer is in charge of maintaining consistency, thus            *
  * createOutputBuffer only needs to allocate memory.                          *
  *                                                                            *
- * recentFrame and semaphores are lists that are explicitly assigned to a     *
- * single output in all cases. createOutputBuffer creates the first node for  *
- * both of these lists.                                                       *
+ * The payloadPool starts out empty. The size of the payloads is not known    *
+ * until the filter has filled out the metaData, so the pool figures it out   *
+ * when the first payload is requested.                                       *
  *                                                                            *
- * outputBreadth and filtersRemaining are both initialized to 0 because they  *
- * depend on the number of filters using this output as input. But since the  *
- * output has just been created, there are clearly no filters using it for    *
- * input, thus these variables should be initialized to 0.                    *
+ * outputBreadth is initialized to 0 because it depends on the number of      *
+ * filters using this output as input. But since the output has just been     *
+ * created, there are clearly no filters using it for input.                  *
  *                                                                            *
  * *** I am not sure if the memory allocated here is ever free()'d        *** *
  *****************************************************************************/
@@ -25,17 +34,45 @@
 MkvsynthOutput *createOutputBuffer() {
 	MkvsynthOutput *output = malloc(sizeof(MkvsynthOutput));
 
-	output->semaphores = malloc(sizeof(MkvsynthSemaphoreList));
-	output->recentFrame = malloc(sizeof(MkvsynthFrame));
 	output->metaData = malloc(sizeof(MkvsynthMetaData));
 
+	output->payloadPool = malloc(sizeof(MkvsynthPayloadPool));
+	output->payloadPool->bytes = 0;
+	output->payloadPool->warmBuffers = 0;
+	output->payloadPool->metaData = output->metaData;
+	pthread_mutex_init(&output->payloadPool->lock, NULL);
+
+	output->metaData->frames = 0;
+	output->metaData->stride = 0;
+
+	output->bufferDepth = 0;
+	output->frames = NULL;
+
+	double *bufferDepth = currentArgs ? getOptArg(currentArgs, "buffer", typeNum) : NULL;
+	if(bufferDepth != NULL) {
+		if(*bufferDepth < 1)
+			MkvsynthError("buffer must be at least 1 frame");
+		output->bufferDepth = *bufferDepth;
+	}
+
+	atomic_init(&output->nextFrame, 0);
+	atomic_init(&output->framesWritten, 0);
+	atomic_init(&output->consumersWaiting, 0);
+	atomic_init(&output->producerWaiting, 0);
+
 	output->outputBreadth = 0;
-	output->recentFrame->filtersRemaining = 0;
+	output->inputs = NULL;
+	output->producer = NULL;
+	output->cache = NULL;
+	output->writer = NULL;
+
+	output->nextOutput = outputList;
+	outputList = output;
 	return output;
 }
 
 /******************************************************************************
- * Also see MkvsynthSempahporeList and MkvsynthOutput and MkvsynthMetaData    *
+ * Also see MkvsynthOutput and MkvsynthMetaData                               *
  *                                                                            *
  * An input buffer needs to coordinate with an output buffer to ensure that   *
  * frames are not deleted from the output buffer until all input buffers have *
@@ -43,37 +80,352 @@ MkvsynthOutput *createOutputBuffer() {
  *                                                                            *
  * Multiple inputs can use the same MkvsynthOutput (though not vice-versa).   *
  *                                                                            *
- * Each MkvsynthInput has a semaphore to track how large its personal buffer  *
- * is, to prevent the previous filter from outputting frames when there is no *
- * room in memory for them. When the input buffer is being created, a new     *
- * semaphore needs to be added to the list for the particular input being     *
- * created.                                                                   *
+ * Each MkvsynthInput keeps its own place in the ring (framesRead). Inputs    *
+ * are all created before any filter starts running, so every input starts at *
+ * the first frame.                                                           *
  *                                                                            *
- * Similarly, the output needs to know how many filters are using it as input *
- * so output->outputBreadth must be increased by 1.                           *
+ * The output needs to know how many filters are using it as input so that it *
+ * knows how many filters have to finish with a frame before the slot can be  *
+ * reused, so output->outputBreadth must be increased by 1.                   *
  *****************************************************************************/
 MkvsynthInput *createInputBuffer(MkvsynthOutput *output) {
 	MkvsynthInput *input = malloc(sizeof(MkvsynthInput));
-	
-	int i;
-	MkvsynthSemaphoreList *tmp = output->semaphores;
-
-	// this may be replaced by a single variable that just remembers where the
-	// end of the list is (found in MkvsynthOutput)
-	for(i = 0; i < output->outputBreadth; i++)
-		tmp = tmp->next;
-		
+
 	output->outputBreadth++;
-	tmp->next = malloc(sizeof(MkvsynthSemaphoreList));
-	
-	input->remainingBuffer = &tmp->remainingBuffer;
-	input->consumedBuffer = &tmp->consumedBuffer;
-	
-	sem_init(input->remainingBuffer, 10, 0);
-	sem_init(input->consumedBuffer, 0, 10);
-	
-	input->currentFrame = output->recentFrame;
+
+	atomic_init(&input->framesRead, 0);
+	input->output = output;
+	input->task = NULL;
+	input->nextInput = output->inputs;
+	output->inputs = input;
+	input->cacheDepth = 0;
+	input->cache = NULL;
+	input->reader = NULL;
 	input->metaData = output->metaData;
+	input->payloadPool = output->payloadPool;
 	
 	return input;
 }
+
+/******************************************************************************
+ * Also see mkvsynthQueue() and advisor.c                                     *
+ *                                                                            *
+ * A filter creates its buffers before it queues itself, so when a filter is  *
+ * queued, every buffer without a filter yet belongs to it. claimBuffers      *
+ * hands them the filter's stats, so that the advisor can tell which filter   *
+ * is on either side of a ring.                                               *
+ *****************************************************************************/
+void claimBuffers(MkvsynthFilterStats *stats) {
+	MkvsynthOutput *output;
+	MkvsynthInput *input;
+
+	for(output = outputList; output != NULL; output = output->nextOutput) {
+		if(output->writer == NULL)
+			output->writer = stats;
+
+		for(input = output->inputs; input != NULL; input = input->nextInput) {
+			if(input->reader == NULL)
+				input->reader = stats;
+		}
+	}
+}
+
+// Returns the filter writing to a buffer that 'reader' reads, NULL for a source
+MkvsynthFilterStats *upstreamFilter(MkvsynthFilterStats *reader) {
+	MkvsynthOutput *output;
+	MkvsynthInput *input;
+
+	for(output = outputList; output != NULL; output = output->nextOutput) {
+		for(input = output->inputs; input != NULL; input = input->nextInput) {
+			if(input->reader == reader)
+				return output->writer;
+		}
+	}
+
+	return NULL;
+}
+
+// Returns 1 if the filter writes to at least one output, and nothing reads any of them
+static int isUnused(MkvsynthFilterStats *stats) {
+	int writes = 0;
+	MkvsynthOutput *output;
+	for(output = outputList; output != NULL; output = output->nextOutput) {
+		if(output->writer != stats)
+			continue;
+		if(output->outputBreadth != 0)
+			return 0;
+		writes = 1;
+	}
+
+	return writes;
+}
+
+// Takes every input of the filter away from the output it reads
+static void releaseInputs(MkvsynthFilterStats *stats) {
+	MkvsynthOutput *output;
+	for(output = outputList; output != NULL; output = output->nextOutput) {
+		MkvsynthInput **link = &output->inputs;
+		while(*link != NULL) {
+			MkvsynthInput *input = *link;
+			if(input->reader == stats) {
+				*link = input->nextInput;
+				output->outputBreadth--;
+				free(input);
+			} else {
+				link = &input->nextInput;
+			}
+		}
+	}
+}
+
+// Drops the outputs of the filter from the list, so they never get a ring
+static void releaseOutputs(MkvsynthFilterStats *stats) {
+	MkvsynthOutput **link = &outputList;
+	while(*link != NULL) {
+		if((*link)->writer == stats)
+			*link = (*link)->nextOutput;
+		else
+			link = &(*link)->nextOutput;
+	}
+}
+
+/******************************************************************************
+ * Also see mkvsynthSpawn() and claimBuffers()                                *
+ *                                                                            *
+ * A clip that is created but never used would still be decoded and filtered *
+ * in full, only for the frames to be thrown away. pruneFilters is called     *
+ * before any filter starts, and takes every filter whose outputs are all     *
+ * unread out of 'queue'. Sinks have no outputs, so they always stay. Dropping *
+ * a filter drops its inputs too, which can leave the filters before it with   *
+ * nothing reading from them, so the whole unused branch goes.                *
+ *                                                                            *
+ * The entries stay in the queue with neither a task nor a filter, like the   *
+ * filters that were fused into another one. Only the params themselves are   *
+ * freed, anything the filter opened while it was being created stays open.   *
+ *****************************************************************************/
+void pruneFilters(MkvsynthFilterQueue *queue) {
+	int pruned;
+	do {
+		pruned = 0;
+
+		MkvsynthFilterQueue *current;
+		for(current = queue; current != NULL; current = current->next) {
+			if(current->task == NULL && current->filter == NULL)
+				continue;
+			if(!isUnused(current->stats))
+				continue;
+
+			MkvsynthMessage("%s (line %i) is never used, skipping it", current->stats->name, current->stats->line);
+
+			releaseInputs(current->stats);
+			releaseOutputs(current->stats);
+
+			free(current->task);
+			free(current->filterParams);
+			removeFilterStats(current->stats);
+
+			current->task = NULL;
+			current->filter = NULL;
+			current->filterParams = NULL;
+			current->stats = NULL;
+			pruned = 1;
+		}
+	} while(pruned);
+}
+
+/******************************************************************************
+ * Also see createOutputBuffer and setBufferMemory_AST                        *
+ *                                                                            *
+ * allocateBuffers is called once every filter has been created, right        *
+ * before the filters start running. It allocates the ring of every output    *
+ * created since the last call.                                               *
+ *                                                                            *
+ * Without a memory budget, every ring gets MKVSYNTH_BUFFER_DEPTH frames. A   *
+ * fixed number of frames is a bad fit for very large frames (8K video uses   *
+ * 100MB per frame) as well as for tiny ones, so with a budget the memory is  *
+ * split between the buffers instead. Buffers with a depth set by the script  *
+ * are paid for first. Whatever is left is shared out by fan-out: an output   *
+ * that feeds 2 filters gets twice the memory of one that feeds 1, because    *
+ * its consumers can drift apart. The depth is then however many frames fit   *
+ * into that memory, between MKVSYNTH_MIN_BUFFER_DEPTH and                    *
+ * MKVSYNTH_MAX_BUFFER_DEPTH.                                                 *
+ *                                                                            *
+ * This is also where the stride of every output is fixed, see                *
+ * MkvsynthMetaData.                                                          *
+ *                                                                            *
+ * Outputs that nothing reads from never put anything into their ring, so     *
+ * they do not count against the budget. Outputs whose frames are rendered    *
+ * on demand (see connectCaches()) do not get a ring at all. Once the rings   *
+ * are allocated they are handed to the advisor, see watchBuffers().          *
+ *****************************************************************************/
+void allocateBuffers(unsigned long long bufferMemory) {
+	MkvsynthOutput *output;
+	unsigned long long sharedMemory = bufferMemory;
+	int sharedBreadth = 0;
+
+	connectCaches(outputList);
+
+	for(output = outputList; output != NULL; output = output->nextOutput) {
+		int stride = getLinesize(output->metaData);
+		if(output->metaData->stride == 0 && stride > 0)
+			output->metaData->stride = stride;
+
+		if(output->outputBreadth == 0 || output->cache != NULL)
+			continue;
+
+		if(output->bufferDepth > 0) {
+			unsigned long long fixedMemory = (unsigned long long)output->bufferDepth * getBytes(output->metaData);
+			sharedMemory = fixedMemory < sharedMemory ? sharedMemory - fixedMemory : 0;
+		} else {
+			sharedBreadth += output->outputBreadth;
+		}
+	}
+
+	int overBudget = 0;
+	for(output = outputList; output != NULL; output = output->nextOutput) {
+		if(output->cache != NULL)
+			continue;
+
+		if(output->outputBreadth == 0) {
+			output->bufferDepth = MKVSYNTH_MIN_BUFFER_DEPTH;
+		} else if(output->bufferDepth == 0 && bufferMemory == 0) {
+			output->bufferDepth = MKVSYNTH_BUFFER_DEPTH;
+		} else if(output->bufferDepth == 0) {
+			unsigned long long share = sharedMemory / sharedBreadth * output->outputBreadth;
+			unsigned long long depth = share / getBytes(output->metaData);
+
+			if(depth < MKVSYNTH_MIN_BUFFER_DEPTH) {
+				depth = MKVSYNTH_MIN_BUFFER_DEPTH;
+				overBudget = 1;
+			} else if(depth > MKVSYNTH_MAX_BUFFER_DEPTH) {
+				depth = MKVSYNTH_MAX_BUFFER_DEPTH;
+			}
+
+			output->bufferDepth = depth;
+		}
+
+		output->frames = malloc(output->bufferDepth * sizeof(MkvsynthFrame));
+
+		int i;
+		for(i = 0; i < output->bufferDepth; i++) {
+			output->frames[i].payload = NULL;
+			output->frames[i].output = output;
+			atomic_init(&output->frames[i].filtersRemaining, 0);
+		}
+	}
+
+	if(overBudget)
+		MkvsynthWarning("buffer memory is too small, some buffers will use more than their share");
+
+	watchBuffers(outputList);
+	outputList = NULL;
+}
+
+/******************************************************************************
+ * Also see MkvsynthPayloadPool and MkvsynthPayloadHeader                     *
+ *                                                                            *
+ * allocatePayload returns a payload that is large enough to hold a frame     *
+ * described by the pool's metaData. If the pool has a warm buffer it gets    *
+ * reused, otherwise a new one is allocated on a MKVSYNTH_ALIGNMENT boundary. *
+ * Either way the payload remembers the pool it came from so that             *
+ * clearPayload() can return it, and starts out with a single reference that  *
+ * belongs to the caller.                                                     *
+ *                                                                            *
+ * getPayload is what filters call to get a payload for their output. All     *
+ * payloads given to putFrame() should come from getPayload().                *
+ *****************************************************************************/
+uint8_t *allocatePayload(MkvsynthPayloadPool *pool) {
+	MkvsynthPayloadHeader *header = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if(pool->bytes == 0)
+		pool->bytes = getBytes(pool->metaData);
+
+	if(pool->warmBuffers > 0) {
+		pool->warmBuffers--;
+		header = (MkvsynthPayloadHeader *)pool->buffers[pool->warmBuffers];
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if(header == NULL) {
+		if(posix_memalign((void **)&header, MKVSYNTH_ALIGNMENT, sizeof(MkvsynthPayloadHeader) + pool->bytes) != 0)
+			MkvsynthError("out of memory for a %i byte payload", pool->bytes);
+		header->pool = pool;
+	}
+
+	atomic_init(&header->references, 1);
+	return (uint8_t *)(header + 1);
+}
+
+uint8_t *getPayload(MkvsynthOutput *output) {
+	return allocatePayload(output->payloadPool);
+}
+
+/******************************************************************************
+ * Also see MkvsynthPayloadHeader                                             *
+ *                                                                            *
+ * sharePayload adds 'count' references to a payload, so that it can be       *
+ * handed to more filters without being copied. The caller must already hold  *
+ * a reference, otherwise the payload could go back to its pool at any time.  *
+ *****************************************************************************/
+uint8_t *sharePayload(uint8_t *payload, int count) {
+	if(payload != NULL && count > 0) {
+		MkvsynthPayloadHeader *header = (MkvsynthPayloadHeader *)payload - 1;
+		atomic_fetch_add_explicit(&header->references, count, memory_order_relaxed);
+	}
+
+	return payload;
+}
+
+/******************************************************************************
+ * getWritablePayload is copy-on-write: the caller hands over its reference   *
+ * to 'payload' and gets back a payload that nobody else can see. If the      *
+ * caller holds the only reference, that is the payload itself and nothing    *
+ * is copied. Otherwise the data is copied into a new payload from the same   *
+ * pool and the reference to the shared payload is dropped.                   *
+ *                                                                            *
+ * References only go down while the caller holds one (nobody else can share  *
+ * a payload they are not holding), so once the caller holds the only         *
+ * reference it cannot become shared again.                                   *
+ *****************************************************************************/
+uint8_t *getWritablePayload(uint8_t *payload) {
+	if(payload == NULL)
+		return NULL;
+
+	MkvsynthPayloadHeader *header = (MkvsynthPayloadHeader *)payload - 1;
+	if(atomic_load_explicit(&header->references, memory_order_acquire) == 1)
+		return payload;
+
+	uint8_t *copy = allocatePayload(header->pool);
+	memcpy(copy, payload, header->pool->bytes);
+	clearPayload(payload);
+	return copy;
+}
+
+/******************************************************************************
+ * clearPayload drops a reference to a payload. When the last reference is    *
+ * gone, the payload goes back to the pool it came from. The pool only        *
+ * keeps MKVSYNTH_POOL_DEPTH payloads, which is enough to cover the payloads  *
+ * that are in flight between two filters at any point. Extra payloads are    *
+ * free'd so that a burst of frames does not permanently inflate memory use.  *
+ *****************************************************************************/
+void clearPayload(uint8_t *payload) {
+	if(payload == NULL)
+		return;
+
+	MkvsynthPayloadHeader *header = (MkvsynthPayloadHeader *)payload - 1;
+	MkvsynthPayloadPool *pool = header->pool;
+
+	if(atomic_fetch_sub_explicit(&header->references, 1, memory_order_acq_rel) != 1)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	if(pool->warmBuffers < MKVSYNTH_POOL_DEPTH) {
+		pool->buffers[pool->warmBuffers] = (uint8_t *)header;
+		pool->warmBuffers++;
+		header = NULL;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	free(header);
+}
@@ -2,3 +2,12 @@
 
 MkvsynthOutput *createOutputBuffer();
 MkvsynthInput *createInputBuffer(MkvsynthOutput *output);
+uint8_t *allocatePayload(MkvsynthPayloadPool *pool);
+uint8_t *getPayload(MkvsynthOutput *output);
+uint8_t *sharePayload(uint8_t *payload, int count);
+uint8_t *getWritablePayload(uint8_t *payload);
+void clearPayload(uint8_t *payload);
+void claimBuffers(MkvsynthFilterStats *stats);
+void pruneFilters(MkvsynthFilterQueue *queue);
+MkvsynthFilterStats *upstreamFilter(MkvsynthFilterStats *reader);
+void allocateBuffers(unsigned long long bufferMemory);
@@ -0,0 +1,209 @@
+#include "filterStats.h"
+#include <stdio.h>
+#include <time.h>
+
+/******************************************************************************
+ * Also see MkvsynthFilterStats                                               *
+ *                                                                            *
+ * Every thread knows which filter it is working for at the moment            *
+ * (currentStats). Whenever a thread switches to another filter (a worker     *
+ * picking up a different task, a filter rendering a frame for another        *
+ * filter, a worker helping out with somebody else's rows) the CPU time       *
+ * since the last switch is charged to the filter it was working for, so      *
+ * nested work is never counted twice.                                        *
+ *****************************************************************************/
+static MkvsynthFilterStats *statsList = NULL;
+static unsigned long long pipelineStart = 0;
+static _Thread_local MkvsynthFilterStats *currentStats = NULL;
+static _Thread_local unsigned long long cpuMark = 0;
+
+unsigned long long statsClock() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static unsigned long long threadClock() {
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return (unsigned long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+MkvsynthFilterStats *createFilterStats(char const *name, int line) {
+	MkvsynthFilterStats *stats = malloc(sizeof(MkvsynthFilterStats));
+	stats->name = name;
+	stats->line = line;
+
+	atomic_init(&stats->cpuTime, 0);
+	atomic_init(&stats->inputWait, 0);
+	atomic_init(&stats->outputWait, 0);
+	atomic_init(&stats->framesIn, 0);
+	atomic_init(&stats->framesOut, 0);
+	atomic_init(&stats->lastActive, 0);
+	atomic_init(&stats->running, 0);
+	stats->threads = 0;
+	stats->advisedFrames = 0;
+	stats->advisedWait = 0;
+
+	stats->next = statsList;
+	statsList = stats;
+	return stats;
+}
+
+// Forgets about a filter that was merged into another one, see fuseFilters()
+void removeFilterStats(MkvsynthFilterStats *stats) {
+	MkvsynthFilterStats **link;
+	for(link = &statsList; *link != NULL; link = &(*link)->next) {
+		if(*link == stats) {
+			*link = stats->next;
+			free(stats);
+			return;
+		}
+	}
+}
+
+MkvsynthFilterStats *currentFilterStats() {
+	return currentStats;
+}
+
+static void chargeCurrent() {
+	unsigned long long now = threadClock();
+
+	if(currentStats != NULL) {
+		atomic_fetch_add_explicit(&currentStats->cpuTime, now - cpuMark, memory_order_relaxed);
+
+		unsigned long long active = statsClock();
+		unsigned long long lastActive = atomic_load_explicit(&currentStats->lastActive, memory_order_relaxed);
+		while(lastActive < active && !atomic_compare_exchange_weak(&currentStats->lastActive, &lastActive, active));
+	}
+
+	cpuMark = now;
+}
+
+/******************************************************************************
+ * enterFilter makes the calling thread work for 'stats' and returns the      *
+ * filter it was working for before, which goes back to leaveFilter() once    *
+ * the work is done. Either can be NULL.                                      *
+ *****************************************************************************/
+MkvsynthFilterStats *enterFilter(MkvsynthFilterStats *stats) {
+	chargeCurrent();
+
+	MkvsynthFilterStats *previous = currentStats;
+	currentStats = stats;
+	return previous;
+}
+
+void leaveFilter(MkvsynthFilterStats *previous) {
+	chargeCurrent();
+	currentStats = previous;
+}
+
+/******************************************************************************
+ * recordWait adds the time since 'started' (from statsClock()) to the input  *
+ * wait of 'stats', or to its output wait if 'output' is set.                 *
+ *****************************************************************************/
+void recordWait(MkvsynthFilterStats *stats, int output, unsigned long long started) {
+	if(stats == NULL)
+		return;
+
+	unsigned long long waited = statsClock() - started;
+	if(output)
+		atomic_fetch_add_explicit(&stats->outputWait, waited, memory_order_relaxed);
+	else
+		atomic_fetch_add_explicit(&stats->inputWait, waited, memory_order_relaxed);
+}
+
+void countFrame(int output) {
+	if(currentStats == NULL)
+		return;
+
+	if(output)
+		atomic_fetch_add_explicit(&currentStats->framesOut, 1, memory_order_relaxed);
+	else
+		atomic_fetch_add_explicit(&currentStats->framesIn, 1, memory_order_relaxed);
+}
+
+void startFilterStats() {
+	pipelineStart = statsClock();
+}
+
+static double seconds(unsigned long long nanoseconds) {
+	return nanoseconds / 1e9;
+}
+
+static unsigned long long doneTime(MkvsynthFilterStats *stats) {
+	unsigned long long lastActive = atomic_load(&stats->lastActive);
+	return lastActive > pipelineStart ? lastActive - pipelineStart : 0;
+}
+
+// Busiest filters first
+static int compareStats(const void *a, const void *b) {
+	unsigned long long cpuA = atomic_load(&(*(MkvsynthFilterStats **)a)->cpuTime);
+	unsigned long long cpuB = atomic_load(&(*(MkvsynthFilterStats **)b)->cpuTime);
+	return cpuA < cpuB ? 1 : cpuA > cpuB ? -1 : 0;
+}
+
+/******************************************************************************
+ * printFilterStats prints a table of every filter queued since the last      *
+ * report, busiest filter first, and forgets about them. A filter that is     *
+ * busy most of the time ("busy" is CPU time over the time it took the        *
+ * filter to finish) while the filters before it wait on their output and     *
+ * the filters after it wait on their input is the bottleneck. 'busy' can be  *
+ * above 100% for filters that split their rows between threads.              *
+ *                                                                            *
+ * If 'jsonFile' is not NULL, the same numbers are written to it as JSON.     *
+ *****************************************************************************/
+void printFilterStats(char const *jsonFile) {
+	unsigned long long wallTime = statsClock() - pipelineStart;
+
+	int count = 0;
+	MkvsynthFilterStats *stats;
+	for(stats = statsList; stats != NULL; stats = stats->next)
+		count++;
+
+	MkvsynthFilterStats **sorted = malloc(count * sizeof(MkvsynthFilterStats *));
+	count = 0;
+	for(stats = statsList; stats != NULL; stats = stats->next)
+		sorted[count++] = stats;
+	qsort(sorted, count, sizeof(MkvsynthFilterStats *), compareStats);
+
+	MkvsynthMessage("%-24s %5s %10s %10s %9s %6s %12s %12s %9s", "filter", "line", "frames in", "frames out", "cpu (s)", "busy", "in wait (s)", "out wait (s)", "done (s)");
+
+	int i;
+	for(i = 0; i < count; i++) {
+		stats = sorted[i];
+		unsigned long long done = doneTime(stats);
+		double busy = done > 0 ? 100.0 * atomic_load(&stats->cpuTime) / done : 0;
+
+		MkvsynthMessage("%-24s %5i %10llu %10llu %9.3f %5.0f%% %12.3f %12.3f %9.3f", stats->name, stats->line,
+		                atomic_load(&stats->framesIn), atomic_load(&stats->framesOut),
+		                seconds(atomic_load(&stats->cpuTime)), busy,
+		                seconds(atomic_load(&stats->inputWait)), seconds(atomic_load(&stats->outputWait)),
+		                seconds(done));
+	}
+
+	FILE *json = jsonFile != NULL ? fopen(jsonFile, "w") : NULL;
+	if(jsonFile != NULL && json == NULL)
+		MkvsynthWarning("could not open %s, the statistics were not written", jsonFile);
+
+	if(json != NULL) {
+		fprintf(json, "{\n\t\"wallSeconds\": %.6f,\n\t\"filters\": [", seconds(wallTime));
+		for(i = 0; i < count; i++) {
+			stats = sorted[i];
+			fprintf(json, "%s\n\t\t{\"filter\": \"%s\", \"line\": %i, \"framesIn\": %llu, \"framesOut\": %llu, "
+			        "\"cpuSeconds\": %.6f, \"inputWaitSeconds\": %.6f, \"outputWaitSeconds\": %.6f, \"doneSeconds\": %.6f}",
+			        i == 0 ? "" : ",", stats->name, stats->line,
+			        atomic_load(&stats->framesIn), atomic_load(&stats->framesOut),
+			        seconds(atomic_load(&stats->cpuTime)),
+			        seconds(atomic_load(&stats->inputWait)), seconds(atomic_load(&stats->outputWait)),
+			        seconds(doneTime(stats)));
+		}
+		fprintf(json, "\n\t]\n}\n");
+		fclose(json);
+	}
+
+	for(i = 0; i < count; i++)
+		free(sorted[i]);
+	free(sorted);
+	statsList = NULL;
+}
@@ -0,0 +1,12 @@
+#include "jarvis.h"
+
+unsigned long long statsClock();
+MkvsynthFilterStats *createFilterStats(char const *name, int line);
+void removeFilterStats(MkvsynthFilterStats *stats);
+MkvsynthFilterStats *currentFilterStats();
+MkvsynthFilterStats *enterFilter(MkvsynthFilterStats *stats);
+void leaveFilter(MkvsynthFilterStats *previous);
+void recordWait(MkvsynthFilterStats *stats, int output, unsigned long long started);
+void countFrame(int output);
+void startFilterStats();
+void printFilterStats(char const *jsonFile);
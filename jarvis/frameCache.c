@@ -0,0 +1,253 @@
+#include "frameCache.h"
+#include <limits.h>
+#include <stdio.h>
+
+/******************************************************************************
+ * Also see requestFrame() and MkvsynthFrameCache                             *
+ *                                                                            *
+ * pullFrames is called by a filter while it is being created (from its _AST  *
+ * function) to say that it will get the frames of 'input' with               *
+ * requestFrame() instead of getFrame(). 'frames' is the number of frames the *
+ * filter wants to be able to ask for again without them having to be         *
+ * produced twice, for example 5 for a filter that looks at frames n-2        *
+ * through n+2.                                                               *
+ *****************************************************************************/
+void pullFrames(MkvsynthInput *input, int frames) {
+	if(frames < 1)
+		MkvsynthError("pullFrames: the cache needs to hold at least 1 frame");
+
+	input->cacheDepth = frames;
+}
+
+static MkvsynthFrameCache *createCache(int depth, MkvsynthTask *task, MkvsynthInput *input) {
+	MkvsynthFrameCache *cache = malloc(sizeof(MkvsynthFrameCache));
+	cache->depth = depth;
+	cache->frameNumbers = calloc(depth, sizeof(unsigned long long));
+	cache->payloads = calloc(depth, sizeof(uint8_t *));
+	cache->lastUsed = calloc(depth, sizeof(unsigned long long));
+	cache->uses = 0;
+
+	cache->task = task;
+	cache->input = input;
+	cache->framesFetched = 0;
+	cache->endFrame = ULLONG_MAX;
+	cache->pullers = 0;
+
+	pthread_mutex_init(&cache->lock, NULL);
+	return cache;
+}
+
+/******************************************************************************
+ * Also see allocateBuffers() and mkvsynthQueueRender()                       *
+ *                                                                            *
+ * connectCaches is called once every filter has been created, before the     *
+ * rings are allocated. An output whose inputs all pull their frames, and     *
+ * whose producer can render any frame on demand, gets a rendered cache       *
+ * instead of a ring. Its producer never runs as a task, and only the frames  *
+ * that somebody asks for are ever rendered. The producer in turn pulls its   *
+ * own input while rendering, so the same can happen one filter further up.   *
+ * Every pulled input whose output still has a ring gets a ring-fed cache.    *
+ *****************************************************************************/
+void connectCaches(MkvsynthOutput *outputs) {
+	MkvsynthOutput *output;
+	MkvsynthInput *input;
+
+	int changed = 1;
+	while(changed) {
+		changed = 0;
+		for(output = outputs; output != NULL; output = output->nextOutput) {
+			MkvsynthTask *producer = output->producer;
+			if(output->cache != NULL || output->inputs == NULL || producer == NULL || producer->render == NULL)
+				continue;
+
+			int depth = 0;
+			for(input = output->inputs; input != NULL; input = input->nextInput) {
+				if(input->cacheDepth == 0)
+					break;
+				if(input->cacheDepth > depth)
+					depth = input->cacheDepth;
+			}
+
+			if(input != NULL)
+				continue;
+
+			output->cache = createCache(depth, producer, NULL);
+			if(producer->input != NULL && producer->input->cacheDepth == 0)
+				producer->input->cacheDepth = 1;
+			changed = 1;
+		}
+	}
+
+	for(output = outputs; output != NULL; output = output->nextOutput) {
+		for(input = output->inputs; input != NULL; input = input->nextInput) {
+			if(input->cacheDepth == 0)
+				continue;
+
+			if(output->cache != NULL)
+				input->cache = output->cache;
+			else
+				input->cache = createCache(input->cacheDepth, NULL, input);
+		}
+	}
+}
+
+/******************************************************************************
+ * renderFrame looks for a frame in a rendered cache, and renders it if it is *
+ * not there. The new frame replaces the frame that was used least recently.  *
+ * Has to be called with the cache locked. The time spent rendering counts    *
+ * towards the filter doing the rendering, not the one asking for the frame.  *
+ *****************************************************************************/
+static uint8_t *renderFrame(MkvsynthFrameCache *cache, unsigned long long frame) {
+	if(frame >= cache->endFrame)
+		return NULL;
+
+	int i, slot = -1;
+	for(i = 0; i < cache->depth && slot == -1; i++) {
+		if(cache->payloads[i] != NULL && cache->frameNumbers[i] == frame)
+			slot = i;
+	}
+
+	if(slot == -1) {
+		unsigned long long started = traceStart();
+		MkvsynthFilterStats *previous = enterFilter(cache->task->stats);
+		uint8_t *payload = cache->task->render(cache->task->filterParams, frame);
+		if(payload != NULL)
+			countFrame(1);
+		leaveFilter(previous);
+		traceEvent(cache->task->stats->name, "render", started);
+
+		if(payload == NULL) {
+			cache->endFrame = frame;
+			return NULL;
+		}
+
+		slot = 0;
+		for(i = 0; i < cache->depth && cache->payloads[slot] != NULL; i++) {
+			if(cache->payloads[i] == NULL || cache->lastUsed[i] < cache->lastUsed[slot])
+				slot = i;
+		}
+
+		clearPayload(cache->payloads[slot]);
+		cache->payloads[slot] = payload;
+		cache->frameNumbers[slot] = frame;
+	}
+
+	cache->uses++;
+	cache->lastUsed[slot] = cache->uses;
+	return cache->payloads[slot];
+}
+
+/******************************************************************************
+ * fetchFrame takes frames out of the ring until 'frame' has been taken out   *
+ * (or the clip has ended), keeping the last 'depth' of them. Has to be       *
+ * called with the cache locked.                                              *
+ *****************************************************************************/
+static uint8_t *fetchFrame(MkvsynthFrameCache *cache, unsigned long long frame) {
+	while(cache->framesFetched <= frame && cache->framesFetched < cache->endFrame) {
+		MkvsynthFrame *ringFrame = getReadOnlyFrame(cache->input);
+		if(ringFrame->payload == NULL) {
+			cache->endFrame = cache->framesFetched;
+			break;
+		}
+
+		int slot = cache->framesFetched % cache->depth;
+		clearPayload(cache->payloads[slot]);
+		cache->payloads[slot] = sharePayload(ringFrame->payload, 1);
+		cache->frameNumbers[slot] = cache->framesFetched;
+		clearReadOnlyFrame(ringFrame);
+		cache->framesFetched++;
+	}
+
+	if(frame >= cache->endFrame)
+		return NULL;
+
+	int slot = frame % cache->depth;
+	if(cache->payloads[slot] == NULL || cache->frameNumbers[slot] != frame)
+		MkvsynthError("requestFrame: frame %llu has already left the cache, pullFrames() needs a bigger cache", frame);
+
+	return cache->payloads[slot];
+}
+
+/******************************************************************************
+ * Also see pullFrames() and MkvsynthFrameCache                               *
+ *                                                                            *
+ * requestFrame returns frame number 'frame' (counting from 0) of the clip    *
+ * that 'input' reads from, or NULL if the clip has fewer frames than that.   *
+ * The frames can be requested in any order. The caller gets a reference to   *
+ * the payload, which it hands back with clearPayload() once it is done. The  *
+ * payload is shared with the cache, so a filter that wants to modify it has  *
+ * to call getWritablePayload() first.                                        *
+ *                                                                            *
+ * If the frame has to be rendered or has to wait for the ring, that happens  *
+ * on the calling thread, which is why filters that pull their frames get a   *
+ * thread of their own instead of running on the workers.                     *
+ *****************************************************************************/
+uint8_t *requestFrame(MkvsynthInput *input, unsigned long long frame) {
+	MkvsynthFrameCache *cache = input->cache;
+	if(cache == NULL)
+		MkvsynthError("requestFrame: the filter never called pullFrames() on this input");
+
+	unsigned long long started = traceStart();
+	pthread_mutex_lock(&cache->lock);
+	uint8_t *payload;
+	if(cache->task != NULL) {
+		payload = renderFrame(cache, frame);
+		if(payload != NULL)
+			countFrame(0);
+	} else {
+		payload = fetchFrame(cache, frame);
+	}
+	sharePayload(payload, 1);
+	pthread_mutex_unlock(&cache->lock);
+	traceEvent("requestFrame", "frame", started);
+
+	return payload;
+}
+
+/******************************************************************************
+ * A pulling filter that is done would leave the ring-fed caches it was       *
+ * reading from (directly, or through filters that render on demand) stuck    *
+ * somewhere in the middle of the ring, and the filter writing to the ring    *
+ * would wait forever for a free slot. holdPulls is called for every pulling  *
+ * filter before it starts, and finishPulls once it is done. Whichever filter *
+ * is the last to let go of a ring-fed cache takes the rest of the frames out *
+ * of the ring.                                                               *
+ *****************************************************************************/
+static void countPulls(MkvsynthInput *input, int count) {
+	MkvsynthFrameCache *cache = input->cache;
+
+	if(cache->task != NULL) {
+		if(cache->task->input != NULL)
+			countPulls(cache->task->input, count);
+		return;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	cache->pullers += count;
+	if(cache->pullers == 0) {
+		while(cache->framesFetched < cache->endFrame) {
+			MkvsynthFrame *ringFrame = getReadOnlyFrame(cache->input);
+			if(ringFrame->payload == NULL)
+				break;
+
+			clearReadOnlyFrame(ringFrame);
+			cache->framesFetched++;
+		}
+		cache->endFrame = cache->framesFetched;
+
+		int i;
+		for(i = 0; i < cache->depth; i++) {
+			clearPayload(cache->payloads[i]);
+			cache->payloads[i] = NULL;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void holdPulls(MkvsynthInput *input) {
+	countPulls(input, 1);
+}
+
+void finishPulls(MkvsynthInput *input) {
+	countPulls(input, -1);
+}
@@ -0,0 +1,7 @@
+#include "jarvis.h"
+
+void pullFrames(MkvsynthInput *input, int frames);
+void connectCaches(MkvsynthOutput *outputs);
+uint8_t *requestFrame(MkvsynthInput *input, unsigned long long frame);
+void holdPulls(MkvsynthInput *input);
+void finishPulls(MkvsynthInput *input);
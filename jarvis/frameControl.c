@@ -2,160 +2,264 @@
 #define frameControl_c_
 
 #include "frameControl.h"
-#include <string.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
 #include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 /******************************************************************************
- * This function returns a frame from the buffer. First sem_wait() is called  *
- * to ensure that there is a frame in the buffer. Then a mutex lock is called *
- * to prevent other threads from making changes to the frame variables at the *
- * same time as we are using it.                                              *
+ * The ring buffers only ever sleep in the kernel when there is nothing else  *
+ * to do: a consumer sleeps when the ring is empty and the producer sleeps    *
+ * when the next slot is still in use. 'waiters' counts the threads that are  *
+ * asleep on a word, so that waking threads up costs nothing when nobody is   *
+ * sleeping.                                                                  *
  *                                                                            *
- * getFrame() returns a unique frame to the next filter, meaning the next     *
- * filter can be sure that no other frames will be looking at the data or     *
- * modifying it. If multiple other filters need to look at the frame still    *
- * (IE filtersRemaining > 1), then getFrame will memcpy the data and create   *
- * a completely fresh frame for the calling filter to use. If the calling     *
- * filter is the last filter (IE filtersRemaining < 2), it will just return   *
- * a pointer to the frame without copying it.                                 *
+ * futexWait() returns once 'word' is no longer equal to 'value'. The kernel  *
+ * checks the value again before going to sleep, so a wakeup that happens     *
+ * between the check and the sleep is never lost.                             *
  *                                                                            *
- * All frames returned from getFrame() will have a filtersRemaining value of  *
- * 0.                                                                         *
+ * Before going to sleep, the thread gives up the rest of its time slice      *
+ * once. When the filters share a core, that lets the other side fill or      *
+ * drain several slots in one go, instead of the producer and its consumers   *
+ * waking each other up for every single frame. When nothing else is waiting  *
+ * for the core, sched_yield() returns straight away.                         *
+ *****************************************************************************/
+static void futexWait(void *word, int value, atomic_int *waiters) {
+	sched_yield();
+	if(atomic_load((atomic_int *)word) != value)
+		return;
+
+	atomic_fetch_add(waiters, 1);
+	while(atomic_load((atomic_int *)word) == value)
+		syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+	atomic_fetch_sub(waiters, 1);
+}
+
+static void futexWake(void *word, atomic_int *waiters) {
+	if(atomic_load(waiters) > 0)
+		syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/******************************************************************************
+ * releaseSlot() is called when a filter is done with a frame in a ring. If   *
+ * the calling filter was the last filter using the frame, the slot becomes   *
+ * free and the producer is woken up (or poked, if it is a task) in case it   *
+ * is waiting for that slot.                                                  *
+ * The payload is not touched, it has its own reference count.                *
+ *****************************************************************************/
+static void releaseSlot(MkvsynthFrame *usedFrame) {
+	MkvsynthOutput *output = usedFrame->output;
+
+	if(atomic_fetch_sub(&usedFrame->filtersRemaining, 1) == 1) {
+		futexWake(&usedFrame->filtersRemaining, &output->producerWaiting);
+		if(output->producer != NULL)
+			pokeTask(output->producer);
+	}
+}
+
+/******************************************************************************
+ * This function returns a frame from the buffer. If the input has already    *
+ * read every frame that has been written to the ring, the filter sleeps      *
+ * until the producer writes another frame.                                   *
+ *                                                                            *
+ * The frame stays in the ring until the filter calls clearReadOnlyFrame(),   *
+ * which means that a filter that holds on to frames also holds on to space   *
+ * in the buffer.                                                             *
  *                                                                            *
- * Once the copying is done, the mutex is unlocked and then sem_post() is     *
- * called to inform the output filter that another space has opened up in the *
- * buffer.                                                                    *
+ * getReadOnlyFrame() assumes that the filter will not be modifying the frame *
+ * data. For that reason, the filter does not need a unique copy of the       *
+ * frame. filtersRemaining also is not decremented, because the filter may    *
+ * still be looking at the data.                                              *
+ *                                                                            *
+ * The final frame of a stream (the frame with a NULL payload) is never       *
+ * consumed, so calling getReadOnlyFrame() again after the end of the stream  *
+ * returns the final frame again.                                             *
  *****************************************************************************/
-MkvsynthFrame *getFrame(MkvsynthInput *params) {
-	sem_wait(params->remainingBuffer);
-	pthread_mutex_lock(&params->currentFrame->lock);
-	
-	MkvsynthFrame *newFrame;
-
-	if(params->currentFrame->filtersRemaining > 1) {
-		newFrame = malloc(sizeof(MkvsynthFrame));
-		newFrame->payload = malloc(getBytes(params->metaData));
-
-		// The first frame is NULL, so we have to make sure we are not
-		// 	looking at the first frame here.
-		if(params->currentFrame->payload != NULL)
-			memcpy(newFrame->payload, params->currentFrame->payload, getBytes(params->metaData));
-		else
-			newFrame->payload = NULL;
-
-		newFrame->filtersRemaining = 0;
-		pthread_mutex_init(&newFrame->lock, NULL);
-		newFrame->nextFrame = params->currentFrame->nextFrame;
-		params->currentFrame->filtersRemaining--;
-	} else {
-		params->currentFrame->filtersRemaining = 0;
-		newFrame = params->currentFrame;
+static MkvsynthFrame *takeFrame(MkvsynthInput *params) {
+	MkvsynthOutput *output = params->output;
+	unsigned long long framesRead = atomic_load_explicit(&params->framesRead, memory_order_relaxed);
+
+	unsigned int framesWritten = atomic_load_explicit(&output->framesWritten, memory_order_acquire);
+	if(framesWritten == (unsigned int)framesRead) {
+		unsigned long long started = statsClock();
+		while(framesWritten == (unsigned int)framesRead) {
+			futexWait(&output->framesWritten, (int)framesWritten, &output->consumersWaiting);
+			framesWritten = atomic_load_explicit(&output->framesWritten, memory_order_acquire);
+		}
+		recordWait(currentFilterStats(), 0, started);
+	}
+
+	MkvsynthFrame *newFrame = &output->frames[framesRead % output->bufferDepth];
+	if(newFrame->payload != NULL) {
+		atomic_store_explicit(&params->framesRead, framesRead + 1, memory_order_release);
+		countFrame(0);
 	}
 
-	pthread_mutex_unlock(&params->currentFrame->lock);
-	sem_post(params->consumedBuffer);
-	
-	params->currentFrame = params->currentFrame->nextFrame;
+	return newFrame;
+}
+
+MkvsynthFrame *getReadOnlyFrame(MkvsynthInput *params) {
+	unsigned long long started = traceStart();
+	MkvsynthFrame *newFrame = takeFrame(params);
+
+	traceEvent("getReadOnlyFrame", "frame", started);
 	return newFrame;
 }
 
 /******************************************************************************
- * getReadOnlyFrame() is like getFrame() except that it assumes that the      *
- * filter will not be modifying the frame data. For that reason, the filter   *
- * does not need a unique copy of the frame. filtersRemaining also is not     *
- * decremented however, because the filter may still be looking at the data.  *
+ * getFrame() returns a unique frame to the next filter, meaning the next     *
+ * filter can be sure that no other frames will be looking at the data or     *
+ * modifying it. If the calling filter holds the only reference to the        *
+ * payload, it will just return the frame in the ring without copying it.     *
+ *                                                                            *
+ * Otherwise the filter lets go of the slot (but not of its reference to the  *
+ * payload) and asks for a writable payload. The other filters may have       *
+ * finished with the payload in the meantime, in which case no copy is made   *
+ * after all. Frames that have left the ring are not part of a ring (their    *
+ * output is NULL), and clearFrame() will free them.                          *
+ *                                                                            *
+ * Filters that only pass payloads along without modifying them should use    *
+ * getReadOnlyFrame() and sharePayload() instead, which never copies.         *
  *****************************************************************************/
-MkvsynthFrame *getReadOnlyFrame(MkvsynthInput *params) {
-	sem_wait(params->remainingBuffer);
+MkvsynthFrame *getFrame(MkvsynthInput *params) {
+	unsigned long long started = traceStart();
+	MkvsynthFrame *currentFrame = getReadOnlyFrame(params);
+
+	if(currentFrame->payload == NULL) {
+		traceEvent("getFrame", "frame", started);
+		return currentFrame;
+	}
 
-	MkvsynthFrame *newFrame = params->currentFrame;
-	params->currentFrame = params->currentFrame->nextFrame;
+	MkvsynthPayloadHeader *header = (MkvsynthPayloadHeader *)currentFrame->payload - 1;
+	if(atomic_load_explicit(&header->references, memory_order_acquire) == 1) {
+		traceEvent("getFrame", "frame", started);
+		return currentFrame;
+	}
+
+	MkvsynthFrame *newFrame = malloc(sizeof(MkvsynthFrame));
+	newFrame->payload = currentFrame->payload;
+	atomic_init(&newFrame->filtersRemaining, 0);
+	newFrame->output = NULL;
 
-	sem_post(params->consumedBuffer);
+	releaseSlot(currentFrame);
+	newFrame->payload = getWritablePayload(newFrame->payload);
+	traceEvent("getFrame", "frame", started);
 	return newFrame;
 }
 
 /******************************************************************************
- * putFrame places a frame into the buffer. Because the buffer is shared by   *
- * many filters, a list of semaphores needs to be used. There is only space   *
- * in the buffer if each of the next filters reports that there is space in   *
- * the buffer.                                                                *
- *                                                                            *
- * recentFrame is a frame that has been allocated but not filled with data.   *
- * putFrame will fill out recentFrame with the payload from the output filter *
- * and initialize the mutex on the frame. filtersRemaining will be equal to   *
- * the outputBreadth of the output filter.                                    *
+ * putFrame places a frame into the ring (publishFrame does the actual work). *
+ * The next slot in the ring may still be in use by filters that are lagging  *
+ * behind, in which case putFrame waits until the last of those filters has   *
+ * cleared the frame.                                                         *
  *                                                                            *
- * Memory is allocated so the recentFrame can be restored to its previous     *
- * status of pointing to a shell of a frame.                                  *
+ * The slot is filled with the payload from the output filter and its         *
+ * filtersRemaining is set to the outputBreadth of the output filter. Only    *
+ * then is framesWritten incremented, which is what makes the frame visible   *
+ * to the input filters. Any input filters that are asleep waiting for a      *
+ * frame are woken up, and input filters that are tasks are poked.            *
  *                                                                            *
- * Finally sem_post() is called for all the input filters to let them know    *
- * that a new frame has been added to the buffer.                             *
+ * The output filter hands its reference to the payload over to the ring.     *
+ * Every input filter needs a reference of its own, so the payload gets       *
+ * outputBreadth - 1 more. If nobody is using the output, the reference is    *
+ * dropped straight away.                                                     *
  *****************************************************************************/
-void putFrame(MkvsynthOutput *params, uint8_t *payload) {	
-	int i;
-	MkvsynthSemaphoreList *tmp = params->semaphores;
-	for(i = 0; i < params->outputBreadth; i++) {
-		sem_wait(&tmp->consumedBuffer);
-		tmp = tmp->next;
+static void publishFrame(MkvsynthOutput *params, uint8_t *payload) {
+	if(payload != NULL)
+		countFrame(1);
+
+	if(params->outputBreadth == 0) {
+		clearPayload(payload);
+		return;
 	}
 
-	params->recentFrame->payload = payload;
-	params->recentFrame->filtersRemaining = params->outputBreadth;
-	pthread_mutex_init(&params->recentFrame->lock, NULL);
+	sharePayload(payload, params->outputBreadth - 1);
 
-	MkvsynthFrame *newFrame = malloc(sizeof(MkvsynthFrame));
-	newFrame->nextFrame = NULL;
-	params->recentFrame->nextFrame = newFrame;
-	params->recentFrame = newFrame;
-
-	tmp = params->semaphores;
-	for(i = 0; i < params->outputBreadth; i++) {
-		sem_post(&tmp->remainingBuffer);
-		tmp = tmp->next;
+	unsigned long long nextFrame = atomic_load_explicit(&params->nextFrame, memory_order_relaxed);
+	MkvsynthFrame *slot = &params->frames[nextFrame % params->bufferDepth];
+
+	int filtersRemaining = atomic_load(&slot->filtersRemaining);
+	if(filtersRemaining != 0) {
+		unsigned long long started = statsClock();
+		while(filtersRemaining != 0) {
+			futexWait(&slot->filtersRemaining, filtersRemaining, &params->producerWaiting);
+			filtersRemaining = atomic_load(&slot->filtersRemaining);
+		}
+		recordWait(currentFilterStats(), 1, started);
+	}
+
+	slot->payload = payload;
+	atomic_store_explicit(&slot->filtersRemaining, params->outputBreadth, memory_order_relaxed);
+
+	atomic_store_explicit(&params->nextFrame, nextFrame + 1, memory_order_relaxed);
+	atomic_fetch_add(&params->framesWritten, 1);
+	futexWake(&params->framesWritten, &params->consumersWaiting);
+
+	MkvsynthInput *input;
+	for(input = params->inputs; input != NULL; input = input->nextInput) {
+		if(input->task != NULL)
+			pokeTask(input->task);
 	}
 }
 
+void putFrame(MkvsynthOutput *params, uint8_t *payload) {
+	unsigned long long started = traceStart();
+
+	publishFrame(params, payload);
+
+	traceEvent("putFrame", "frame", started);
+}
+
 /******************************************************************************
  * clearFrame() will delete a frame but not the payload. The assumption here  *
- * is that the payload modified and then used in the next frame. If           *
- * filtersRemaining() is not 0 there was probably an error, because it either *
- * means that the filter calling clearFrame() used getReadOnlyFrame() to grab *
- * the frame, which is an error.                                              *
+ * is that the payload modified and then used in the next frame, so the       *
+ * filter's reference to the payload goes along with it. A frame that lives   *
+ * in a ring is not deleted, its slot is just marked as free again.           *
+ *                                                                            *
+ * If filtersRemaining is not 1 for a frame in a ring, there was probably an  *
+ * error, because it means that the filter calling clearFrame() used          *
+ * getReadOnlyFrame() to grab the frame.                                      *
  *****************************************************************************/
 void clearFrame(MkvsynthFrame *usedFrame) {
+	unsigned long long started = traceStart();
 
+	if(usedFrame->output == NULL) {
+		free(usedFrame);
+	} else if(usedFrame->payload != NULL) {
 #ifdef DEBUG
-	if(usedFrame->filtersRemaining != 0)
-		MkvsynthError("clearFrame: filtersRemaining should equal 0!");
+		if(atomic_load(&usedFrame->filtersRemaining) != 1)
+			MkvsynthError("clearFrame: filtersRemaining should equal 1!");
 #endif
+		releaseSlot(usedFrame);
+	}
 
-	pthread_mutex_destroy(&usedFrame->lock);
-	free(usedFrame);
+	traceEvent("clearFrame", "frame", started);
 }
 
 /******************************************************************************
- * clearReadOnlyFrame() checks that all filters (except the calling filter)   *
- * have finished looking at the frame. If not, filtersReamining is reduced.   *
- * This check must happen using a mutex to prevent race conditions between    *
- * filters calling clearReadOnlyFrame().                                      *
+ * clearReadOnlyFrame() lets the ring know that the calling filter is done    *
+ * looking at the frame, and drops the filter's reference to the payload.     *
+ * Both counts are decremented atomically, so filters calling                 *
+ * clearReadOnlyFrame() at the same time cannot race.                         *
  *                                                                            *
- * If it is the last filter, then the payload is destroyed as well as the     *
- * frame. clearReadOnlyFrame() is different because it needs to check         *
- * filtersRemaining and then it free's the payload.                           *
+ * The payload pointer is saved before the slot is released, because the      *
+ * producer is free to reuse the slot as soon as it has been released.        *
  *****************************************************************************/
 void clearReadOnlyFrame(MkvsynthFrame *usedFrame) {
-	pthread_mutex_lock(&usedFrame->lock);
-	if(usedFrame->filtersRemaining <= 1) {
-		// kill the frame
-		pthread_mutex_unlock(&usedFrame->lock);
-		free(usedFrame->payload);
-		pthread_mutex_destroy(&usedFrame->lock);
+	unsigned long long started = traceStart();
+	uint8_t *payload = usedFrame->payload;
+
+	if(usedFrame->output == NULL) {
+		clearPayload(payload);
 		free(usedFrame);
-	} else {
-		pthread_mutex_unlock(&usedFrame->lock);
-		usedFrame->filtersRemaining--;
+	} else if(payload != NULL) {
+		releaseSlot(usedFrame);
+		clearPayload(payload);
 	}
+
+	traceEvent("clearReadOnlyFrame", "frame", started);
 }
 
 #endif
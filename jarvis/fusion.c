@@ -0,0 +1,217 @@
+#include "fusion.h"
+#include <stdio.h>
+#include <string.h>
+
+/******************************************************************************
+ * Also see MkvsynthFusion and mkvsynthQueueRows()                            *
+ *                                                                            *
+ * A filter that only ever looks at one row of its input to produce the same  *
+ * row of its output does not need a whole frame from the filter before it.   *
+ * When two of those filters follow each other, and nothing else reads the    *
+ * frames in between, fuseFilters turns them into a single task: each block   *
+ * of rows goes through the first filter and straight on into the second      *
+ * while it is still in the cache. The ring between them disappears, and so   *
+ * does one trip through memory for every frame.                              *
+ *****************************************************************************/
+
+// Writes rows firstRow through lastRow - 1 of the last output, see fuseRows()
+struct FusedFrame {
+	MkvsynthFusion *fusion;
+	uint8_t **payloads;
+};
+
+static void fusedRows(void *filterParams, uint8_t *input, uint8_t *output, int firstRow, int lastRow) {
+	struct FusedFrame *frame = (struct FusedFrame *)filterParams;
+	MkvsynthFusion *fusion = frame->fusion;
+
+	int widest = getBytes(fusion->input->metaData) / fusion->input->metaData->height;
+	int i;
+	for(i = 0; i < fusion->count; i++) {
+		int bytes = getBytes(fusion->outputs[i]->metaData) / fusion->outputs[i]->metaData->height;
+		if(bytes > widest)
+			widest = bytes;
+	}
+
+	// Bands start on even rows, like the chunks of processRows()
+	int band = MKVSYNTH_FUSION_BYTES / widest & ~1;
+	if(band < 2)
+		band = 2;
+
+	int row;
+	for(row = firstRow; row < lastRow; row += band) {
+		int bandEnd = row + band < lastRow ? row + band : lastRow;
+		for(i = 0; i < fusion->count; i++) {
+			uint8_t *source = i == 0 ? input : frame->payloads[i - 1];
+			uint8_t *dest = i == fusion->count - 1 ? output : frame->payloads[i];
+			fusion->kernels[i](fusion->filterParams[i], source, dest, row, bandEnd);
+		}
+	}
+}
+
+// Runs every filter of the chain over 'input', returns the last output
+static uint8_t *fuseRows(MkvsynthFusion *fusion, uint8_t *input) {
+	uint8_t **payloads = malloc(fusion->count * sizeof(uint8_t *));
+	struct FusedFrame frame = { fusion, payloads };
+
+	int i;
+	for(i = 0; i < fusion->count; i++)
+		payloads[i] = getPayload(fusion->outputs[i]);
+
+	MkvsynthOutput *last = fusion->outputs[fusion->count - 1];
+	processRows(fusedRows, &frame, input, payloads[fusion->count - 1], last->metaData);
+
+	for(i = 0; i < fusion->count - 1; i++)
+		clearPayload(payloads[i]);
+
+	uint8_t *payload = payloads[fusion->count - 1];
+	free(payloads);
+	return payload;
+}
+
+static int fusedStep(void *filterParams) {
+	MkvsynthFusion *fusion = (MkvsynthFusion *)filterParams;
+	MkvsynthOutput *last = fusion->outputs[fusion->count - 1];
+
+	MkvsynthFrame *workingFrame = getReadOnlyFrame(fusion->input);
+
+	if(workingFrame->payload == NULL) {
+		putFrame(last, NULL);
+		clearReadOnlyFrame(workingFrame);
+
+		int i;
+		for(i = 0; i < fusion->count; i++)
+			free(fusion->filterParams[i]);
+		free(fusion->kernels);
+		free(fusion->filterParams);
+		free(fusion->outputs);
+		free(fusion);
+		return 0;
+	}
+
+	putFrame(last, fuseRows(fusion, workingFrame->payload));
+	clearReadOnlyFrame(workingFrame);
+	return 1;
+}
+
+static uint8_t *fusedRender(void *filterParams, unsigned long long frame) {
+	MkvsynthFusion *fusion = (MkvsynthFusion *)filterParams;
+
+	uint8_t *input = requestFrame(fusion->input, frame);
+	if(input == NULL)
+		return NULL;
+
+	uint8_t *payload = fuseRows(fusion, input);
+	clearPayload(input);
+	return payload;
+}
+
+/******************************************************************************
+ * The rows of a subsampled plane are shared by two rows of the frame, so the *
+ * filters in a chain can only hand rows to each other if every frame in the  *
+ * chain shares rows the same way.                                            *
+ *****************************************************************************/
+static int sameRows(MkvsynthMetaData *first, MkvsynthMetaData *second) {
+	int firstWidthShift, firstHeightShift, secondWidthShift, secondHeightShift;
+	getChromaShift(first, &firstWidthShift, &firstHeightShift);
+	getChromaShift(second, &secondWidthShift, &secondHeightShift);
+
+	return first->height == second->height && firstHeightShift == secondHeightShift;
+}
+
+// Returns the task that is the only reader of 'output', if it can be fused
+static MkvsynthTask *fusableReader(MkvsynthOutput *output) {
+	MkvsynthInput *input = output->inputs;
+	if(output->outputBreadth != 1 || input == NULL)
+		return NULL;
+
+	MkvsynthTask *reader = input->task;
+	if(reader == NULL || reader->rows == NULL || reader->step == fusedStep || reader->input != input || reader->output == NULL || input->cacheDepth != 0)
+		return NULL;
+
+	if(!sameRows(output->metaData, reader->output->metaData))
+		return NULL;
+
+	return reader;
+}
+
+static MkvsynthFusion *startFusion(MkvsynthTask *task) {
+	MkvsynthFusion *fusion = malloc(sizeof(MkvsynthFusion));
+	fusion->count = 1;
+	fusion->kernels = malloc(sizeof(MkvsynthRowKernel));
+	fusion->filterParams = malloc(sizeof(void *));
+	fusion->outputs = malloc(sizeof(MkvsynthOutput *));
+	fusion->kernels[0] = task->rows;
+	fusion->filterParams[0] = task->filterParams;
+	fusion->outputs[0] = task->output;
+	fusion->renders = task->render != NULL;
+	fusion->input = task->input;
+
+	task->step = fusedStep;
+	task->filterParams = fusion;
+	task->rows = fusedRows;
+	return fusion;
+}
+
+/******************************************************************************
+ * Also see mkvsynthSpawn()                                                   *
+ *                                                                            *
+ * fuseFilters is called once every filter has been queued, before the        *
+ * caches are connected and the rings are allocated. Every task that writes   *
+ * rows for a single reader that also writes rows takes the reader over: the  *
+ * reader's kernel is added to the chain, the task writes to the reader's     *
+ * output from then on, and the reader is dropped from 'queue'. The fused     *
+ * task shows up as one filter in the statistics, named after every filter    *
+ * in it.                                                                     *
+ *****************************************************************************/
+void fuseFilters(MkvsynthFilterQueue *queue) {
+	MkvsynthFilterQueue *current;
+	for(current = queue; current != NULL; current = current->next) {
+		MkvsynthTask *task = current->task;
+		if(task == NULL || task->rows == NULL || task->input == NULL || task->output == NULL)
+			continue;
+		if(!sameRows(task->input->metaData, task->output->metaData))
+			continue;
+
+		MkvsynthTask *reader;
+		while((reader = fusableReader(task->output)) != NULL) {
+			MkvsynthFusion *fusion = task->step == fusedStep ? task->filterParams : startFusion(task);
+
+			fusion->count++;
+			fusion->kernels = realloc(fusion->kernels, fusion->count * sizeof(MkvsynthRowKernel));
+			fusion->filterParams = realloc(fusion->filterParams, fusion->count * sizeof(void *));
+			fusion->outputs = realloc(fusion->outputs, fusion->count * sizeof(MkvsynthOutput *));
+			fusion->kernels[fusion->count - 1] = reader->rows;
+			fusion->filterParams[fusion->count - 1] = reader->filterParams;
+			fusion->outputs[fusion->count - 1] = reader->output;
+			fusion->renders = fusion->renders && reader->render != NULL;
+
+			// Nothing reads the frames in between anymore
+			MkvsynthOutput *between = task->output;
+			between->inputs = NULL;
+			between->outputBreadth = 0;
+			between->producer = NULL;
+
+			task->output = reader->output;
+			task->output->producer = task;
+			task->output->writer = task->stats;
+			task->render = fusion->renders ? fusedRender : NULL;
+
+			char *name = malloc(strlen(task->stats->name) + strlen(reader->stats->name) + 2);
+			sprintf(name, "%s+%s", task->stats->name, reader->stats->name);
+			task->stats->name = name;
+
+			MkvsynthFilterQueue *queued;
+			for(queued = current->next; queued != NULL; queued = queued->next) {
+				if(queued->task == reader) {
+					queued->task = NULL;
+					queued->filter = NULL;
+					queued->filterParams = NULL;
+					queued->stats = task->stats;
+				}
+			}
+
+			removeFilterStats(reader->stats);
+			free(reader);
+		}
+	}
+}
@@ -0,0 +1,3 @@
+#include "jarvis.h"
+
+void fuseFilters(MkvsynthFilterQueue *queue);
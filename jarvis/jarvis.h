@@ -2,17 +2,81 @@
 #define JARVIS_H_
 
 #include <pthread.h>
-#include <semaphore.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 
-typedef enum {NULL_COLOR, MKVS_RGB48, MKVS_RGB24, MKVS_YUV444_48, MKVS_YUV444_24, MKVS_HSV48, MKVS_HSV24, MKVS_HSL48, MKVS_HSL24} c_space;
+typedef enum {NULL_COLOR, MKVS_RGB48, MKVS_RGB24, MKVS_YUV444_48, MKVS_YUV444_24, MKVS_HSV48, MKVS_HSV24, MKVS_HSL48, MKVS_HSL24,
+              MKVS_RGB48_PLANAR, MKVS_RGB24_PLANAR, MKVS_YUV444_48_PLANAR, MKVS_YUV444_24_PLANAR,
+              MKVS_HSV48_PLANAR, MKVS_HSV24_PLANAR, MKVS_HSL48_PLANAR, MKVS_HSL24_PLANAR,
+              MKVS_YUV420_12, MKVS_YUV420_24, MKVS_YUV422_16, MKVS_YUV422_32} c_space;
 
+// The number of unused payloads that an output will keep around for reuse
+#define MKVSYNTH_POOL_DEPTH 4
+
+// Every payload, and every row of a payload, starts on a multiple of this
+// many bytes: a cache line, and enough for the widest SIMD registers
+#define MKVSYNTH_ALIGNMENT 64
+
+// The number of frames that fit in the buffer between two filters when no
+// buffer memory budget has been set
+#define MKVSYNTH_BUFFER_DEPTH 10
+
+// The limits on the buffer depth that jarvis picks from the memory budget
+#define MKVSYNTH_MIN_BUFFER_DEPTH 2
+#define MKVSYNTH_MAX_BUFFER_DEPTH 64
+
+// The number of trace events that each thread allocates at a time
+#define MKVSYNTH_TRACE_BLOCK 4096
+
+// How often (in milliseconds) the advisor looks at how full the buffers are,
+// and how often (in seconds) it reports on them unless the script says otherwise
+#define MKVSYNTH_ADVISOR_SAMPLE 10
+#define MKVSYNTH_ADVISOR_INTERVAL 10
+
+// How many bytes of each frame a chain of fused filters works on at a time,
+// small enough for the rows to still be in the cache for the next filter
+#define MKVSYNTH_FUSION_BYTES (128 * 1024)
+
+// The largest script a worker takes from its coordinator, and the largest
+// segment the coordinator takes from a worker, see segments.c
+#define MKVSYNTH_MAX_SCRIPT_BYTES (16 * 1024 * 1024)
+#define MKVSYNTH_MAX_PART_BYTES (1ULL << 40)
+
+// The version of the protocol between a coordinator and its workers, the
+// longest MKVSYNTH_SECRET, and how long (in seconds) a coordinator waits for
+// a worker that connected to say who it is
+#define MKVSYNTH_SEGMENT_PROTOCOL 1
+#define MKVSYNTH_MAX_SECRET_BYTES 256
+#define MKVSYNTH_HANDSHAKE_TIMEOUT 10
 
 typedef struct MkvsynthMetaData MkvsynthMetaData;
-typedef struct MkvsynthSemaphoreList MkvsynthSemaphoreList;
 typedef struct MkvsynthFilterQueue MkvsynthFilterQueue;
+typedef struct MkvsynthPayloadPool MkvsynthPayloadPool;
+typedef struct MkvsynthPayloadHeader MkvsynthPayloadHeader;
 typedef struct MkvsynthFrame MkvsynthFrame;
+typedef struct MkvsynthRowJob MkvsynthRowJob;
+typedef struct MkvsynthTask MkvsynthTask;
+typedef struct MkvsynthWorker MkvsynthWorker;
+typedef struct MkvsynthFrameCache MkvsynthFrameCache;
+typedef struct MkvsynthFilterStats MkvsynthFilterStats;
+typedef struct MkvsynthTraceEvent MkvsynthTraceEvent;
+typedef struct MkvsynthTraceBuffer MkvsynthTraceBuffer;
+typedef struct MkvsynthBufferWatch MkvsynthBufferWatch;
+typedef struct MkvsynthFusion MkvsynthFusion;
+typedef struct MkvsynthSegmentSink MkvsynthSegmentSink;
+
+// Processes a single frame, returns 0 once the filter has output its last frame
+typedef int (*MkvsynthTaskStep)(void *filterParams);
+
+// Returns output frame number 'frame' (counting from 0), or NULL past the end
+typedef uint8_t *(*MkvsynthFrameRender)(void *filterParams, unsigned long long frame);
+
+// A function that processes rows firstRow up to (but not including) lastRow
+typedef void (*MkvsynthRowKernel)(void *filterParams, uint8_t *input, uint8_t *output, int firstRow, int lastRow);
+
+// Puts the 'count' segments of a sink (see segmentFile()) together into 'filename'
+typedef void (*MkvsynthStitch)(char const *filename, char **parts, int count, void *stitchParams);
 typedef struct MkvsynthOutput MkvsynthOutput;
 typedef struct MkvsynthInput MkvsynthInput;
 
@@ -31,9 +95,34 @@ typedef struct MkvsynthInput MkvsynthInput;
  * using the output for input needs to see and process each frame. Therefore   *
  * the output needs to be aware of how many times it is being used for input.  *
  *                                                                             *
- * recentFrame:                                                                *
- *   The most recently output frame from the output filter. When the output    *
- * filter adds another frame it gets connected to recentFrame.                 *
+ * colorspace:                                                                 *
+ *   How the pixels are stored. The colorspaces ending in _PLANAR hold the     *
+ * same values as the colorspaces without it, but instead of storing the 3     *
+ * channels of each pixel next to each other they store all of the first       *
+ * channel, then all of the second, then all of the third. Each of those       *
+ * planes starts on a new row, see getPlanes().                                *
+ *   MKVS_YUV420 and MKVS_YUV422 are always planar, and their Cb and Cr planes *
+ * are half as wide as the frame (and for YUV420 half as high), so the width   *
+ * (and for YUV420 the height) has to be even. As with the other colorspaces,  *
+ * the number is the bits per pixel: YUV420_12 and YUV422_16 have 8 bit        *
+ * samples, YUV420_24 and YUV422_32 have 16 bit samples.                       *
+ *                                                                             *
+ * frames:                                                                     *
+ *   The number of frames in the clip, 0 if it is not known (a decoder that    *
+ * can not tell how long its file is). createOutputBuffer() sets it to 0, and  *
+ * filters that know how many frames they output fill it out. A decoder may    *
+ * fill out an estimate if that is all its file has. Segments (see             *
+ * segmentFrames()) need it to split the clip up.                              *
+ *                                                                             *
+ * stride:                                                                     *
+ *   The number of bytes from the start of one row of a frame to the start of  *
+ * the next, see getLinesize(). In a planar frame every plane has its own      *
+ * rows, which all use the same stride except for subsampled chroma planes     *
+ * (see getPlaneLinesize()). The end of every row is padded so that            *
+ * every row starts on a multiple of MKVSYNTH_ALIGNMENT bytes. Filters         *
+ * normally leave it at 0, and allocateBuffers() fills it out once the rest of *
+ * the metaData is known. The padding does not belong to the picture, and      *
+ * filters writing frames to a file or an encoder leave it out.                *
  *                                                                             *
  * *** I am not sure that these are all the needed variables               *** *
  ******************************************************************************/
@@ -41,63 +130,161 @@ struct MkvsynthMetaData {
 	c_space colorspace;
 	int width;
 	int height;
+	int frames;
+	int stride;
 	int fpsNumerator;
 	int fpsDenominator;
 	void *extraData;
 };
 
-/*******************************************************************************
- * Each buffer is only allowed to contain a finite number of frames because    *
- * mkvsynth would otherwise potentially consume all of system memory and       *
- * eventually crash. Because everything operates in a different pthread,       *
- * semaphores are needed to control the size of the buffer.                    *
- *                                                                             *
- * Each buffer can be used by multiple filters for input, and each input may   *
- * be looking at a different frame in the buffer. Because of this, each input  *
- * needs to have a different semaphore for communicating with the output       *
- * filter. Each input however only needs to be aware of it's own place in the  *
- * buffer.                                                                     *
- ******************************************************************************/
-struct MkvsynthSemaphoreList {
-	sem_t remainingBuffer;
-	sem_t consumedBuffer;
-	MkvsynthSemaphoreList *next;
-};
-
 // Linked list of pthreads, parameters, and function pointers
 // This list is used for mkvsynthSpawn() and mkvsynthJoin()
+// task is only set by mkvsynthQueueTask(), those filters get no pthread
+// node is the NUMA node the filter runs on, -1 for anywhere, see placeFilters()
 struct MkvsynthFilterQueue {
 	pthread_t thread;
 	void *(*filter)(void *);
 	void *filterParams;
+	MkvsynthTask *task;
+	MkvsynthFilterStats *stats;
+	int node;
 	MkvsynthFilterQueue *next;
 };
 
+/*******************************************************************************
+ * Also see filterStats.c                                                      *
+ *                                                                             *
+ * Every filter that gets queued keeps track of where its time goes, so that   *
+ * the slowest filter in a script can be found without guessing. The report    *
+ * is printed when go() finishes. All of the times are in nanoseconds.         *
+ *                                                                             *
+ * name and line:                                                              *
+ *   The function that queued the filter, and the line of the script it was    *
+ * called from.                                                                *
+ *                                                                             *
+ * cpuTime:                                                                    *
+ *   CPU time spent running the filter, including rows that other threads      *
+ * processed for it and frames that it rendered on demand for other filters.   *
+ *                                                                             *
+ * inputWait and outputWait:                                                   *
+ *   Time the filter spent waiting for a frame to arrive in its input, and     *
+ * waiting for a free slot in its output (backpressure). For a task this is    *
+ * the time it sat idle for either reason.                                     *
+ *                                                                             *
+ * framesIn and framesOut:                                                     *
+ *   The number of frames the filter read and wrote.                           *
+ *                                                                             *
+ * lastActive:                                                                 *
+ *   When the filter last did anything, which once the script has finished is  *
+ * when the filter finished.                                                   *
+ *                                                                             *
+ * running:                                                                    *
+ *   How many copies of the filter are still running (tasks or pthreads).      *
+ *                                                                             *
+ * threads:                                                                    *
+ *   The most threads the filter may use at once, from its 'threads' argument  *
+ * or the thread budget, 0 if neither was given. See filterThreads().          *
+ *                                                                             *
+ * advisedFrames and advisedWait:                                              *
+ *   The frames and the waits of the filter the last time the advisor reported *
+ * on it, see advisor.c. Only the advisor thread uses them.                    *
+ ******************************************************************************/
+struct MkvsynthFilterStats {
+	char const *name;
+	int line;
+
+	atomic_ullong cpuTime;
+	atomic_ullong inputWait;
+	atomic_ullong outputWait;
+	atomic_ullong framesIn;
+	atomic_ullong framesOut;
+	atomic_ullong lastActive;
+	atomic_int running;
+	int threads;
+
+	unsigned long long advisedFrames;
+	unsigned long long advisedWait;
+
+	MkvsynthFilterStats *next;
+};
+
+
+/*******************************************************************************
+ * Also see MkvsynthOutput and getPayload()                                    *
+ *                                                                             *
+ * Allocating and freeing a full frame for every frame of video is expensive,  *
+ * especially for large frames. Each output has a pool of payloads that are    *
+ * all the same size (getBytes() of the output's MkvsynthMetaData). Payloads   *
+ * that are no longer needed go back into the pool that they came from, and   *
+ * the next call to getPayload() will reuse them instead of calling malloc().  *
+ *                                                                             *
+ * bytes:                                                                      *
+ *   The size of every payload in the pool. This is 0 until the first payload  *
+ * is requested, because the metaData is filled out after the output has been  *
+ * created.                                                                    *
+ *                                                                             *
+ * warmBuffers:                                                                *
+ *   The number of unused payloads in 'buffers'. At most MKVSYNTH_POOL_DEPTH   *
+ * payloads are kept, anything beyond that is free()'d.                        *
+ ******************************************************************************/
+struct MkvsynthPayloadPool {
+	int bytes;
+	int warmBuffers;
+	uint8_t *buffers[MKVSYNTH_POOL_DEPTH];
+	pthread_mutex_t lock;
+
+	MkvsynthMetaData *metaData;
+};
+
+/*******************************************************************************
+ * Every payload from getPayload() is preceded by a header that remembers      *
+ * which pool the payload came from. Payloads can be passed from filter to     *
+ * filter (removeRange for example), so the frame that a payload is cleared    *
+ * from is not necessarily attached to the pool that the payload belongs to.   *
+ *                                                                             *
+ * references:                                                                 *
+ *   The number of filters holding on to the payload. Every input that has not *
+ * finished with a frame holds a reference, as does a filter that is about to  *
+ * put the payload into its output. The payload goes back to its pool when the *
+ * count drops to 0. A filter that holds the only reference can safely write   *
+ * to the payload, everybody else has to make a copy first (copy-on-write).    *
+ *                                                                             *
+ * The header is padded to MKVSYNTH_ALIGNMENT bytes and allocated on that      *
+ * alignment, so the payload (and with it every row) is aligned as well.       *
+ ******************************************************************************/
+struct MkvsynthPayloadHeader {
+	MkvsynthPayloadPool *pool;
+	atomic_int references;
+	uint8_t padding[MKVSYNTH_ALIGNMENT - sizeof(MkvsynthPayloadPool *) - sizeof(atomic_int)];
+};
 
 /*******************************************************************************
  * Each frame needs to know how many filters have not finished looking at it,  *
- * so that the functions in frameControl.c do not deallocate memory            *
- * prematurely. The mutex is needed to prevent multiple threads (aka filters)  *
- * from decrementing the count at the same time.                               *
+ * so that the functions in frameControl.c do not reuse a slot in the ring     *
+ * prematurely. filtersRemaining is atomic so that multiple threads (aka       *
+ * filters) can decrement the count at the same time without a mutex. The     *
+ * payload itself is reference counted separately (see                         *
+ * MkvsynthPayloadHeader), because a filter can keep a payload after it is     *
+ * done with the slot.                                                         *
  *                                                                             *
  * The payload for a frame conatins all of the raw pixel data. You need an     *
  * MkvsynthMetaData to be able to interpret the raw data. The structure        *
  * that points to the frame should also point to an associated                 *
  * MkvsynthMetaData.                                                           *
  *                                                                             *
- * nextFrame is needed because a video is a linked list of MkvsynthFrames.     *
+ * output:                                                                     *
+ *   The output whose ring buffer the frame lives in. Frames that getFrame()   *
+ * copied for a single filter do not live in a ring, and have a NULL output.   *
  ******************************************************************************/
 struct MkvsynthFrame {
 	uint8_t *payload;
 
-	int filtersRemaining;
-	pthread_mutex_t lock;
-
-	MkvsynthFrame *nextFrame;
+	atomic_int filtersRemaining;
+	MkvsynthOutput *output;
 };
 
 /*******************************************************************************
- * Also see MkvsynthMetaData and MkvsynthSemaphoreList                         *
+ * Also see MkvsynthMetaData and MkvsynthInput                                 *
  *                                                                             *
  * An MkvsynthOutput and an MkvsynthInput wrap around the buffer that exists   *
  * between filters. Ultimately, the each wrap the same data. MkvsynthOutput    *
@@ -108,40 +295,405 @@ struct MkvsynthFrame {
  * using the output for input needs to see and process each frame. Therefore   *
  * the output needs to be aware of how many times it is being used for input.  *
  *                                                                             *
- * recentFrame:                                                                *
- *   The most recently output frame from the output filter. When the output    *
- * filter adds another frame it gets connected to recentFrame.                 *
+ * frames:                                                                     *
+ *   The buffer is a ring of bufferDepth frames with a single producer (the    *
+ * output filter) and outputBreadth consumers. A slot in the ring can be       *
+ * reused once its filtersRemaining has dropped to 0.                          *
+ *                                                                             *
+ * bufferDepth:                                                                *
+ *   0 until mkvsynthSpawn() calls allocateBuffers(), unless the script asked  *
+ * for a specific depth with the 'buffer' optional argument. The ring is only  *
+ * allocated once every filter has been created, because with a memory budget  *
+ * the depth depends on the size of every other buffer.                        *
+ *                                                                             *
+ * nextFrame:                                                                  *
+ *   The number of the next frame the producer will put into the ring. Only    *
+ * the producer changes it, but the scheduler looks at it to see whether the   *
+ * producer has room for another frame.                                        *
+ *                                                                             *
+ * inputs and producer:                                                        *
+ *   Every input reading from the output, and the task writing to it (NULL if  *
+ * the filter is not a task). They are used to wake up tasks that were         *
+ * waiting for a frame or for a free slot.                                     *
+ *                                                                             *
+ * cache:                                                                      *
+ *   NULL unless every input reading from the output pulls its frames with     *
+ * requestFrame() and the producer can render any frame on demand. The output  *
+ * then has no ring at all, its frames are rendered into the cache when they   *
+ * are requested, see MkvsynthFrameCache.                                      *
+ *                                                                             *
+ * nextOutput:                                                                 *
+ *   The list of outputs that allocateBuffers() still has to allocate.         *
  *                                                                             *
- * *** I am considering changing semaphores from a pointer to a data value *** *
+ * writer:                                                                     *
+ *   The stats of the filter writing to the output, see claimBuffers().        *
+ *                                                                             *
+ * framesWritten:                                                              *
+ *   The number of frames that have been put into the ring. Consumers compare  *
+ * it against their own framesRead to see if a frame is available. It is only *
+ * 32 bits so that it can be used as a futex; the consumers never fall more    *
+ * than bufferDepth frames behind, so wrapping around is not a problem.        *
+ *                                                                             *
+ * consumersWaiting and producerWaiting:                                       *
+ *   How many threads are currently asleep on the ring. The futex system call  *
+ * is only made when somebody is actually asleep, so a filter that never has   *
+ * to wait never leaves userspace.                                             *
+ *                                                                             *
+ * payloadPool:                                                                *
+ *   Where getPayload() gets new payloads from. Payloads return to the pool    *
+ * when the last filter is finished with them.                                 *
  ******************************************************************************/
 struct MkvsynthOutput {
 	int outputBreadth;
-	MkvsynthSemaphoreList *semaphores;
 
-	MkvsynthFrame *recentFrame;
+	int bufferDepth;
+	MkvsynthFrame *frames;
+	atomic_ullong nextFrame;
+	atomic_uint framesWritten;
+	atomic_int consumersWaiting;
+	atomic_int producerWaiting;
+
 	MkvsynthMetaData *metaData;
+	MkvsynthPayloadPool *payloadPool;
+
+	MkvsynthInput *inputs;
+	MkvsynthTask *producer;
+	MkvsynthFrameCache *cache;
+
+	MkvsynthOutput *nextOutput;
+	MkvsynthFilterStats *writer;
 };
 
 /*******************************************************************************
- * Also see MkvsynthOutput, MkvsynthSemaphoreList, and MkvsynthMetaData        *
+ * Also see MkvsynthOutput and MkvsynthMetaData                                *
+ *                                                                             *
+ * framesRead:                                                                 *
+ *   The number of frames that this input has taken out of the ring. The slot  *
+ * that the input will read next is framesRead % bufferDepth. Only the filter  *
+ * using the input ever changes it, but it is atomic so that other threads can *
+ * see how far behind the input is.                                            *
+ *                                                                             *
+ * payloadPool:                                                                *
+ *   The pool of the associated MkvsynthOutput. getFrame() uses it when it     *
+ * needs to make a copy of a frame.                                            *
+ *                                                                             *
+ * task:                                                                       *
+ *   The task reading from the input, or NULL if the filter is not a task.     *
+ *                                                                             *
+ * nextInput:                                                                  *
+ *   The next input reading from the same output.                              *
  *                                                                             *
- * currentFrame:                                                               *
- *   Current frame is the frame that is currently being accessed by the filter *
- * using the MkvsynthInput. It may (or may not) be different from recentFrame  *
- * in the associated MkvsynthOutput.                                           *
+ * cacheDepth and cache:                                                       *
+ *   0 and NULL unless the filter pulls frames with requestFrame(). cacheDepth *
+ * is the number of frames the filter wants to keep around (see pullFrames()), *
+ * and the cache is set up when the filters are spawned.                       *
+ *                                                                             *
+ * reader:                                                                     *
+ *   The stats of the filter reading from the input, see claimBuffers().       *
  ******************************************************************************/
 struct MkvsynthInput {
-	sem_t *remainingBuffer;
-	sem_t *consumedBuffer;
+	atomic_ullong framesRead;
+	MkvsynthOutput *output;
+
+	MkvsynthTask *task;
+	MkvsynthInput *nextInput;
+
+	int cacheDepth;
+	MkvsynthFrameCache *cache;
+	MkvsynthFilterStats *reader;
 
-	MkvsynthFrame *currentFrame;
 	MkvsynthMetaData *metaData;
+	MkvsynthPayloadPool *payloadPool;
+};
+
+/*******************************************************************************
+ * Also see processRows()                                                      *
+ *                                                                             *
+ * A row job is a single frame whose rows are being split between the threads  *
+ * of the row pool. The rows are handed out in chunks of rowsPerChunk, and     *
+ * whichever thread finishes the last chunk wakes up the filter that is        *
+ * waiting for the frame.                                                      *
+ *                                                                             *
+ * nextRow and rowsDone:                                                       *
+ *   The first row that has not been handed out yet, and the number of rows    *
+ * that are finished. Both are only changed while holding the pool lock.       *
+ *                                                                             *
+ * node:                                                                       *
+ *   The NUMA node of the thread that started the job, -1 if threads are not   *
+ * pinned. Workers on other nodes leave the job alone, see setAffinity().      *
+ *                                                                             *
+ * threads and working:                                                        *
+ *   The most threads that may work on the job at once, and how many are. The  *
+ * filter that started the job always counts as one of them.                   *
+ *                                                                             *
+ * next:                                                                       *
+ *   The list of jobs that still have rows to hand out.                        *
+ ******************************************************************************/
+struct MkvsynthRowJob {
+	MkvsynthRowKernel kernel;
+	void *filterParams;
+	uint8_t *input;
+	uint8_t *output;
+
+	int rows;
+	int rowsPerChunk;
+	int nextRow;
+	int rowsDone;
+
+	MkvsynthFilterStats *stats;
+	pthread_cond_t finished;
+	int node;
+	int threads;
+	int working;
+	MkvsynthRowJob *next;
+};
+
+/*******************************************************************************
+ * Also see mkvsynthQueueTask() and pokeTask()                                 *
+ *                                                                             *
+ * A task is a filter that is run one frame at a time by the workers of the    *
+ * scheduler instead of getting a pthread of its own. The step only ever gets  *
+ * called when the input has a frame waiting and the next slot of the output   *
+ * is free, so the step never blocks and the worker can move on to another     *
+ * filter as soon as the frame is done.                                        *
+ *                                                                             *
+ * state:                                                                      *
+ *   TASK_IDLE when the task is waiting for a frame or for space in its        *
+ * output, TASK_QUEUED while it sits in a worker's deque or is running, and    *
+ * TASK_DIRTY if something changed while it was queued (the worker checks      *
+ * again before letting the task go idle). TASK_FINISHED once the step has     *
+ * returned 0.                                                                 *
+ *                                                                             *
+ * render:                                                                     *
+ *   NULL unless the filter can also produce any single frame of its output on *
+ * demand, see mkvsynthQueueRender().                                          *
+ *                                                                             *
+ * rows:                                                                       *
+ *   NULL unless every row of the output depends only on the same row of the   *
+ * input, see mkvsynthQueueRows().                                             *
+ *                                                                             *
+ * thread:                                                                     *
+ *   1 if the step gets a pthread of its own whenever it runs, because it      *
+ * blocks inside a library for long stretches, see mkvsynthQueueThread().      *
+ *                                                                             *
+ * idleSince and idleReason:                                                   *
+ *   When the task last went idle, and whether it was waiting for its input    *
+ * or its output. The time it spends idle goes into its stats.                 *
+ *                                                                             *
+ * node:                                                                       *
+ *   The NUMA node whose workers the task is queued on, -1 for any worker, see *
+ * placeFilters().                                                             *
+ ******************************************************************************/
+enum {TASK_IDLE, TASK_QUEUED, TASK_DIRTY, TASK_FINISHED};
+
+struct MkvsynthTask {
+	MkvsynthTaskStep step;
+	void *filterParams;
+	MkvsynthInput *input;
+	MkvsynthOutput *output;
+	MkvsynthFrameRender render;
+	MkvsynthRowKernel rows;
+	int thread;
+
+	atomic_int state;
+	MkvsynthFilterStats *stats;
+	atomic_ullong idleSince;
+	atomic_int idleReason;
+	int node;
+};
+
+/*******************************************************************************
+ * Each worker of the scheduler has a deque of tasks that are ready to run.    *
+ * Tasks that a worker makes ready (by putting a frame into a buffer, or by    *
+ * freeing up a slot) go onto its own deque, so a frame tends to be processed  *
+ * by the next filter while it is still in the cache. A worker without any     *
+ * work of its own steals the oldest task from another worker's deque.         *
+ *                                                                             *
+ * tasks:                                                                      *
+ *   A ring of 'capacity' tasks, 'count' of which are in use starting at       *
+ * 'head'. The owner pushes and pops at the tail, thieves take from the head.  *
+ *                                                                             *
+ * node:                                                                       *
+ *   The NUMA node of the core the worker is pinned to, -1 if it is not        *
+ * pinned. Workers steal from workers on their own node first.                 *
+ ******************************************************************************/
+struct MkvsynthWorker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int node;
+
+	MkvsynthTask **tasks;
+	int capacity;
+	int head;
+	int count;
+};
+
+/*******************************************************************************
+ * Also see requestFrame() and pullFrames()                                    *
+ *                                                                             *
+ * A frame cache holds the frames that a filter pulled with requestFrame(),    *
+ * so that asking for the same frame twice (or for frame n-1 after frame n)    *
+ * does not do the work twice. There are two kinds of cache:                   *
+ *                                                                             *
+ * A rendered cache belongs to an output whose producer can render any frame   *
+ * on demand ('task' is that producer). The cache is shared by every input of  *
+ * the output, and a frame that is not cached is rendered by calling the       *
+ * task's render function. The least recently used frame is thrown out to      *
+ * make room, it can always be rendered again.                                 *
+ *                                                                             *
+ * A ring-fed cache belongs to a single input whose output still uses a ring   *
+ * ('task' is NULL). Frames can only be taken out of the ring in order, so     *
+ * the cache holds the last 'depth' frames that were taken out of the ring.    *
+ * Asking for a frame that has already been thrown out is an error.            *
+ *                                                                             *
+ * framesFetched:                                                              *
+ *   The number of frames a ring-fed cache has taken out of the ring.          *
+ *                                                                             *
+ * endFrame:                                                                   *
+ *   The number of frames in the clip, once the end of the clip has been seen. *
+ * ULLONG_MAX until then.                                                      *
+ *                                                                             *
+ * pullers:                                                                    *
+ *   The number of pulling filters that can still ask a ring-fed cache for a   *
+ * frame, see finishPulls(). Once nobody can, the rest of the ring is drained  *
+ * so that the filter writing to the ring does not wait on it forever.         *
+ ******************************************************************************/
+struct MkvsynthFrameCache {
+	int depth;
+	unsigned long long *frameNumbers;
+	uint8_t **payloads;
+	unsigned long long *lastUsed;
+	unsigned long long uses;
+
+	MkvsynthTask *task;
+	MkvsynthInput *input;
+	unsigned long long framesFetched;
+	unsigned long long endFrame;
+	int pullers;
+
+	pthread_mutex_t lock;
+};
+
+/*******************************************************************************
+ * Also see trace.c                                                            *
+ *                                                                             *
+ * With MKVSYNTH_TRACE set, every call to the frame functions and every frame  *
+ * a filter works on is recorded as a trace event: what happened (name and     *
+ * category), when it started, and how long it took (in nanoseconds).          *
+ *                                                                             *
+ * Each thread writes its events into its own buffer, so recording an event    *
+ * never takes a lock. The events are kept in blocks of MKVSYNTH_TRACE_BLOCK,  *
+ * and when a block is full a new one is added, so events never move.          *
+ *                                                                             *
+ * name:                                                                       *
+ *   What the thread is called in the trace, the filter for pthreads and       *
+ * 'worker' for the workers of the scheduler.                                  *
+ *                                                                             *
+ * next:                                                                       *
+ *   Every buffer is put onto a list (with a compare and swap) when its thread *
+ * records its first event, so that writeTrace() can find all of them.         *
+ ******************************************************************************/
+struct MkvsynthTraceEvent {
+	char const *name;
+	char const *category;
+	unsigned long long started;
+	unsigned long long duration;
+};
+
+struct MkvsynthTraceBuffer {
+	int thread;
+	char const *name;
+
+	MkvsynthTraceEvent **blocks;
+	int count;
+
+	MkvsynthTraceBuffer *next;
+};
+
+/*******************************************************************************
+ * Also see advisor.c                                                          *
+ *                                                                             *
+ * While the filters are running, the advisor looks at every ring every        *
+ * MKVSYNTH_ADVISOR_SAMPLE milliseconds to see how many frames are waiting     *
+ * in it for 'input'. A ring that is always full means the filter reading      *
+ * from it cannot keep up, and a ring that is always empty means the filter    *
+ * writing to it cannot keep up.                                               *
+ *                                                                             *
+ * samples, fullSamples and emptySamples:                                      *
+ *   How many times the ring was looked at since the last report, and how      *
+ * many of those times it was full or empty.                                   *
+ *                                                                             *
+ * framesWaiting:                                                              *
+ *   The frames that were waiting for 'input', added up over every sample.     *
+ ******************************************************************************/
+struct MkvsynthBufferWatch {
+	MkvsynthInput *input;
+
+	int samples;
+	int fullSamples;
+	int emptySamples;
+	unsigned long long framesWaiting;
+
+	MkvsynthBufferWatch *next;
+};
+
+/*******************************************************************************
+ * Also see fuseFilters() and mkvsynthQueueRows()                              *
+ *                                                                             *
+ * A chain of filters that work on each row on its own, run as a single task.  *
+ * Filter 'i' of the chain runs kernels[i] with filterParams[i], reading the   *
+ * rows that filter i - 1 wrote into outputs[i - 1] (or the rows of 'input'    *
+ * for the first filter) and writing into outputs[i]. Only the last of the     *
+ * outputs has a ring, the others just lend their payload pools and metaData   *
+ * to frames that never leave the task.                                        *
+ *                                                                             *
+ * renders:                                                                    *
+ *   1 if every filter in the chain could render frames on demand, in which    *
+ * case the chain can too.                                                     *
+ ******************************************************************************/
+struct MkvsynthFusion {
+	int count;
+	MkvsynthRowKernel *kernels;
+	void **filterParams;
+	MkvsynthOutput **outputs;
+	int renders;
+
+	MkvsynthInput *input;
+};
+
+/*******************************************************************************
+ * Also see segmentFile()                                                      *
+ *                                                                             *
+ * A sink that is writing a segment of its output, in the order the sinks were *
+ * created. The first of the processes stitches the segments together once     *
+ * every process is done, and a worker sends its segments to the coordinator.  *
+ *                                                                             *
+ * part:                                                                       *
+ *   The file this process writes its segment to. A worker writes to a         *
+ * temporary file, since the directory of 'filename' may only exist on the     *
+ * coordinator's machine.                                                      *
+ ******************************************************************************/
+struct MkvsynthSegmentSink {
+	char *filename;
+	char *extension;
+	char *part;
+	MkvsynthStitch stitch;
+	void *stitchParams;
+	MkvsynthSegmentSink *next;
 };
 
 #include "../delbrot/delbrot.h"
 #include "../colorspacing/colorspacing.h"
+#include "advisor.h"
+#include "affinity.h"
 #include "bufferAllocation.h"
+#include "frameCache.h"
+#include "filterStats.h"
 #include "frameControl.h"
+#include "fusion.h"
+#include "segments.h"
 #include "spawn.h"
+#include "threadPool.h"
+#include "trace.h"
 
 #endif
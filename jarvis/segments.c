@@ -0,0 +1,631 @@
+#include "segments.h"
+#include <endian.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/******************************************************************************
+ * Also see MkvsynthSegmentSink and the --segments option                     *
+ *                                                                            *
+ * A script with a single encoder at the end only ever works on one part of   *
+ * the video at a time, and the encoder can only use so many cores. With      *
+ * --segments N, mkvsynth runs the script N times side by side, in N          *
+ * processes, and every sink only writes its share of the frames: the first   *
+ * process the first Nth of the clip, the second process the second Nth, and  *
+ * so on. Sinks pull their frames (see requestFrame()), so every filter in    *
+ * front of them that can render on demand only renders the frames of its     *
+ * own segment, and ffmpegDecode seeks straight to the start of it.           *
+ *                                                                            *
+ * Every sink writes its segment to a file of its own, see segmentFile().     *
+ * The first process waits for the others at the end of every go(), and then  *
+ * stitches the segments of each sink into the file the script asked for.     *
+ *                                                                            *
+ * The other processes are either forked on the same machine, or they are     *
+ * workers that connect to the first process (the coordinator) over TCP, see  *
+ * listenSegments() and joinSegments(). Either way the processes are started  *
+ * before the script is read, so that none of them share an open file with    *
+ * another.                                                                   *
+ *****************************************************************************/
+static int segment = 0;
+static int segmentCount = 1;
+
+// Every forked process writes a byte into a pipe of its own each time go()
+// finishes, the first process keeps the read ends, by segment
+static int *segmentPipes = NULL;
+static pid_t *segmentChildren = NULL;
+
+// The coordinator's connections to its workers, by segment, NULL without workers
+static int *workerSockets = NULL;
+
+// A worker's connection to its coordinator, -1 for any other process
+static int coordinatorSocket = -1;
+
+// The sinks created since the last go(), in order, which get stitched when it finishes
+static MkvsynthSegmentSink *sinks = NULL;
+static MkvsynthSegmentSink *lastSink = NULL;
+
+// Reaps the forked processes when the first one exits, see startSegments()
+static void waitSegments() {
+	int i;
+	for(i = 1; i < segmentCount; i++) {
+		int status;
+		if(waitpid(segmentChildren[i], &status, 0) != segmentChildren[i])
+			continue;
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			MkvsynthMessage("the process rendering segment %i did not exit cleanly", i + 1);
+	}
+}
+
+/******************************************************************************
+ * startSegments is called by main() for --segments, before the script is     *
+ * read. It forks count - 1 more copies of mkvsynth, each of which goes on to *
+ * run the script for a segment of its own. The thread budget is split        *
+ * between them, so that together they use as many threads as a single        *
+ * process would have.                                                        *
+ *****************************************************************************/
+void startSegments(int count) {
+	if(count <= 1)
+		return;
+
+	int threads = threadBudget() / count;
+	setThreadBudget(threads < 1 ? 1 : threads);
+
+	segmentPipes = malloc(count * sizeof(int));
+	segmentChildren = malloc(count * sizeof(pid_t));
+	segmentPipes[0] = -1;
+
+	// Flush before forking, or the children print it again
+	fflush(stdout);
+	fflush(stderr);
+
+	segmentCount = count;
+	int i, j;
+	for(i = 1; i < count; i++) {
+		int ends[2];
+		if(pipe(ends) != 0)
+			MkvsynthError("could not create a pipe for segment %i", i + 1);
+
+		pid_t child = fork();
+		if(child < 0)
+			MkvsynthError("could not start the process for segment %i", i + 1);
+
+		if(child == 0) {
+			// Only the write end of its own pipe stays open in a child
+			segment = i;
+			for(j = 1; j < i; j++)
+				close(segmentPipes[j]);
+			close(ends[0]);
+			segmentPipes[i] = ends[1];
+			return;
+		}
+
+		// Without the write end, a read sees the end of the pipe as soon
+		// as the child goes away
+		close(ends[1]);
+		segmentPipes[i] = ends[0];
+		segmentChildren[i] = child;
+	}
+
+	atexit(waitSegments);
+}
+
+// Writes all of 'data' to 'socket', any error ends the script
+static void sendAll(int socket, void const *data, size_t bytes) {
+	while(bytes > 0) {
+		ssize_t sent = send(socket, data, bytes, MSG_NOSIGNAL);
+		if(sent <= 0)
+			MkvsynthError("the connection between the coordinator and a worker was lost");
+
+		data = (char const *)data + sent;
+		bytes -= sent;
+	}
+}
+
+// Reads exactly 'bytes' from 'socket', returns 0 if the connection went away
+static int receiveAll(int socket, void *data, size_t bytes) {
+	while(bytes > 0) {
+		ssize_t received = recv(socket, data, bytes, 0);
+		if(received <= 0)
+			return 0;
+
+		data = (char *)data + received;
+		bytes -= received;
+	}
+
+	return 1;
+}
+
+// Reads a line of at most 'size' - 1 bytes from 'socket' into 'line', without
+// the newline. Returns 0 if the connection went away or the line is too long
+static int receiveLine(int socket, char *line, size_t size) {
+	size_t i;
+	for(i = 0; i < size - 1; i++) {
+		if(!receiveAll(socket, &line[i], 1))
+			return 0;
+		if(line[i] == '\n') {
+			line[i] = '\0';
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Returns the secret from MKVSYNTH_SECRET, or "" if it is not set
+static char const *segmentSecret() {
+	char const *secret = getenv("MKVSYNTH_SECRET");
+	if(secret == NULL)
+		return "";
+	if(strlen(secret) > MKVSYNTH_MAX_SECRET_BYTES || strchr(secret, '\n') != NULL)
+		MkvsynthError("MKVSYNTH_SECRET has to be a single line of at most %i bytes", MKVSYNTH_MAX_SECRET_BYTES);
+	return secret;
+}
+
+// Compares two secrets in a time that does not depend on where they differ
+static int sameSecret(char const *first, char const *second) {
+	size_t firstLength = strlen(first), secondLength = strlen(second);
+	unsigned char difference = firstLength != secondLength;
+
+	size_t i;
+	for(i = 0; i < firstLength && i < secondLength; i++)
+		difference |= first[i] ^ second[i];
+	return difference == 0;
+}
+
+// Splits 'address' ("host:port", "[host]:port" or "port") into a host, which
+// is 'defaultHost' if there is none, and a port, to be freed with the host
+static void splitAddress(char const *address, char const *defaultHost, char **host, char **port) {
+	char *copy = strdup(address);
+	char *colon = strrchr(copy, ':');
+	if(colon == NULL) {
+		*port = copy;
+		*host = strdup(defaultHost);
+		return;
+	}
+
+	*colon = '\0';
+	*port = strdup(colon + 1);
+	*host = copy;
+	if(copy[0] == '[' && colon > copy + 1 && colon[-1] == ']') {
+		colon[-1] = '\0';
+		memmove(copy, copy + 1, strlen(copy));
+	}
+}
+
+// Returns 1 if 'address' can only be reached from this machine
+static int isLoopback(struct sockaddr const *address) {
+	if(address->sa_family == AF_INET)
+		return (ntohl(((struct sockaddr_in const *)address)->sin_addr.s_addr) >> 24) == 127;
+	if(address->sa_family == AF_INET6)
+		return IN6_IS_ADDR_LOOPBACK(&((struct sockaddr_in6 const *)address)->sin6_addr);
+	return 0;
+}
+
+// Checks the line a worker starts with, see joinSegments(). Returns 0 if it
+// is not an mkvsynth worker of the same version with the same secret
+static int acceptWorker(int worker, char const *secret) {
+	// A connection that never says anything must not hold up the others
+	struct timeval timeout = { MKVSYNTH_HANDSHAKE_TIMEOUT, 0 };
+	setsockopt(worker, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	char line[MKVSYNTH_MAX_SECRET_BYTES + 64];
+	int version, offset = -1;
+	if(!receiveLine(worker, line, sizeof(line))) {
+		MkvsynthMessage("Turned away a connection that did not say what it is");
+		return 0;
+	}
+	if(sscanf(line, "mkvsynth-worker %i %n", &version, &offset) != 1 || offset < 0) {
+		MkvsynthMessage("Turned away a connection that is not an mkvsynth worker");
+		return 0;
+	}
+	if(version != MKVSYNTH_SEGMENT_PROTOCOL) {
+		MkvsynthMessage("Turned away a worker that speaks version %i of the segment protocol instead of %i", version, MKVSYNTH_SEGMENT_PROTOCOL);
+		return 0;
+	}
+	if(!sameSecret(line + offset, secret)) {
+		MkvsynthMessage("Turned away a worker with the wrong MKVSYNTH_SECRET");
+		return 0;
+	}
+
+	// Rendering a segment can take much longer than the handshake
+	timeout.tv_sec = 0;
+	setsockopt(worker, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	return 1;
+}
+
+/******************************************************************************
+ * listenSegments is startSegments for segments that are rendered by workers, *
+ * which may run on other machines. The coordinator renders the first         *
+ * segment itself, and waits at 'address' ("host:port", or just "port" for    *
+ * 127.0.0.1) for count - 1 workers to connect (see joinSegments()). Each     *
+ * worker has to start with the magic line of the same protocol version and   *
+ * the secret from MKVSYNTH_SECRET, and anything else is turned away. A       *
+ * coordinator that can be reached from other machines needs a secret.        *
+ *                                                                            *
+ * Each worker is then sent the number of its segment, the number of          *
+ * segments, and the script, so the script only has to exist on the           *
+ * coordinator. The files the script reads have to be at the same paths on    *
+ * every machine. The thread budget is not split, since the workers are       *
+ * expected to have cores of their own.                                       *
+ *****************************************************************************/
+void listenSegments(int count, char const *address, char const *script) {
+	if(count <= 1)
+		return;
+
+	FILE *scriptFile = fopen(script, "r");
+	if(scriptFile == NULL)
+		MkvsynthError("could not open %s to send to the workers", script);
+
+	fseek(scriptFile, 0, SEEK_END);
+	long length = ftell(scriptFile);
+	rewind(scriptFile);
+	if(length < 0 || length > MKVSYNTH_MAX_SCRIPT_BYTES)
+		MkvsynthError("%s is too big to send to the workers", script);
+
+	char *text = malloc(length + 1);
+	if(text == NULL || fread(text, 1, length, scriptFile) != length)
+		MkvsynthError("could not read %s to send to the workers", script);
+	fclose(scriptFile);
+
+	char const *secret = segmentSecret();
+	char *host, *port;
+	splitAddress(address, "127.0.0.1", &host, &port);
+
+	struct addrinfo hints, *addresses, *current;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if(getaddrinfo(host, port, &hints, &addresses) != 0)
+		MkvsynthError("could not find %s to listen for workers on", address);
+
+	int server = -1;
+	for(current = addresses; current != NULL; current = current->ai_next) {
+		if(!isLoopback(current->ai_addr) && secret[0] == '\0')
+			MkvsynthError("listening for workers on %s needs MKVSYNTH_SECRET, since other machines can connect to it", address);
+
+		server = socket(current->ai_family, current->ai_socktype, current->ai_protocol);
+		int reuse = 1;
+		setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		if(server >= 0 && bind(server, current->ai_addr, current->ai_addrlen) == 0 && listen(server, count) == 0)
+			break;
+
+		if(server >= 0)
+			close(server);
+		server = -1;
+	}
+
+	freeaddrinfo(addresses);
+	free(host);
+	free(port);
+	if(server < 0)
+		MkvsynthError("could not listen for workers on %s", address);
+
+	MkvsynthMessage("Waiting for %i workers on %s", count - 1, address);
+	workerSockets = malloc(count * sizeof(int));
+	workerSockets[0] = -1;
+
+	int i = 1;
+	while(i < count) {
+		workerSockets[i] = accept(server, NULL, NULL);
+		if(workerSockets[i] < 0)
+			MkvsynthError("could not accept a worker on %s", address);
+
+		if(!acceptWorker(workerSockets[i], secret)) {
+			close(workerSockets[i]);
+			continue;
+		}
+
+		char header[96];
+		int headerLength = sprintf(header, "mkvsynth-coordinator %i %i %i %li\n", MKVSYNTH_SEGMENT_PROTOCOL, i, count, length);
+		sendAll(workerSockets[i], header, headerLength);
+		sendAll(workerSockets[i], text, length);
+		MkvsynthMessage("Worker %i of %i connected, it renders segment %i", i, count - 1, i + 1);
+		i++;
+	}
+
+	close(server);
+	free(text);
+	segmentCount = count;
+}
+
+/******************************************************************************
+ * joinSegments is called by main() for --connect, and makes this process a   *
+ * worker of the coordinator at 'address' ("host:port"). The worker starts    *
+ * with a line of its own: the protocol's magic and version, and the secret   *
+ * from MKVSYNTH_SECRET. It returns the script that the coordinator sent,     *
+ * which the worker runs instead of a file of its own.                        *
+ *****************************************************************************/
+FILE *joinSegments(char const *address) {
+	char const *secret = segmentSecret();
+	char *host, *port;
+	if(strchr(address, ':') == NULL)
+		MkvsynthError("--connect needs the address of the coordinator as host:port");
+	splitAddress(address, NULL, &host, &port);
+
+	struct addrinfo hints, *addresses, *current;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if(getaddrinfo(host, port, &hints, &addresses) != 0)
+		MkvsynthError("could not find the coordinator at %s", address);
+
+	for(current = addresses; current != NULL; current = current->ai_next) {
+		coordinatorSocket = socket(current->ai_family, current->ai_socktype, current->ai_protocol);
+		if(coordinatorSocket >= 0 && connect(coordinatorSocket, current->ai_addr, current->ai_addrlen) == 0)
+			break;
+
+		if(coordinatorSocket >= 0)
+			close(coordinatorSocket);
+		coordinatorSocket = -1;
+	}
+
+	freeaddrinfo(addresses);
+	free(host);
+	free(port);
+	if(coordinatorSocket < 0)
+		MkvsynthError("could not connect to the coordinator at %s", address);
+
+	char hello[MKVSYNTH_MAX_SECRET_BYTES + 64];
+	int helloLength = sprintf(hello, "mkvsynth-worker %i %s\n", MKVSYNTH_SEGMENT_PROTOCOL, secret);
+	sendAll(coordinatorSocket, hello, helloLength);
+
+	// The header is a single line, followed by the script
+	char header[96];
+	if(!receiveLine(coordinatorSocket, header, sizeof(header)))
+		MkvsynthError("the coordinator at %s hung up, check that MKVSYNTH_SECRET is the same on both sides", address);
+
+	int version;
+	long length;
+	if(sscanf(header, "mkvsynth-coordinator %i %i %i %li", &version, &segment, &segmentCount, &length) != 4)
+		MkvsynthError("%s does not seem to be an mkvsynth coordinator", address);
+	if(version != MKVSYNTH_SEGMENT_PROTOCOL)
+		MkvsynthError("the coordinator at %s speaks version %i of the segment protocol instead of %i", address, version, MKVSYNTH_SEGMENT_PROTOCOL);
+	if(segment < 1 || segment >= segmentCount || length < 0 || length > MKVSYNTH_MAX_SCRIPT_BYTES)
+		MkvsynthError("the coordinator at %s sent a header that does not make sense", address);
+
+	char *text = malloc(length + 1);
+	if(text == NULL)
+		MkvsynthError("could not allocate %li bytes for the script from %s", length, address);
+	if(!receiveAll(coordinatorSocket, text, length))
+		MkvsynthError("the coordinator at %s went away", address);
+
+	FILE *script = tmpfile();
+	fwrite(text, 1, length, script);
+	rewind(script);
+	free(text);
+
+	MkvsynthMessage("Rendering segment %i of %i for %s", segment + 1, segmentCount, address);
+	return script;
+}
+
+/******************************************************************************
+ * segmentFrames is called by sinks while they are being created. 'first' and *
+ * 'last' are the frames the sink would write if there were no segments,      *
+ * counting from 0, with 'last' being the first frame that is not written, or *
+ * 0 for the end of the clip. Without segments it returns 0 and leaves them   *
+ * alone. Otherwise it narrows them down to the frames of this process's      *
+ * segment and returns 1. A sink can only be split up if the number of frames *
+ * in the clip is known, and every segment gets at least one frame.           *
+ *                                                                            *
+ * A decoder may only know roughly how many frames its file has, so the last  *
+ * segment of a sink that runs to the end of the clip still runs to the end   *
+ * of the clip, and 'last' stays 0.                                           *
+ *****************************************************************************/
+int segmentFrames(MkvsynthMetaData *metaData, unsigned long long *first, unsigned long long *last) {
+	if(segmentCount <= 1)
+		return 0;
+
+	unsigned long long end = *last > 0 ? *last : metaData->frames;
+	if(end <= *first)
+		MkvsynthError("the number of frames in the clip is not known, so it can not be split into segments");
+
+	unsigned long long frames = end - *first;
+	if(frames < segmentCount)
+		MkvsynthError("the clip has fewer frames than there are segments");
+
+	unsigned long long start = *first;
+	*first = start + frames * segment / segmentCount;
+	if(*last > 0 || segment < segmentCount - 1)
+		*last = start + frames * (segment + 1) / segmentCount;
+	return 1;
+}
+
+// Returns the file that segment 'index' of 'filename' is written to
+static char *partName(char const *filename, int index, char const *extension) {
+	char *part = malloc(strlen(filename) + strlen(extension) + 32);
+	sprintf(part, "%s.part%i%s", filename, index + 1, extension);
+	return part;
+}
+
+/******************************************************************************
+ * segmentFile is called by a sink that has a segment (see segmentFrames())   *
+ * instead of opening 'filename' itself. It returns the name of the file that *
+ * the segment goes to, which is 'filename' with the number of the segment    *
+ * and 'extension' (NULL for none) added to it, or a temporary file on a      *
+ * worker. Once every process has finished, the first one calls 'stitch'      *
+ * with the names of all of the segments, in order, and deletes them          *
+ * afterwards.                                                                *
+ *****************************************************************************/
+char *segmentFile(char const *filename, char const *extension, MkvsynthStitch stitch, void *stitchParams) {
+	if(extension == NULL)
+		extension = "";
+
+	MkvsynthSegmentSink *sink = malloc(sizeof(MkvsynthSegmentSink));
+	sink->filename = strdup(filename);
+	sink->extension = strdup(extension);
+	sink->stitch = stitch;
+	sink->stitchParams = stitchParams;
+	sink->next = NULL;
+
+	if(coordinatorSocket >= 0) {
+		sink->part = malloc(strlen(extension) + 32);
+		sprintf(sink->part, "/tmp/mkvsynth-XXXXXX%s", extension);
+		int part = mkstemps(sink->part, strlen(extension));
+		if(part < 0)
+			MkvsynthError("could not create a temporary file for the segment of %s", filename);
+		close(part);
+	} else {
+		sink->part = partName(filename, segment, extension);
+	}
+
+	if(lastSink == NULL)
+		sinks = sink;
+	else
+		lastSink->next = sink;
+	lastSink = sink;
+
+	return strdup(sink->part);
+}
+
+// Sends the size of 'part' and then its contents to the coordinator
+static void sendPart(char const *part) {
+	FILE *file = fopen(part, "r");
+	if(file == NULL)
+		MkvsynthError("segment %s is missing", part);
+
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	if(length < 0 || length > MKVSYNTH_MAX_PART_BYTES)
+		MkvsynthError("segment %s is too big to send to the coordinator", part);
+
+	uint64_t size = htobe64(length);
+	rewind(file);
+	sendAll(coordinatorSocket, &size, sizeof(size));
+
+	char buffer[65536];
+	size_t bytes;
+	while((bytes = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		sendAll(coordinatorSocket, buffer, bytes);
+
+	fclose(file);
+}
+
+// Receives a part sent with sendPart() into 'part', returns 0 if the worker
+// went away or sent a size that can not be right
+static int receivePart(int socket, char const *part) {
+	uint64_t size;
+	if(!receiveAll(socket, &size, sizeof(size)))
+		return 0;
+	size = be64toh(size);
+	if(size > MKVSYNTH_MAX_PART_BYTES)
+		return 0;
+
+	FILE *file = fopen(part, "w");
+	if(file == NULL)
+		MkvsynthError("could not write segment %s", part);
+
+	char buffer[65536];
+	while(size > 0) {
+		size_t bytes = size < sizeof(buffer) ? size : sizeof(buffer);
+		if(!receiveAll(socket, buffer, bytes)) {
+			fclose(file);
+			return 0;
+		}
+
+		if(fwrite(buffer, 1, bytes, file) != bytes)
+			MkvsynthError("could not write segment %s", part);
+		size -= bytes;
+	}
+
+	fclose(file);
+	return 1;
+}
+
+/******************************************************************************
+ * finishSegments is called at the end of every go(). The other processes let *
+ * the first one know that they are done, workers by sending their segments   *
+ * over, and the first one waits for all of them, then stitches the segments  *
+ * of every sink together. A process that goes away without saying that it is *
+ * done has failed, and so has the whole script.                              *
+ *****************************************************************************/
+void finishSegments() {
+	if(segmentCount <= 1)
+		return;
+
+	MkvsynthSegmentSink *sink;
+	int i;
+	if(coordinatorSocket >= 0) {
+		for(sink = sinks; sink != NULL; sink = sink->next) {
+			sendPart(sink->part);
+			unlink(sink->part);
+		}
+	} else if(segment != 0) {
+		char done = 1;
+		if(write(segmentPipes[segment], &done, 1) != 1)
+			MkvsynthError("could not tell the first segment that segment %i is done", segment + 1);
+	} else if(workerSockets == NULL) {
+		// One byte from every segment, a fast segment that is already done
+		// with the next go() cannot stand in for a slow one
+		for(i = 1; i < segmentCount; i++) {
+			char done;
+			if(read(segmentPipes[i], &done, 1) != 1)
+				MkvsynthError("segment %i failed, the output is incomplete", i + 1);
+		}
+	} else {
+		for(i = 1; i < segmentCount; i++) {
+			for(sink = sinks; sink != NULL; sink = sink->next) {
+				char *part = partName(sink->filename, i, sink->extension);
+				if(!receivePart(workerSockets[i], part))
+					MkvsynthError("the worker rendering segment %i failed, the output is incomplete", i + 1);
+				free(part);
+			}
+		}
+	}
+
+	while(sinks != NULL) {
+		sink = sinks;
+		sinks = sink->next;
+
+		if(segment == 0) {
+			char **parts = malloc(segmentCount * sizeof(char *));
+			for(i = 0; i < segmentCount; i++)
+				parts[i] = partName(sink->filename, i, sink->extension);
+
+			MkvsynthMessage("Stitching %i segments into %s", segmentCount, sink->filename);
+			sink->stitch(sink->filename, parts, segmentCount, sink->stitchParams);
+
+			for(i = 0; i < segmentCount; i++) {
+				unlink(parts[i]);
+				free(parts[i]);
+			}
+
+			free(parts);
+		}
+
+		free(sink->filename);
+		free(sink->extension);
+		free(sink->part);
+		free(sink);
+	}
+
+	lastSink = NULL;
+}
+
+// A stitch for sinks whose segments can simply be written one after another
+void concatenateFiles(char const *filename, char **parts, int count, void *stitchParams) {
+	FILE *output = fopen(filename, "w");
+	if(output == NULL)
+		MkvsynthError("could not open %s to stitch the segments into", filename);
+
+	char buffer[65536];
+	int i;
+	for(i = 0; i < count; i++) {
+		FILE *part = fopen(parts[i], "r");
+		if(part == NULL)
+			MkvsynthError("segment %s is missing", parts[i]);
+
+		size_t bytes;
+		while((bytes = fread(buffer, 1, sizeof(buffer), part)) > 0)
+			fwrite(buffer, 1, bytes, output);
+
+		fclose(part);
+	}
+
+	fclose(output);
+}
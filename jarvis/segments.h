@@ -0,0 +1,10 @@
+#include "jarvis.h"
+#include <stdio.h>
+
+void startSegments(int count);
+void listenSegments(int count, char const *address, char const *script);
+FILE *joinSegments(char const *address);
+int segmentFrames(MkvsynthMetaData *metaData, unsigned long long *first, unsigned long long *last);
+char *segmentFile(char const *filename, char const *extension, MkvsynthStitch stitch, void *stitchParams);
+void finishSegments();
+void concatenateFiles(char const *filename, char **parts, int count, void *stitchParams);
@@ -1,5 +1,7 @@
 #include "spawn.h"
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 /******************************************************************************
  * The head and tail of the list are currently implemented outside of the     *
@@ -9,6 +11,41 @@
 static MkvsynthFilterQueue *head = 0;
 static MkvsynthFilterQueue *tail = 0;
 
+// The memory budget for all of the buffers in bytes, 0 means no budget
+static unsigned long long bufferMemory = 0;
+
+// Where go() writes the filter statistics as JSON, NULL to only print them
+static char *statsFile = NULL;
+
+// Seconds between the reports of the advisor, 0 to switch it off
+static double advisorInterval = MKVSYNTH_ADVISOR_INTERVAL;
+
+// 1 to pin the filters to cores and NUMA nodes, see placeFilters()
+static int pinThreads = 0;
+
+/******************************************************************************
+ * Also see threadBudget()                                                    *
+ *                                                                            *
+ * filterThreads returns how many threads the filter that is being created    *
+ * may use: its 'threads' argument if it has one, but never more than the     *
+ * thread budget. Without either it returns 0, and the filter (or the library *
+ * it uses) decides for itself. Filters that start threads of their own ask   *
+ * while they are being created, every other filter gets it from jarvis.      *
+ *****************************************************************************/
+int filterThreads() {
+	int threads = threadBudgetSet() ? threadBudget() : 0;
+
+	double *hint = currentArgs ? getOptArg(currentArgs, "threads", typeNum) : NULL;
+	if(hint != NULL) {
+		if(*hint < 1)
+			MkvsynthError("threads must be at least 1");
+		if(threads == 0 || *hint < threads)
+			threads = *hint;
+	}
+
+	return threads;
+}
+
 /******************************************************************************
  * The incoming arguments are a function (to spawn in a pthread) and the      *
  * input struct for that function. Because no filter should start processing  *
@@ -19,7 +56,12 @@ void mkvsynthQueue(void *filterParams, void *(*filter) (void *)) {
 	MkvsynthFilterQueue *new = malloc(sizeof(MkvsynthFilterQueue));
 	new->filter = filter;
 	new->filterParams = filterParams;
+	new->task = NULL;
+	new->stats = createFilterStats(currentFunction, linenumber);
+	new->stats->threads = filterThreads();
+	new->node = -1;
 	new->next = NULL;
+	claimBuffers(new->stats);
 
 	if(head == NULL) {
 		head = new;
@@ -31,19 +73,224 @@ void mkvsynthQueue(void *filterParams, void *(*filter) (void *)) {
 }
 
 /******************************************************************************
- * All filters have finished their startup: go through the queue and create   *
- * a bunch of pthreads.                                                       *
+ * Also see MkvsynthTask and threadPool.c                                     *
+ *                                                                            *
+ * mkvsynthQueueTask is mkvsynthQueue for filters that are written as a step  *
+ * that processes a single frame: get a frame from 'input' (if there is an    *
+ * input), put at most one frame into 'output' (if there is an output), and   *
+ * return 0 once the final frame has been put, 1 otherwise. The filter frees  *
+ * its params before returning 0, just like a pthread filter would.           *
+ *                                                                            *
+ * Tasks do not get a pthread. The workers of the scheduler call the step     *
+ * whenever a frame is waiting and there is room in the output, so scripts    *
+ * with lots of filters do not end up with lots of threads.                   *
+ *****************************************************************************/
+void mkvsynthQueueTask(void *filterParams, MkvsynthTaskStep step, MkvsynthInput *input, MkvsynthOutput *output) {
+	MkvsynthTask *task = malloc(sizeof(MkvsynthTask));
+	task->step = step;
+	task->filterParams = filterParams;
+	task->input = input;
+	task->output = output;
+	task->render = NULL;
+	task->rows = NULL;
+	task->thread = 0;
+	task->node = -1;
+	atomic_init(&task->state, TASK_IDLE);
+
+	if(input != NULL)
+		input->task = task;
+	if(output != NULL)
+		output->producer = task;
+
+	mkvsynthQueue(filterParams, NULL);
+	tail->task = task;
+	task->stats = tail->stats;
+}
+
+/******************************************************************************
+ * Also see connectCaches() and requestFrame()                                *
+ *                                                                            *
+ * mkvsynthQueueRender is called after mkvsynthQueueTask by filters that can  *
+ * also produce any single frame of 'output' on demand. 'render' is called    *
+ * with the same params as the step and returns a payload from getPayload()   *
+ * (or NULL if the clip has fewer frames), getting the frames it needs from   *
+ * the filter's input with requestFrame() instead of getFrame(). It must not  *
+ * touch any state that the step keeps from one frame to the next.            *
+ *                                                                            *
+ * If every filter reading from 'output' pulls its frames, the step never     *
+ * runs, and only the frames that are actually asked for are ever rendered.   *
+ *****************************************************************************/
+void mkvsynthQueueRender(MkvsynthOutput *output, MkvsynthFrameRender render) {
+	if(output->producer == NULL)
+		MkvsynthError("mkvsynthQueueRender: the filter has to be queued with mkvsynthQueueTask first");
+
+	output->producer->render = render;
+}
+
+/******************************************************************************
+ * Also see fuseFilters() and MkvsynthFusion                                  *
+ *                                                                            *
+ * mkvsynthQueueRows is called after mkvsynthQueueTask by filters whose       *
+ * output is the same height as their input, and whose step does nothing but  *
+ * get a frame, get a payload for 'output', fill it with processRows() and    *
+ * 'kernel', and put it. The kernel may only read the rows of the input that  *
+ * it is asked to write in the output, and the params must be freed with      *
+ * free() and nothing else.                                                   *
+ *                                                                            *
+ * Such filters can be fused with the filters around them that do the same,   *
+ * so that a frame goes through all of them one block of rows at a time, and  *
+ * the frames in between never have to be written out to memory.              *
+ *****************************************************************************/
+void mkvsynthQueueRows(MkvsynthOutput *output, MkvsynthRowKernel kernel) {
+	if(output->producer == NULL)
+		MkvsynthError("mkvsynthQueueRows: the filter has to be queued with mkvsynthQueueTask first");
+
+	output->producer->rows = kernel;
+}
+
+/******************************************************************************
+ * Also see mkvsynthPull()                                                    *
+ *                                                                            *
+ * mkvsynthQueueThread is called after mkvsynthQueueTask by filters whose     *
+ * step spends most of its time blocked inside a library, a decoder that      *
+ * reads the file and waits on threads of its own for example. Whenever the   *
+ * step runs, it runs on a pthread of its own, like a filter queued with      *
+ * mkvsynthQueue, rather than holding up a worker. A render function is still *
+ * used on its own if the output is rendered on demand.                       *
+ *****************************************************************************/
+void mkvsynthQueueThread(MkvsynthOutput *output) {
+	if(output->producer == NULL)
+		MkvsynthError("mkvsynthQueueThread: the filter has to be queued with mkvsynthQueueTask first");
+
+	output->producer->thread = 1;
+}
+
+/******************************************************************************
+ * Every pthread starts here, so that the time the filter spends running is   *
+ * counted towards its stats.                                                 *
+ *****************************************************************************/
+static void *filterThread(void *queued) {
+	MkvsynthFilterQueue *filter = (MkvsynthFilterQueue *)queued;
+
+	pinToNode(filter->node);
+	traceThreadName(filter->stats->name);
+	unsigned long long started = traceStart();
+
+	enterFilter(filter->stats);
+	filter->filter(filter->filterParams);
+	leaveFilter(NULL);
+
+	traceEvent(filter->stats->name, "filter", started);
+	atomic_fetch_sub(&filter->stats->running, 1);
+	freeRowScratch();
+	return NULL;
+}
+
+/******************************************************************************
+ * A task that pulls its frames with requestFrame() may have to wait for a    *
+ * frame that is still being worked on further up, so it cannot run on a      *
+ * worker, and neither can a task that asked for a thread with                *
+ * mkvsynthQueueThread(). It gets a pthread that calls the step until the     *
+ * filter is done.                                                            *
+ *****************************************************************************/
+static void *stepThread(void *filterTask) {
+	MkvsynthTask *task = (MkvsynthTask *)filterTask;
+
+	int running = 1;
+	while(running) {
+		unsigned long long started = traceStart();
+		running = task->step(task->filterParams);
+		traceEvent(task->stats->name, "filter", started);
+	}
+
+	if(task->input != NULL && task->input->cache != NULL)
+		finishPulls(task->input);
+	return NULL;
+}
+
+/******************************************************************************
+ * Also see connectCaches() and mkvsynthQueueThread()                         *
+ *                                                                            *
+ * Once the caches are connected, a task whose output is rendered on demand   *
+ * does not run at all, and a task that pulls its input, or that asked for a  *
+ * thread of its own, runs on a pthread. None of them must be poked by the    *
+ * rings around them anymore.                                                 *
+ *****************************************************************************/
+static void mkvsynthPull(MkvsynthFilterQueue *queued) {
+	MkvsynthTask *task = queued->task;
+
+	if(task->output != NULL && task->output->cache != NULL) {
+		queued->filter = NULL;
+	} else if(task->input != NULL && task->input->cache != NULL) {
+		holdPulls(task->input);
+		queued->filter = stepThread;
+		queued->filterParams = task;
+	} else if(task->thread) {
+		queued->filter = stepThread;
+		queued->filterParams = task;
+	} else {
+		return;
+	}
+
+	if(task->input != NULL)
+		task->input->task = NULL;
+	if(task->output != NULL)
+		task->output->producer = NULL;
+	queued->task = NULL;
+}
+
+/******************************************************************************
+ * All filters have finished their startup: drop the ones nothing uses, fuse  *
+ * the ones that can be fused, place them on NUMA nodes, size the buffers     *
+ * between them, then go through the queue and create a pthread for every     *
+ * filter that is not a task. The tasks are handed to the scheduler. The      *
+ * pixel kernels for this CPU are picked first, while nothing is running.     *
  *****************************************************************************/
 void mkvsynthSpawn() {
-	MkvsynthFilterQueue *current = head;
-	while(current != NULL) {
-		pthread_create(&current->thread, NULL, current->filter, current->filterParams);
-		current = current->next;
+	setupKernels();
+	pruneFilters(head);
+	fuseFilters(head);
+	placeFilters(head, pinThreads);
+	allocateBuffers(bufferMemory);
+	startFilterStats();
+	startTrace();
+
+	int taskCount = 0;
+	MkvsynthFilterQueue *current;
+	for(current = head; current != NULL; current = current->next) {
+		if(current->task != NULL)
+			mkvsynthPull(current);
 	}
+
+	for(current = head; current != NULL; current = current->next) {
+		if(current->task != NULL)
+			taskCount++;
+		if(current->task != NULL || current->filter != NULL)
+			atomic_fetch_add(&current->stats->running, 1);
+	}
+
+	MkvsynthTask **tasks = malloc(taskCount * sizeof(MkvsynthTask *));
+	taskCount = 0;
+
+	for(current = head; current != NULL; current = current->next) {
+		if(current->task != NULL)
+			tasks[taskCount++] = current->task;
+	}
+
+	// The workers have to exist before a pthread can put a frame into a task
+	startTasks(tasks, taskCount);
+	free(tasks);
+
+	for(current = head; current != NULL; current = current->next) {
+		if(current->task == NULL && current->filter != NULL)
+			pthread_create(&current->thread, NULL, filterThread, current);
+	}
+
+	startAdvisor(advisorInterval);
 }
 
 /******************************************************************************
- * This is just to make sure that all pthreads finish normally                *
+ * This is just to make sure that all pthreads and tasks finish normally      *
  *****************************************************************************/
 void mkvsynthJoin() {
 	MkvsynthFilterQueue *current = head;
@@ -51,10 +298,15 @@ void mkvsynthJoin() {
 	void *retval;
 
 	while(current != NULL) {
-		pthread_join(current->thread, &retval);
+		if(current->task == NULL && current->filter != NULL)
+			pthread_join(current->thread, &retval);
 		current = current->next;
 	}
 
+	waitForTasks();
+	stopAdvisor();
+	writeTrace();
+
 	while(current != NULL) {
 		prev = current;
 		current = current->next;
@@ -76,7 +328,84 @@ Value go_AST(argList *a) {
 		MkvsynthMessage("All filters are running");
 		mkvsynthJoin();
 		MkvsynthMessage("All filters have completed");
+		printFilterStats(statsFile);
+		finishSegments();
 	}
 
 	RETURNNULL();
 }
+
+/******************************************************************************
+ * setBufferMemory sets how much memory (in MB) the buffers between filters   *
+ * may use in total. It has to be called before go(), and applies to every    *
+ * buffer that has not been given a depth with the 'buffer' argument.         *
+ *****************************************************************************/
+Value setBufferMemory_AST(argList *a) {
+	checkArgs(a, 1, typeNum);
+	double megabytes = MANDNUM(0);
+
+	if(megabytes <= 0)
+		MkvsynthError("buffer memory must be greater than 0 MB");
+
+	bufferMemory = megabytes * 1024 * 1024;
+	RETURNNULL();
+}
+
+/******************************************************************************
+ * setStatsFile makes go() write the filter statistics that it prints at the  *
+ * end to a file as well, as JSON, so that they can be compared between runs  *
+ * or read by other tools.                                                    *
+ *****************************************************************************/
+Value setStatsFile_AST(argList *a) {
+	checkArgs(a, 1, typeStr);
+
+	free(statsFile);
+	statsFile = strdup(MANDSTR(0));
+	RETURNNULL();
+}
+
+/******************************************************************************
+ * setAdvisorInterval sets how often (in seconds) the advisor reports which   *
+ * filter is holding the script back while go() is running. 0 switches the   *
+ * advisor off.                                                               *
+ *****************************************************************************/
+Value setAdvisorInterval_AST(argList *a) {
+	checkArgs(a, 1, typeNum);
+	double seconds = MANDNUM(0);
+
+	if(seconds < 0)
+		MkvsynthError("the advisor interval can not be negative");
+
+	advisorInterval = seconds;
+	RETURNNULL();
+}
+
+/******************************************************************************
+ * setAffinity pins every worker to a core of its own, and keeps every chain  *
+ * of filters on a single NUMA node, see placeFilters(). It has to be called  *
+ * before go(). It helps the most on machines with more than one socket, and  *
+ * is off by default because it gets in the way of anything else running on   *
+ * the same cores.                                                            *
+ *****************************************************************************/
+Value setAffinity_AST(argList *a) {
+	checkArgs(a, 1, typeBool);
+
+	pinThreads = MANDBOOL(0);
+	RETURNNULL();
+}
+
+/******************************************************************************
+ * setThreads sets the thread budget, the most threads the script may keep    *
+ * busy, see setThreadBudget(). It does the same as the --threads option, and *
+ * has to come before the filters that should stick to it.                    *
+ *****************************************************************************/
+Value setThreads_AST(argList *a) {
+	checkArgs(a, 1, typeNum);
+	double threads = MANDNUM(0);
+
+	if(threads < 1)
+		MkvsynthError("the thread budget must be at least 1 thread");
+
+	setThreadBudget(threads);
+	RETURNNULL();
+}
@@ -1,5 +1,10 @@
 #include "jarvis.h"
 
+int filterThreads();
 void mkvsynthQueue(void *filterParams, void *(*filter) (void *));
+void mkvsynthQueueTask(void *filterParams, MkvsynthTaskStep step, MkvsynthInput *input, MkvsynthOutput *output);
+void mkvsynthQueueRender(MkvsynthOutput *output, MkvsynthFrameRender render);
+void mkvsynthQueueRows(MkvsynthOutput *output, MkvsynthRowKernel kernel);
+void mkvsynthQueueThread(MkvsynthOutput *output);
 void mkvsynthSpawn();
 void mkvsynthJoin();
@@ -0,0 +1,521 @@
+#include "threadPool.h"
+#include <unistd.h>
+
+/******************************************************************************
+ * The scheduler has one worker per core, shared by every filter in the       *
+ * script. Workers run tasks (filters that were queued with                   *
+ * mkvsynthQueueTask) one frame at a time, and chunks of rows for             *
+ * processRows(). Filters that were queued with mkvsynthQueue still get a     *
+ * pthread of their own, because they block inside getFrame() and putFrame(), *
+ * and a blocked worker could end up waiting on a task that has no worker     *
+ * left to run it.                                                            *
+ *                                                                            *
+ * The workers are started the first time they are needed and never exit.     *
+ * There are as many of them as the thread budget allows, see setThreadBudget. *
+ *****************************************************************************/
+static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+static MkvsynthWorker *workers = NULL;
+static int workerCount = 0;
+static _Thread_local MkvsynthWorker *currentWorker = NULL;
+static atomic_uint nextWorker;
+
+/******************************************************************************
+ * poolLock protects the list of row jobs and is what idle workers sleep on.  *
+ * 'sleepers' lets threads that add work skip the lock when every worker is   *
+ * already busy.                                                              *
+ *****************************************************************************/
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolWork = PTHREAD_COND_INITIALIZER;
+static atomic_int sleepers;
+static MkvsynthRowJob *jobs = NULL;
+static atomic_int rowJobs;
+
+// The most threads the script may use, 0 for one per core
+static int budget = 0;
+
+// The number of tasks that have not finished yet, see waitForTasks()
+static atomic_int tasksRemaining;
+static pthread_cond_t tasksFinished = PTHREAD_COND_INITIALIZER;
+
+static void wakeWorker() {
+	if(atomic_load(&sleepers) > 0) {
+		pthread_mutex_lock(&poolLock);
+		pthread_cond_signal(&poolWork);
+		pthread_mutex_unlock(&poolLock);
+	}
+}
+
+// Returns the next worker in turn on 'node', or the next worker in turn on any node for -1
+static MkvsynthWorker *spreadWorker(int node) {
+	unsigned int start = atomic_fetch_add(&nextWorker, 1);
+
+	int i;
+	for(i = 0; i < workerCount && node >= 0; i++) {
+		MkvsynthWorker *worker = &workers[(start + i) % workerCount];
+		if(worker->node == node)
+			return worker;
+	}
+
+	return &workers[start % workerCount];
+}
+
+/******************************************************************************
+ * The deque functions. pushTask() puts a task on the deque of the calling    *
+ * worker, or spreads tasks over the workers if it is not called from a       *
+ * worker. A task that belongs to a node always goes to a worker on that      *
+ * node. popTask() takes the newest task of a worker's own deque, and         *
+ * stealTask() takes the oldest task of another worker's deque, looking at    *
+ * the workers on its own node before the others.                             *
+ *****************************************************************************/
+static void pushTask(MkvsynthTask *task) {
+	MkvsynthWorker *worker = currentWorker;
+	if(worker == NULL || (task->node >= 0 && worker->node != task->node))
+		worker = spreadWorker(task->node);
+
+	pthread_mutex_lock(&worker->lock);
+	if(worker->count == worker->capacity) {
+		int newCapacity = worker->capacity * 2;
+		MkvsynthTask **newTasks = malloc(newCapacity * sizeof(MkvsynthTask *));
+
+		int i;
+		for(i = 0; i < worker->count; i++)
+			newTasks[i] = worker->tasks[(worker->head + i) % worker->capacity];
+
+		free(worker->tasks);
+		worker->tasks = newTasks;
+		worker->capacity = newCapacity;
+		worker->head = 0;
+	}
+
+	worker->tasks[(worker->head + worker->count) % worker->capacity] = task;
+	worker->count++;
+	pthread_mutex_unlock(&worker->lock);
+
+	wakeWorker();
+}
+
+static MkvsynthTask *popTask(MkvsynthWorker *worker) {
+	MkvsynthTask *task = NULL;
+
+	pthread_mutex_lock(&worker->lock);
+	if(worker->count > 0) {
+		worker->count--;
+		task = worker->tasks[(worker->head + worker->count) % worker->capacity];
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	return task;
+}
+
+static MkvsynthTask *stealTask(MkvsynthWorker *thief) {
+	MkvsynthTask *task = NULL;
+
+	int local, i;
+	for(local = 1; local >= 0 && task == NULL; local--) {
+		for(i = 1; i < workerCount && task == NULL; i++) {
+			MkvsynthWorker *victim = &workers[(thief - workers + i) % workerCount];
+			if((victim->node == thief->node) != local)
+				continue;
+
+			pthread_mutex_lock(&victim->lock);
+			if(victim->count > 0) {
+				task = victim->tasks[victim->head];
+				victim->head = (victim->head + 1) % victim->capacity;
+				victim->count--;
+			}
+			pthread_mutex_unlock(&victim->lock);
+		}
+	}
+
+	return task;
+}
+
+static int tasksWaiting() {
+	int i, waiting = 0;
+	for(i = 0; i < workerCount; i++) {
+		pthread_mutex_lock(&workers[i].lock);
+		waiting += workers[i].count;
+		pthread_mutex_unlock(&workers[i].lock);
+	}
+
+	return waiting;
+}
+
+/******************************************************************************
+ * A task is ready when the step can run without blocking: there is a frame   *
+ * in the input (or the final frame, which never goes away) and the next      *
+ * slot in the output is free. An output that nobody reads from is always     *
+ * free, because putFrame() just drops the payload.                           *
+ *                                                                            *
+ * Only the task itself reads from its input and writes to its output, so a   *
+ * task that is ready stays ready until it runs. The other way around is not  *
+ * true: a poke can see the task as idle, and by the time it checks whether   *
+ * the task is ready the task may have run and gone idle again, so the poke   *
+ * was looking at a task in the middle of a step. runTask() checks again.     *
+ *****************************************************************************/
+static int taskReady(MkvsynthTask *task) {
+	MkvsynthInput *input = task->input;
+	if(input != NULL) {
+		unsigned int framesRead = atomic_load(&input->framesRead);
+		if(atomic_load(&input->output->framesWritten) == framesRead)
+			return 0;
+	}
+
+	MkvsynthOutput *output = task->output;
+	if(output != NULL && output->outputBreadth > 0) {
+		unsigned long long nextFrame = atomic_load_explicit(&output->nextFrame, memory_order_relaxed);
+		MkvsynthFrame *slot = &output->frames[nextFrame % output->bufferDepth];
+		if(atomic_load(&slot->filtersRemaining) != 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+// 1 if the task is waiting for its output, 0 if it is waiting for its input
+static int taskWaiting(MkvsynthTask *task) {
+	MkvsynthInput *input = task->input;
+	if(input != NULL) {
+		unsigned int framesRead = atomic_load(&input->framesRead);
+		if(atomic_load(&input->output->framesWritten) == framesRead)
+			return 0;
+	}
+
+	return 1;
+}
+
+/******************************************************************************
+ * pokeTask is called whenever something happens that might make a task       *
+ * ready: a frame was put into its input, or a slot in its output was freed.  *
+ * An idle task that is ready gets queued. A task that is already queued is   *
+ * marked dirty, so that the worker running it checks whether it is ready     *
+ * again before letting it go idle, which means that a poke is never lost.    *
+ *****************************************************************************/
+void pokeTask(MkvsynthTask *task) {
+	int state = atomic_load(&task->state);
+	while(1) {
+		if(state == TASK_IDLE) {
+			if(!taskReady(task))
+				return;
+			if(atomic_compare_exchange_weak(&task->state, &state, TASK_QUEUED)) {
+				recordWait(task->stats, atomic_load(&task->idleReason), atomic_load(&task->idleSince));
+				pushTask(task);
+				return;
+			}
+		} else if(state == TASK_QUEUED) {
+			if(atomic_compare_exchange_weak(&task->state, &state, TASK_DIRTY))
+				return;
+		} else {
+			return;
+		}
+	}
+}
+
+/******************************************************************************
+ * runTask() processes a single frame of a task. If the task is still ready   *
+ * afterwards it goes back onto the deque, where it will usually be picked up *
+ * again by the same worker; other workers can steal it in the meantime.      *
+ *****************************************************************************/
+static void runTask(MkvsynthTask *task) {
+	int finished = 0;
+	if(taskReady(task)) {
+		unsigned long long started = traceStart();
+		MkvsynthFilterStats *previous = enterFilter(task->stats);
+		finished = task->step(task->filterParams) == 0;
+		leaveFilter(previous);
+		traceEvent(task->stats->name, "filter", started);
+	}
+
+	if(finished) {
+		atomic_store(&task->state, TASK_FINISHED);
+		atomic_fetch_sub(&task->stats->running, 1);
+		if(atomic_fetch_sub(&tasksRemaining, 1) == 1) {
+			pthread_mutex_lock(&poolLock);
+			pthread_cond_broadcast(&tasksFinished);
+			pthread_mutex_unlock(&poolLock);
+		}
+		return;
+	}
+
+	while(1) {
+		atomic_store(&task->state, TASK_QUEUED);
+		if(taskReady(task)) {
+			pushTask(task);
+			return;
+		}
+
+		atomic_store(&task->idleReason, taskWaiting(task));
+		atomic_store(&task->idleSince, statsClock());
+
+		int state = TASK_QUEUED;
+		if(atomic_compare_exchange_strong(&task->state, &state, TASK_IDLE))
+			return;
+	}
+}
+
+/******************************************************************************
+ * runChunk() hands out the next chunk of 'job' and runs the kernel on it.    *
+ * It has to be called with the pool lock held, and returns with the lock     *
+ * held. The job is taken off the list once every chunk has been handed out,  *
+ * and the filter waiting on the job is woken up once every chunk is done.    *
+ *****************************************************************************/
+static void runChunk(MkvsynthRowJob *job) {
+	int firstRow = job->nextRow;
+	int lastRow = firstRow + job->rowsPerChunk;
+	if(lastRow > job->rows)
+		lastRow = job->rows;
+	job->nextRow = lastRow;
+
+	if(job->nextRow == job->rows) {
+		MkvsynthRowJob **link = &jobs;
+		while(*link != job)
+			link = &(*link)->next;
+		*link = job->next;
+		atomic_fetch_sub(&rowJobs, 1);
+	}
+
+	pthread_mutex_unlock(&poolLock);
+	unsigned long long started = traceStart();
+	MkvsynthFilterStats *previous = enterFilter(job->stats);
+	job->kernel(job->filterParams, job->input, job->output, firstRow, lastRow);
+	leaveFilter(previous);
+	traceEvent(job->stats != NULL ? job->stats->name : "rows", "rows", started);
+	pthread_mutex_lock(&poolLock);
+
+	job->rowsDone += lastRow - firstRow;
+	if(job->rowsDone == job->rows)
+		pthread_cond_signal(&job->finished);
+}
+
+// Returns the first job that 'worker' may help with, has to be called with the pool lock held
+static MkvsynthRowJob *nodeJob(MkvsynthWorker *worker) {
+	MkvsynthRowJob *job;
+	for(job = jobs; job != NULL; job = job->next) {
+		if(job->working >= job->threads)
+			continue;
+		if(job->node < 0 || job->node == worker->node)
+			return job;
+	}
+
+	return NULL;
+}
+
+/******************************************************************************
+ * Rows come first, because a filter is waiting on them and every other       *
+ * filter downstream is waiting on that filter. Then the worker's own tasks,  *
+ * then other workers' tasks. If there is nothing to do at all, the worker    *
+ * sleeps until somebody adds work. Workers leave the rows of frames on other *
+ * NUMA nodes alone, reading them would be slower than not helping at all.    *
+ *****************************************************************************/
+static void *workerThread(void *worker) {
+	currentWorker = (MkvsynthWorker *)worker;
+	pinWorker(currentWorker - workers);
+	traceThreadName("worker");
+
+	while(1) {
+		if(atomic_load(&rowJobs) > 0) {
+			pthread_mutex_lock(&poolLock);
+			MkvsynthRowJob *job = nodeJob(currentWorker);
+			if(job != NULL) {
+				job->working++;
+				runChunk(job);
+				job->working--;
+			}
+			pthread_mutex_unlock(&poolLock);
+			if(job != NULL)
+				continue;
+		}
+
+		MkvsynthTask *task = popTask(currentWorker);
+		if(task == NULL)
+			task = stealTask(currentWorker);
+		if(task != NULL) {
+			runTask(task);
+			continue;
+		}
+
+		pthread_mutex_lock(&poolLock);
+		atomic_fetch_add(&sleepers, 1);
+		if(nodeJob(currentWorker) == NULL && tasksWaiting() == 0)
+			pthread_cond_wait(&poolWork, &poolLock);
+		atomic_fetch_sub(&sleepers, 1);
+		pthread_mutex_unlock(&poolLock);
+	}
+
+	return NULL;
+}
+
+static void startPool() {
+	workerCount = threadBudget();
+
+	workers = malloc(workerCount * sizeof(MkvsynthWorker));
+
+	int i;
+	for(i = 0; i < workerCount; i++) {
+		pthread_mutex_init(&workers[i].lock, NULL);
+		workers[i].node = workerNode(i);
+		workers[i].capacity = 16;
+		workers[i].tasks = malloc(workers[i].capacity * sizeof(MkvsynthTask *));
+		workers[i].head = 0;
+		workers[i].count = 0;
+	}
+
+	for(i = 0; i < workerCount; i++) {
+		pthread_create(&workers[i].thread, NULL, workerThread, &workers[i]);
+		pthread_detach(workers[i].thread);
+	}
+}
+
+/******************************************************************************
+ * Also see MkvsynthTask                                                      *
+ *                                                                            *
+ * startTasks hands the tasks to the workers. Every task gets poked once, so  *
+ * the tasks that are ready straight away (the sources) start running.        *
+ * waitForTasks returns once every task has finished.                         *
+ *****************************************************************************/
+void startTasks(MkvsynthTask **tasks, int count) {
+	pthread_once(&poolOnce, startPool);
+
+	atomic_fetch_add(&tasksRemaining, count);
+
+	int i;
+	for(i = 0; i < count; i++) {
+		atomic_store(&tasks[i]->idleReason, taskWaiting(tasks[i]));
+		atomic_store(&tasks[i]->idleSince, statsClock());
+	}
+
+	for(i = 0; i < count; i++)
+		pokeTask(tasks[i]);
+}
+
+/******************************************************************************
+ * Also see filterThreads() and setThreads_AST                                *
+ *                                                                            *
+ * The thread budget is the most threads a script may keep busy: the number   *
+ * of workers, and of threads a decoder or encoder may start. Without a       *
+ * budget there is one of each per core. Several scripts running side by side *
+ * should split the cores between them, or they will all fight over every     *
+ * core. The budget has to be set before the workers start, which is the      *
+ * first time go() is called.                                                 *
+ *****************************************************************************/
+void setThreadBudget(int threads) {
+	budget = threads;
+}
+
+// Returns the thread budget, or the number of cores if no budget was set
+int threadBudget() {
+	if(budget > 0)
+		return budget;
+
+	int cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores < 1 ? 1 : cores;
+}
+
+// Returns 1 if the script set a thread budget
+int threadBudgetSet() {
+	return budget > 0;
+}
+
+void waitForTasks() {
+	pthread_mutex_lock(&poolLock);
+	while(atomic_load(&tasksRemaining) > 0)
+		pthread_cond_wait(&tasksFinished, &poolLock);
+	pthread_mutex_unlock(&poolLock);
+}
+
+/******************************************************************************
+ * Also see MkvsynthRowJob                                                    *
+ *                                                                            *
+ * processRows splits the rows of a frame between the workers and the calling *
+ * filter, and returns once every row has been processed. 'metaData'          *
+ * describes the frame whose rows are being produced (normally the output),   *
+ * and 'kernel' is called with ranges of rows from that frame.                *
+ *                                                                            *
+ * The kernel may be running on several threads at once, so it must not       *
+ * write to anything outside of the rows that it was given. 'input' and       *
+ * 'output' are passed straight through to the kernel, either can be NULL.    *
+ *                                                                            *
+ * The rows are split into a few chunks per thread, so that a worker that is  *
+ * busy with another filter does not hold up the whole frame. A filter that   *
+ * was given a 'threads' argument never has more threads than that working on *
+ * its rows. On a single core machine, or for a filter that may only use one  *
+ * thread, the kernel is just called for the whole frame.                     *
+ *                                                                            *
+ * Chunks always start on an even row, so that the two rows sharing the Cb    *
+ * and Cr samples of a 4:2:0 frame are given to the same kernel call.         *
+ *****************************************************************************/
+void processRows(MkvsynthRowKernel kernel, void *filterParams, uint8_t *input, uint8_t *output, MkvsynthMetaData *metaData) {
+	pthread_once(&poolOnce, startPool);
+
+	MkvsynthFilterStats *stats = currentFilterStats();
+	int threads = workerCount;
+	if(stats != NULL && stats->threads > 0 && stats->threads < threads)
+		threads = stats->threads;
+
+	int rows = metaData->height;
+	if(threads < 2 || rows < 2) {
+		kernel(filterParams, input, output, 0, rows);
+		return;
+	}
+
+	MkvsynthRowJob job;
+	job.kernel = kernel;
+	job.filterParams = filterParams;
+	job.input = input;
+	job.output = output;
+	job.rows = rows;
+	job.rowsPerChunk = rows / (threads * 4) & ~1;
+	if(job.rowsPerChunk < 2)
+		job.rowsPerChunk = 2;
+	job.nextRow = 0;
+	job.rowsDone = 0;
+	job.stats = stats;
+	job.node = threadNode();
+	job.threads = threads;
+	job.working = 1;
+	pthread_cond_init(&job.finished, NULL);
+
+	pthread_mutex_lock(&poolLock);
+	job.next = jobs;
+	jobs = &job;
+	atomic_fetch_add(&rowJobs, 1);
+	pthread_cond_broadcast(&poolWork);
+
+	while(job.nextRow < job.rows)
+		runChunk(&job);
+	while(job.rowsDone < job.rows)
+		pthread_cond_wait(&job.finished, &poolLock);
+	pthread_mutex_unlock(&poolLock);
+
+	pthread_cond_destroy(&job.finished);
+}
+
+/******************************************************************************
+ * rowScratch returns at least 'bytes' bytes for a row kernel to work in, so  *
+ * that kernels do not have to allocate memory every time they are called.    *
+ * Every thread has a buffer of its own, which only ever grows, so kernels    *
+ * running on several workers at once never share one. The buffer is only     *
+ * the kernel's until it returns: in a fused chain, the next kernel on the    *
+ * same thread gets the same buffer.                                          *
+ *****************************************************************************/
+static _Thread_local void *scratch = NULL;
+static _Thread_local size_t scratchBytes = 0;
+
+void *rowScratch(size_t bytes) {
+	if(bytes > scratchBytes) {
+		free(scratch);
+		scratch = malloc(bytes);
+		if(scratch == NULL)
+			MkvsynthError("could not allocate %zu bytes to work on a row in", bytes);
+		scratchBytes = bytes;
+	}
+
+	return scratch;
+}
+
+// Frees the buffer of a thread that is about to exit, see rowScratch()
+void freeRowScratch() {
+	free(scratch);
+	scratch = NULL;
+	scratchBytes = 0;
+}
@@ -0,0 +1,11 @@
+#include "jarvis.h"
+
+void pokeTask(MkvsynthTask *task);
+void startTasks(MkvsynthTask **tasks, int count);
+void waitForTasks();
+void setThreadBudget(int threads);
+int threadBudget();
+int threadBudgetSet();
+void processRows(MkvsynthRowKernel kernel, void *filterParams, uint8_t *input, uint8_t *output, MkvsynthMetaData *metaData);
+void *rowScratch(size_t bytes);
+void freeRowScratch();
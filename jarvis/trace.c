@@ -0,0 +1,121 @@
+#include "trace.h"
+#include <stdio.h>
+
+/******************************************************************************
+ * Also see MkvsynthTraceBuffer                                               *
+ *                                                                            *
+ * Tracing is switched on by setting MKVSYNTH_TRACE to the name of a file.    *
+ * When mkvsynthJoin() returns, every event recorded so far is written to     *
+ * that file in the Chrome trace format, which can be opened in               *
+ * chrome://tracing or ui.perfetto.dev. Each thread shows up as a row, and    *
+ * the frame functions show up nested inside the frames the filters work on,  *
+ * so a filter waiting in getFrame() or putFrame() is easy to spot.           *
+ *                                                                            *
+ * With tracing switched off, the only cost is checking traceFile.            *
+ *****************************************************************************/
+static char const *traceFile = NULL;
+static unsigned long long traceOrigin = 0;
+static _Atomic(MkvsynthTraceBuffer *) traceBuffers = NULL;
+static atomic_int traceThreads;
+static _Thread_local MkvsynthTraceBuffer *threadBuffer = NULL;
+static _Thread_local char const *threadName = NULL;
+
+void startTrace() {
+	traceFile = getenv("MKVSYNTH_TRACE");
+	if(traceFile != NULL && traceFile[0] == '\0')
+		traceFile = NULL;
+
+	if(traceFile != NULL && traceOrigin == 0)
+		traceOrigin = statsClock();
+}
+
+// Returns the time an event starts at, or 0 when tracing is switched off
+unsigned long long traceStart() {
+	if(traceFile == NULL)
+		return 0;
+
+	return statsClock();
+}
+
+static MkvsynthTraceBuffer *createTraceBuffer() {
+	MkvsynthTraceBuffer *buffer = malloc(sizeof(MkvsynthTraceBuffer));
+	buffer->thread = atomic_fetch_add(&traceThreads, 1) + 1;
+	buffer->name = threadName;
+	buffer->blocks = NULL;
+	buffer->count = 0;
+
+	buffer->next = atomic_load(&traceBuffers);
+	while(!atomic_compare_exchange_weak(&traceBuffers, &buffer->next, buffer));
+
+	return buffer;
+}
+
+/******************************************************************************
+ * traceEvent records an event that started at 'started' (from traceStart())  *
+ * and ends now. 'name' and 'category' have to stay around until the trace    *
+ * is written, so they are normally string constants or filter names.         *
+ *****************************************************************************/
+void traceEvent(char const *name, char const *category, unsigned long long started) {
+	if(started == 0)
+		return;
+
+	if(threadBuffer == NULL)
+		threadBuffer = createTraceBuffer();
+
+	MkvsynthTraceBuffer *buffer = threadBuffer;
+	if(buffer->count % MKVSYNTH_TRACE_BLOCK == 0) {
+		int blocks = buffer->count / MKVSYNTH_TRACE_BLOCK;
+		buffer->blocks = realloc(buffer->blocks, (blocks + 1) * sizeof(MkvsynthTraceEvent *));
+		buffer->blocks[blocks] = malloc(MKVSYNTH_TRACE_BLOCK * sizeof(MkvsynthTraceEvent));
+	}
+
+	MkvsynthTraceEvent *event = &buffer->blocks[buffer->count / MKVSYNTH_TRACE_BLOCK][buffer->count % MKVSYNTH_TRACE_BLOCK];
+	event->name = name;
+	event->category = category;
+	event->started = started;
+	event->duration = statsClock() - started;
+	buffer->count++;
+}
+
+// Names the calling thread in the trace
+void traceThreadName(char const *name) {
+	threadName = name;
+	if(threadBuffer != NULL)
+		threadBuffer->name = name;
+}
+
+/******************************************************************************
+ * writeTrace is called once every filter has finished, so no thread is       *
+ * adding events while they are being written. Timestamps are in              *
+ * microseconds since tracing started, which is what the format expects.      *
+ *****************************************************************************/
+void writeTrace() {
+	if(traceFile == NULL)
+		return;
+
+	FILE *file = fopen(traceFile, "w");
+	if(file == NULL) {
+		MkvsynthWarning("could not open %s, the trace was not written", traceFile);
+		return;
+	}
+
+	fprintf(file, "{\"traceEvents\": [\n");
+	fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"mkvsynth\"}}");
+
+	MkvsynthTraceBuffer *buffer;
+	for(buffer = atomic_load(&traceBuffers); buffer != NULL; buffer = buffer->next) {
+		if(buffer->name != NULL)
+			fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %i, \"args\": {\"name\": \"%s\"}}", buffer->thread, buffer->name);
+
+		int i;
+		for(i = 0; i < buffer->count; i++) {
+			MkvsynthTraceEvent *event = &buffer->blocks[i / MKVSYNTH_TRACE_BLOCK][i % MKVSYNTH_TRACE_BLOCK];
+			fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %i, \"ts\": %.3f, \"dur\": %.3f}",
+			        event->name, event->category, buffer->thread,
+			        (event->started - traceOrigin) / 1e3, event->duration / 1e3);
+		}
+	}
+
+	fprintf(file, "\n]}\n");
+	fclose(file);
+}
@@ -0,0 +1,7 @@
+#include "jarvis.h"
+
+void startTrace();
+unsigned long long traceStart();
+void traceEvent(char const *name, char const *category, unsigned long long started);
+void traceThreadName(char const *name);
+void writeTrace();
@@ -0,0 +1,301 @@
+/******************************************************************************
+ * Measures how long it takes Jarvis to hand a frame from one filter to the   *
+ * next. A producer thread puts tiny frames into an output as fast as it can  *
+ * and 1 or more consumer threads read them back out with getReadOnlyFrame()  *
+ * and clearReadOnlyFrame(). The frames are tiny so that the time measured is *
+ * almost entirely spent in putFrame(), getReadOnlyFrame() and                *
+ * clearReadOnlyFrame().                                                      *
+ *                                                                            *
+ * The same handoff is also run through the buffer Jarvis had before the      *
+ * ring (see the legacy functions below), so that both columns come from the  *
+ * same binary on the same machine.                                           *
+ *                                                                            *
+ * Build and run with 'make benchmark'.                                       *
+ *****************************************************************************/
+
+#include "../jarvis/affinity.c"
+#include "../jarvis/advisor.c"
+#include "../jarvis/bufferAllocation.c"
+#include "../jarvis/filterStats.c"
+#include "../jarvis/trace.c"
+#include "../jarvis/frameCache.c"
+#include "../jarvis/frameControl.c"
+#include "../jarvis/threadPool.c"
+#include "../colorspacing/properties.c"
+#include <semaphore.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define BENCHMARK_FRAMES 200000
+
+// createOutputBuffer() looks for a 'buffer' argument, but there is no script
+argList *currentArgs = NULL;
+
+void *getOptArg(argList const *a, char const *name, valueType type) {
+	return NULL;
+}
+
+void MkvsynthError(char const *error, ...) {
+	va_list arglist;
+	va_start(arglist, error);
+	vfprintf(stderr, error, arglist);
+	va_end(arglist);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+void MkvsynthMessage(char const *message, ...) {
+	va_list arglist;
+	va_start(arglist, message);
+	vfprintf(stdout, message, arglist);
+	va_end(arglist);
+	fprintf(stdout, "\n");
+}
+
+void MkvsynthWarning(char const *warning, ...) {
+	va_list arglist;
+	va_start(arglist, warning);
+	vfprintf(stderr, warning, arglist);
+	va_end(arglist);
+	fprintf(stderr, "\n");
+}
+
+void *benchmarkProducer(void *filterParams) {
+	MkvsynthOutput *output = (MkvsynthOutput *)filterParams;
+
+	int i;
+	for(i = 0; i < BENCHMARK_FRAMES; i++)
+		putFrame(output, getPayload(output));
+
+	putFrame(output, NULL);
+	return NULL;
+}
+
+void *benchmarkConsumer(void *filterParams) {
+	MkvsynthInput *input = (MkvsynthInput *)filterParams;
+
+	MkvsynthFrame *workingFrame = getReadOnlyFrame(input);
+	while(workingFrame->payload != NULL) {
+		clearReadOnlyFrame(workingFrame);
+		workingFrame = getReadOnlyFrame(input);
+	}
+
+	return NULL;
+}
+
+/******************************************************************************
+ * The buffer as it was before MkvsynthOutput had a ring: a linked list of    *
+ * frames, each with a mutex of its own and a malloc()'d shell, and a pair of *
+ * semaphores per input that the output waits on and posts one by one. Only   *
+ * the read only path is kept, the way the old getReadOnlyFrame(), putFrame() *
+ * and clearReadOnlyFrame() did it. The semaphores are set up as the old      *
+ * createInputBuffer() did, for a depth of MKVSYNTH_BUFFER_DEPTH, except that *
+ * both are private to the process: the old code asked for a shared one by    *
+ * mistake. clearReadOnlyFrame() used to count down outside the lock, which   *
+ * races once there are several consumers, so here it counts down inside the  *
+ * lock. The payloads come from the same pool as for the ring.                *
+ *****************************************************************************/
+typedef struct LegacyFrame LegacyFrame;
+typedef struct LegacySemaphoreList LegacySemaphoreList;
+
+struct LegacyFrame {
+	uint8_t *payload;
+	int filtersRemaining;
+	pthread_mutex_t lock;
+	LegacyFrame *nextFrame;
+};
+
+struct LegacySemaphoreList {
+	sem_t remainingBuffer;
+	sem_t consumedBuffer;
+	LegacySemaphoreList *next;
+};
+
+typedef struct {
+	int outputBreadth;
+	LegacySemaphoreList *semaphores;
+	LegacyFrame *recentFrame;
+	MkvsynthOutput *pool;
+} LegacyOutput;
+
+typedef struct {
+	sem_t *remainingBuffer;
+	sem_t *consumedBuffer;
+	LegacyFrame *currentFrame;
+} LegacyInput;
+
+LegacyInput *legacyCreateInputBuffer(LegacyOutput *output) {
+	LegacyInput *input = malloc(sizeof(LegacyInput));
+
+	LegacySemaphoreList **tail = &output->semaphores;
+	while(*tail != NULL)
+		tail = &(*tail)->next;
+
+	*tail = malloc(sizeof(LegacySemaphoreList));
+	(*tail)->next = NULL;
+	output->outputBreadth++;
+
+	input->remainingBuffer = &(*tail)->remainingBuffer;
+	input->consumedBuffer = &(*tail)->consumedBuffer;
+	sem_init(input->remainingBuffer, 0, 0);
+	sem_init(input->consumedBuffer, 0, MKVSYNTH_BUFFER_DEPTH);
+
+	input->currentFrame = output->recentFrame;
+	return input;
+}
+
+void legacyPutFrame(LegacyOutput *params, uint8_t *payload) {
+	int i;
+	LegacySemaphoreList *tmp = params->semaphores;
+	for(i = 0; i < params->outputBreadth; i++) {
+		sem_wait(&tmp->consumedBuffer);
+		tmp = tmp->next;
+	}
+
+	params->recentFrame->payload = payload;
+	params->recentFrame->filtersRemaining = params->outputBreadth;
+	pthread_mutex_init(&params->recentFrame->lock, NULL);
+
+	LegacyFrame *newFrame = malloc(sizeof(LegacyFrame));
+	newFrame->nextFrame = NULL;
+	params->recentFrame->nextFrame = newFrame;
+	params->recentFrame = newFrame;
+
+	tmp = params->semaphores;
+	for(i = 0; i < params->outputBreadth; i++) {
+		sem_post(&tmp->remainingBuffer);
+		tmp = tmp->next;
+	}
+}
+
+LegacyFrame *legacyGetReadOnlyFrame(LegacyInput *params) {
+	sem_wait(params->remainingBuffer);
+
+	LegacyFrame *newFrame = params->currentFrame;
+	params->currentFrame = params->currentFrame->nextFrame;
+
+	sem_post(params->consumedBuffer);
+	return newFrame;
+}
+
+void legacyClearReadOnlyFrame(LegacyFrame *usedFrame) {
+	pthread_mutex_lock(&usedFrame->lock);
+	if(usedFrame->filtersRemaining <= 1) {
+		pthread_mutex_unlock(&usedFrame->lock);
+		clearPayload(usedFrame->payload);
+		pthread_mutex_destroy(&usedFrame->lock);
+		free(usedFrame);
+	} else {
+		usedFrame->filtersRemaining--;
+		pthread_mutex_unlock(&usedFrame->lock);
+	}
+}
+
+void *legacyProducer(void *filterParams) {
+	LegacyOutput *output = (LegacyOutput *)filterParams;
+
+	int i;
+	for(i = 0; i < BENCHMARK_FRAMES; i++)
+		legacyPutFrame(output, getPayload(output->pool));
+
+	legacyPutFrame(output, NULL);
+	return NULL;
+}
+
+void *legacyConsumer(void *filterParams) {
+	LegacyInput *input = (LegacyInput *)filterParams;
+
+	LegacyFrame *workingFrame = legacyGetReadOnlyFrame(input);
+	while(workingFrame->payload != NULL) {
+		legacyClearReadOnlyFrame(workingFrame);
+		workingFrame = legacyGetReadOnlyFrame(input);
+	}
+
+	return NULL;
+}
+
+// Creates an output of tiny frames, for either kind of buffer
+MkvsynthOutput *benchmarkOutput() {
+	MkvsynthOutput *output = createOutputBuffer();
+	output->metaData->colorspace = MKVS_RGB24;
+	output->metaData->width = 4;
+	output->metaData->height = 4;
+	return output;
+}
+
+double elapsed(struct timespec *start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double nanoseconds = (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+	return nanoseconds / BENCHMARK_FRAMES;
+}
+
+double benchmarkLegacyHandoff(int consumers) {
+	LegacyOutput *output = malloc(sizeof(LegacyOutput));
+	output->outputBreadth = 0;
+	output->semaphores = NULL;
+	output->recentFrame = malloc(sizeof(LegacyFrame));
+	output->pool = benchmarkOutput();
+
+	LegacyInput *inputs[consumers];
+	pthread_t consumerThreads[consumers];
+	pthread_t producerThread;
+
+	int i;
+	for(i = 0; i < consumers; i++)
+		inputs[i] = legacyCreateInputBuffer(output);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for(i = 0; i < consumers; i++)
+		pthread_create(&consumerThreads[i], NULL, legacyConsumer, inputs[i]);
+	pthread_create(&producerThread, NULL, legacyProducer, output);
+
+	pthread_join(producerThread, NULL);
+	for(i = 0; i < consumers; i++)
+		pthread_join(consumerThreads[i], NULL);
+
+	return elapsed(&start);
+}
+
+double benchmarkHandoff(int consumers) {
+	MkvsynthOutput *output = benchmarkOutput();
+
+	MkvsynthInput *inputs[consumers];
+	pthread_t consumerThreads[consumers];
+	pthread_t producerThread;
+
+	int i;
+	for(i = 0; i < consumers; i++)
+		inputs[i] = createInputBuffer(output);
+	allocateBuffers(0);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for(i = 0; i < consumers; i++)
+		pthread_create(&consumerThreads[i], NULL, benchmarkConsumer, inputs[i]);
+	pthread_create(&producerThread, NULL, benchmarkProducer, output);
+
+	pthread_join(producerThread, NULL);
+	for(i = 0; i < consumers; i++)
+		pthread_join(consumerThreads[i], NULL);
+
+	return elapsed(&start);
+}
+
+int main(int argc, char *argv[]) {
+	int consumers[] = {1, 2, 4};
+
+	printf("consumers   semaphores and frame chain   ring\n");
+
+	int i;
+	for(i = 0; i < sizeof(consumers) / sizeof(consumers[0]); i++) {
+		double legacy = benchmarkLegacyHandoff(consumers[i]);
+		double ring = benchmarkHandoff(consumers[i]);
+		printf("%9i   %20.0f ns   %7.0f ns\n", consumers[i], legacy, ring);
+	}
+
+	return 0;
+}
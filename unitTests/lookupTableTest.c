@@ -0,0 +1,166 @@
+/******************************************************************************
+ * Checks that the lookup tables of colorspacing give exactly the same        *
+ * results as the code they stand in for. rowToRgb() and rowToYCbCr() are     *
+ * compared with getRed() and the rest for every possible 8 bit pixel, and    *
+ * convertSamples() on 8 bit samples is compared with widening the samples to *
+ * 16 bits first, for a million random pixels and every pair of models.       *
+ *                                                                            *
+ * Build and run with 'make lookuptest'.                                      *
+ *****************************************************************************/
+
+#include "../colorspacing/pixels.c"
+#include "../colorspacing/properties.c"
+#include "../colorspacing/conversion.c"
+#include "../colorspacing/dispatch.c"
+#include "../colorspacing/lookup.c"
+#include <stdarg.h>
+
+#define TEST_PIXELS 1000000
+
+void MkvsynthError(char const *error, ...) {
+	va_list arglist;
+	va_start(arglist, error);
+	vfprintf(stderr, error, arglist);
+	va_end(arglist);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+void MkvsynthMessage(char const *message, ...) {
+	va_list arglist;
+	va_start(arglist, message);
+	vfprintf(stdout, message, arglist);
+	va_end(arglist);
+	fprintf(stdout, "\n");
+}
+
+// Compares rowToRgb() (or rowToYCbCr()) with the functions of pixels.c for
+// every pixel of 'colorspace', one row of 256 pixels at a time
+static int testRow(c_space colorspace, int ycbcr) {
+	MkvsynthMetaData metaData = { .colorspace = colorspace, .width = 256 };
+	uint16_t samples[256 * 3];
+	int first, second, third, mismatches = 0;
+
+	for(first = 0; first < 256; first++) {
+		for(second = 0; second < 256; second++) {
+			for(third = 0; third < 256; third++) {
+				samples[3*third] = first;
+				samples[3*third + 1] = second;
+				samples[3*third + 2] = third;
+			}
+
+			if(ycbcr)
+				rowToYCbCr(samples, &metaData, 256);
+			else
+				rowToRgb(samples, &metaData, 256);
+
+			for(third = 0; third < 256; third++) {
+				MkvsynthPixel pixel = { .rgb24 = { first, second, third } };
+				uint16_t expected[3];
+				if(ycbcr) {
+					expected[0] = getLuma(&pixel, &metaData);
+					expected[1] = getCb(&pixel, &metaData);
+					expected[2] = getCr(&pixel, &metaData);
+				} else {
+					expected[0] = getRed(&pixel, &metaData);
+					expected[1] = getGreen(&pixel, &metaData);
+					expected[2] = getBlue(&pixel, &metaData);
+				}
+
+				mismatches += memcmp(expected, samples + 3*third, sizeof(expected)) != 0;
+			}
+		}
+	}
+
+	return mismatches;
+}
+
+// Compares converting 8 bit samples from 'from' to 'to' with widening them
+// to 16 bits by hand and converting from the 16 bit colorspace instead
+static int testConversion(c_space from, c_space deepFrom, c_space to) {
+	MkvsynthConversion *lookup = malloc(sizeof(MkvsynthConversion));
+	MkvsynthConversion *deep = malloc(sizeof(MkvsynthConversion));
+	prepareConversion(lookup, from, to, MKVS_BT601);
+	prepareConversion(deep, deepFrom, to, MKVS_BT601);
+
+	uint16_t *samples = malloc(TEST_PIXELS * 3 * sizeof(uint16_t));
+	uint16_t *expected = malloc(TEST_PIXELS * 3 * sizeof(uint16_t));
+
+	int i;
+	for(i = 0; i < TEST_PIXELS * 3; i++) {
+		samples[i] = rand() % 256;
+		if(deep->fromModel == MKVS_YUV444_48 && i % 3 != 0)
+			expected[i] = samples[i] << 8;
+		else
+			expected[i] = samples[i] * 257;
+	}
+
+	convertSamples(lookup, samples, TEST_PIXELS);
+	convertSamples(deep, expected, TEST_PIXELS);
+
+	int mismatches = 0;
+	for(i = 0; i < TEST_PIXELS * 3; i++)
+		mismatches += samples[i] != expected[i];
+
+	free(lookup);
+	free(deep);
+	free(samples);
+	free(expected);
+	return mismatches;
+}
+
+// Runs testConversion() for every pair of models, with the kernels of 'level'
+static int testConversions(char const *level) {
+	setenv("MKVSYNTH_CPU", level, 1);
+	setupKernels();
+	printf("Converting with the %s kernels\n", kernelLevelName(mkvsynthKernels.level));
+
+	c_space shallow[] = { MKVS_RGB24, MKVS_YUV444_24, MKVS_HSV24, MKVS_HSL24 };
+	c_space deep[] = { MKVS_RGB48, MKVS_YUV444_48, MKVS_HSV48, MKVS_HSL48 };
+	int count = sizeof(shallow) / sizeof(shallow[0]);
+
+	int i, j, failures = 0;
+	for(i = 0; i < count; i++) {
+		for(j = 0; j < count * 2; j++) {
+			c_space to = j < count ? shallow[j] : deep[j - count];
+			if(j % count == i)
+				continue;
+
+			int mismatches = testConversion(shallow[i], deep[i], to);
+			printf("convert %2i to %2i         %i mismatches\n", shallow[i], to, mismatches);
+			failures += mismatches != 0;
+		}
+	}
+
+	return failures;
+}
+
+int main(int argc, char *argv[]) {
+	int failures = 0;
+
+	struct {
+		char const *name;
+		c_space colorspace;
+		int ycbcr;
+	} rows[] = {
+		{ "rgb24 to RGB",       MKVS_RGB24,     0 },
+		{ "rgb24 to YCbCr",     MKVS_RGB24,     1 },
+		{ "yuv444_24 to RGB",   MKVS_YUV444_24, 0 },
+		{ "yuv444_24 to YCbCr", MKVS_YUV444_24, 1 },
+		{ "hsv24 to RGB",       MKVS_HSV24,     0 },
+	};
+
+	int i;
+	for(i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+		int mismatches = testRow(rows[i].colorspace, rows[i].ycbcr);
+		printf("%-24s %i mismatches\n", rows[i].name, mismatches);
+		failures += mismatches != 0;
+	}
+
+	// The matrix is only looked up at the scalar level, see widenSamples()
+	failures += testConversions("scalar");
+	failures += testConversions("avx512");
+
+	printf("%s\n", failures == 0 ? "All lookups match" : "Some lookups do not match");
+	return failures != 0;
+}